@@ -0,0 +1,181 @@
+/*
+ * Region of interest shared by the Pin tools of every lab.
+ *
+ * By default the whole run is the region. Each gate the tool enables keeps
+ * the region closed outside of:
+ *   function  a call to the function named, nested calls counted
+ *   window    instructions [skip, skip + len) of the run, len 0 for the rest
+ *   magic     the markers executed by the application, xchg %rcx,%rcx to
+ *             begin and xchg %rdx,%rdx to end, e.g.
+ *             __asm__ __volatile__("xchg %%rcx, %%rcx" ::: "memory");
+ * The region is active while every enabled gate is open. When it starts or
+ * stops, PIN_RemoveInstrumentation re-instruments all code, so the
+ * instrumentation functions of the tool insert their calls only while
+ * active(), and outside the region only the calls that watch the gates
+ * remain.
+ *
+ * The gates change from analysis routines on every application thread, so
+ * each change is serialized by the lock of the region.
+ */
+#ifndef REGION_OF_INTEREST_H
+#define REGION_OF_INTEREST_H
+
+#include <string>
+#include "pin.H"
+
+class RegionOfInterest
+{
+public:
+    RegionOfInterest()
+        : m_func_open(true), m_window_open(true), m_magic_open(true), m_active(true),
+          m_window(false), m_magic(false), m_skip(0), m_end(~0ul), m_depth(0), m_entries(1) {}
+
+    // Enable the gates asked for: the calls of func (empty for none), len instructions from skip
+    // on (both 0 for none) and the markers. Call from main after PIN_Init, even with no gate
+    void init(const std::string& func, UINT64 skip, UINT64 len, bool magic)
+    {
+        PIN_InitLock(&m_lock);
+
+        m_func = func;
+        if (!m_func.empty())
+        {
+            m_func_open = false;
+            PIN_InitSymbols();
+            IMG_AddInstrumentFunction(imageLoad, this);
+        }
+
+        m_window = skip || len;
+        m_skip = skip;
+        if (len) m_end = skip + len;
+        m_window_open = (skip == 0);
+
+        m_magic = magic;
+        m_magic_open = !magic;
+
+        m_active = m_func_open && m_window_open && m_magic_open;
+        m_entries = m_active ? 1 : 0;
+    }
+
+    bool active() const { return m_active; }
+
+    bool hasGates() const { return !m_func.empty() || m_window || m_magic; }
+
+    // 指令窗口需要在区域外也统计指令数
+    bool hasWindow() const { return m_window; }
+
+    // The number of times the region started, counting the start of the run if it was open then
+    UINT32 entries() const { return m_entries; }
+
+    // The instructions left from total until the window opens or closes, ~0 if it never does
+    UINT64 windowLeft(UINT64 total) const
+    {
+        if (m_window && total < m_skip) return m_skip - total;
+        if (m_window && total < m_end) return m_end - total;
+        return ~0ul;
+    }
+
+    // Open or close the window at total instructions of the run, inside the region or not
+    void updateWindow(UINT64 total)
+    {
+        if (!m_window) return;
+
+        bool open = (total >= m_skip && total < m_end);
+        if (open == m_window_open) return;
+
+        PIN_GetLock(&m_lock, 0);
+        m_window_open = open;
+        update();
+        PIN_ReleaseLock(&m_lock);
+    }
+
+    // Insert the call of a marker if ins is one; call for every instruction, inside the region or not
+    void instrumentMarker(INS ins)
+    {
+        if (!m_magic) return;
+
+        if (isMarker(ins, REG_RCX))
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)marker, IARG_PTR, this, IARG_BOOL, TRUE, IARG_END);
+        else if (isMarker(ins, REG_RDX))
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)marker, IARG_PTR, this, IARG_BOOL, FALSE, IARG_END);
+    }
+
+private:
+    PIN_LOCK m_lock;
+
+    bool m_func_open;
+    bool m_window_open;
+    bool m_magic_open;
+    volatile bool m_active;
+
+    std::string m_func;
+    bool m_window;
+    bool m_magic;
+    UINT64 m_skip;
+    UINT64 m_end;           // 窗口结束时的总指令数
+    UINT32 m_depth;         // Active calls of the function
+    UINT32 m_entries;
+
+    // Re-evaluate the gates, and re-instrument everything when the region starts or stops.
+    // The caller holds m_lock
+    void update()
+    {
+        bool active = m_func_open && m_window_open && m_magic_open;
+        if (active == m_active) return;
+
+        m_active = active;
+        if (active) m_entries++;
+        PIN_RemoveInstrumentation();
+    }
+
+    static VOID funcEnter(RegionOfInterest* roi)
+    {
+        PIN_GetLock(&roi->m_lock, 0);
+        if (roi->m_depth++ == 0)
+        {
+            roi->m_func_open = true;
+            roi->update();
+        }
+        PIN_ReleaseLock(&roi->m_lock);
+    }
+
+    static VOID funcExit(RegionOfInterest* roi)
+    {
+        PIN_GetLock(&roi->m_lock, 0);
+        if (roi->m_depth > 0 && --roi->m_depth == 0)
+        {
+            roi->m_func_open = false;
+            roi->update();
+        }
+        PIN_ReleaseLock(&roi->m_lock);
+    }
+
+    static VOID marker(RegionOfInterest* roi, BOOL begin)
+    {
+        PIN_GetLock(&roi->m_lock, 0);
+        roi->m_magic_open = begin;
+        roi->update();
+        PIN_ReleaseLock(&roi->m_lock);
+    }
+
+    // Instrument the entry and the returns of the function
+    static VOID imageLoad(IMG img, VOID* v)
+    {
+        RegionOfInterest* roi = (RegionOfInterest*)v;
+        RTN rtn = RTN_FindByName(img, roi->m_func.c_str());
+        if (!RTN_Valid(rtn)) return;
+
+        RTN_Open(rtn);
+        RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)funcEnter, IARG_PTR, roi, IARG_END);
+        RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)funcExit, IARG_PTR, roi, IARG_END);
+        RTN_Close(rtn);
+    }
+
+    // Return true if ins is the marker xchg reg,reg
+    static bool isMarker(INS ins, REG reg)
+    {
+        return INS_IsXchg(ins) && INS_OperandCount(ins) >= 2 && INS_OperandIsReg(ins, 0) && INS_OperandIsReg(ins, 1)
+            && INS_OperandReg(ins, 0) == reg && INS_OperandReg(ins, 1) == reg;
+    }
+};
+
+#endif
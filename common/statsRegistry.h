@@ -0,0 +1,284 @@
+/*
+ * Statistics registry shared by the Pin tools of every lab.
+ *
+ * A tool names its statistics once, and the registry exports all of them
+ * the same way, so one script can read the output of any tool:
+ *   - counters and histograms owned by the registry, which keep one slot
+ *     per thread so application threads add to them without locks;
+ *   - variables and arrays the tool already maintains, read by pointer
+ *     only when the statistics are written.
+ * Every interval of instructions the deltas of all statistics are appended
+ * to the file, and at Fini their totals.
+ *
+ * Two formats are supported, both written as the run goes:
+ *   json  one object per line (JSON Lines)
+ *           {"tool":"t","interval":1,"insts":N,"deltas":{"name":v,"hist":[...],...}}
+ *           {"tool":"t","interval":"total","insts":N,"counters":{...},"histograms":{"name":[...]}}
+ *   csv   tool,interval,insts,name,value; the bucket i of a histogram is
+ *         named name[i], and the totals have interval "total"
+ *
+ * Nothing here depends on Pin.
+ */
+#ifndef STATS_REGISTRY_H
+#define STATS_REGISTRY_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Threads with a larger id share one slot, updated atomically
+const uint32_t STATS_SLOTS = 64;
+
+/**************************************
+ * Per-Thread Counters
+**************************************/
+class StatCounter
+{
+public:
+    StatCounter() { memset(m_slots, 0, sizeof(m_slots)); }
+
+    void add(uint32_t tid, uint64_t n = 1)
+    {
+        if (tid < STATS_SLOTS) m_slots[tid].val += n;
+        else __sync_fetch_and_add(&m_slots[STATS_SLOTS].val, n);
+    }
+
+    uint64_t value() const
+    {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i <= STATS_SLOTS; i++) sum += m_slots[i].val;
+        return sum;
+    }
+
+private:
+    // 每个线程的槽位独占一个 Cache 行, 避免伪共享
+    struct Slot
+    {
+        uint64_t val;
+        char pad[56];
+    };
+
+    Slot m_slots[STATS_SLOTS + 1];
+};
+
+class StatHistogram
+{
+public:
+    // Values of bucket buckets - 1 or more are counted in the last bucket
+    StatHistogram(size_t buckets)
+        : m_buckets(buckets ? buckets : 1), m_stride((m_buckets + 7) & ~(size_t)7)
+    {
+        m_slots = new uint64_t[m_stride * (STATS_SLOTS + 1)]();
+    }
+
+    ~StatHistogram() { delete[] m_slots; }
+
+    void add(uint32_t tid, size_t bucket, uint64_t n = 1)
+    {
+        if (bucket >= m_buckets) bucket = m_buckets - 1;
+        if (tid < STATS_SLOTS) m_slots[tid * m_stride + bucket] += n;
+        else __sync_fetch_and_add(&m_slots[STATS_SLOTS * m_stride + bucket], n);
+    }
+
+    size_t getBuckets() const { return m_buckets; }
+
+    uint64_t value(size_t bucket) const
+    {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i <= STATS_SLOTS; i++) sum += m_slots[i * m_stride + bucket];
+        return sum;
+    }
+
+private:
+    size_t m_buckets;
+    size_t m_stride;        // 按 64 字节对齐的每线程桶数
+    uint64_t* m_slots;
+};
+
+/**************************************
+ * Registry
+**************************************/
+class StatsRegistry
+{
+public:
+    StatsRegistry(const std::string& tool)
+        : m_tool(tool), m_file(NULL), m_json(true), m_interval(0), m_next(~0ul), m_intervals(0) {}
+
+    ~StatsRegistry()
+    {
+        if (m_file) fclose(m_file);
+        for (size_t i = 0; i < m_counters.size(); i++) delete m_counters[i];
+        for (size_t i = 0; i < m_histograms.size(); i++) delete m_histograms[i];
+    }
+
+    // A counter owned by the registry
+    StatCounter& counter(const std::string& name)
+    {
+        StatCounter* c = new StatCounter();
+        m_counters.push_back(c);
+        addEntry(name, c, 1, readCounter, false);
+        return *c;
+    }
+
+    // A histogram owned by the registry
+    StatHistogram& histogram(const std::string& name, size_t buckets)
+    {
+        StatHistogram* h = new StatHistogram(buckets);
+        m_histograms.push_back(h);
+        addEntry(name, h, h->getBuckets(), readHistogram, true);
+        return *h;
+    }
+
+    // A counter the tool maintains itself
+    template <typename T>
+    void watch(const std::string& name, const T* value) { addEntry(name, value, 1, readValue<T>, false); }
+
+    // A histogram the tool maintains itself, as an array of n buckets
+    template <typename T>
+    void watchArray(const std::string& name, const T* values, size_t n) { addEntry(name, values, n, readValue<T>, true); }
+
+    // Write to path in format json or csv, with the deltas every interval instructions (0 for none).
+    // Return false if the format is unknown or the file cannot be created
+    bool open(const std::string& path, const std::string& format, uint64_t interval)
+    {
+        if (format != "json" && format != "csv") return false;
+
+        m_file = fopen(path.c_str(), "w");
+        if (m_file == NULL) return false;
+
+        m_json = (format == "json");
+        m_interval = interval;
+        m_next = interval ? interval : ~0ul;
+        if (!m_json) fprintf(m_file, "tool,interval,insts,name,value\n");
+        return true;
+    }
+
+    bool isOpen() { return m_file != NULL; }
+
+    // The instructions executed when the next interval is due, ~0 for none
+    uint64_t nextDue() const { return m_next; }
+
+    // Return true once another interval has passed, given the instructions executed so far
+    bool due(uint64_t insts) { return insts >= m_next; }
+
+    // Write the deltas of the counters and histograms since the previous interval
+    void writeInterval(uint64_t insts)
+    {
+        m_next = insts - insts % m_interval + m_interval;
+        if (m_file == NULL) return;
+
+        m_intervals++;
+        if (m_json)
+            fprintf(m_file, "{\"tool\":\"%s\",\"interval\":%lu,\"insts\":%lu,\"deltas\":{", m_tool.c_str(), m_intervals, insts);
+
+        const char* sep = "";
+        for (size_t i = 0; i < m_entries.size(); i++)
+        {
+            Entry& e = m_entries[i];
+            if (m_json) fprintf(m_file, e.histogram ? "%s\"%s\":[" : "%s\"%s\":", sep, e.name.c_str());
+            sep = ",";
+
+            for (size_t b = 0; b < e.n; b++)
+            {
+                uint64_t val = read(e, b);
+                if (m_json) fprintf(m_file, b ? ",%lu" : "%lu", val - e.last[b]);
+                else if (e.histogram) fprintf(m_file, "%s,%lu,%lu,%s[%lu],%lu\n", m_tool.c_str(), m_intervals, insts, e.name.c_str(), b, val - e.last[b]);
+                else fprintf(m_file, "%s,%lu,%lu,%s,%lu\n", m_tool.c_str(), m_intervals, insts, e.name.c_str(), val - e.last[b]);
+                e.last[b] = val;
+            }
+            if (m_json && e.histogram) fprintf(m_file, "]");
+        }
+
+        if (m_json) fprintf(m_file, "}}\n");
+        fflush(m_file);
+    }
+
+    // Write the totals and close the file
+    void close(uint64_t insts)
+    {
+        if (m_file == NULL) return;
+
+        if (m_json)
+        {
+            fprintf(m_file, "{\"tool\":\"%s\",\"interval\":\"total\",\"insts\":%lu,\"counters\":{", m_tool.c_str(), insts);
+            const char* sep = "";
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                if (m_entries[i].histogram) continue;
+                fprintf(m_file, "%s\"%s\":%lu", sep, m_entries[i].name.c_str(), read(m_entries[i], 0));
+                sep = ",";
+            }
+
+            fprintf(m_file, "},\"histograms\":{");
+            sep = "";
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                Entry& e = m_entries[i];
+                if (!e.histogram) continue;
+                fprintf(m_file, "%s\"%s\":[", sep, e.name.c_str());
+                for (size_t b = 0; b < e.n; b++) fprintf(m_file, b ? ",%lu" : "%lu", read(e, b));
+                fprintf(m_file, "]");
+                sep = ",";
+            }
+            fprintf(m_file, "}}\n");
+        }
+        else
+        {
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                Entry& e = m_entries[i];
+                if (!e.histogram)
+                {
+                    fprintf(m_file, "%s,total,%lu,%s,%lu\n", m_tool.c_str(), insts, e.name.c_str(), read(e, 0));
+                    continue;
+                }
+                for (size_t b = 0; b < e.n; b++)
+                    fprintf(m_file, "%s,total,%lu,%s[%lu],%lu\n", m_tool.c_str(), insts, e.name.c_str(), b, read(e, b));
+            }
+        }
+
+        fclose(m_file);
+        m_file = NULL;
+    }
+
+private:
+    typedef uint64_t (*Reader)(const void* src, size_t i);
+
+    struct Entry
+    {
+        std::string name;
+        const void* src;
+        size_t n;               // 1 for a counter
+        Reader reader;
+        bool histogram;
+        std::vector<uint64_t> last;     // The values at the end of the previous interval
+    };
+
+    std::string m_tool;
+    FILE* m_file;
+    bool m_json;
+    uint64_t m_interval;
+    uint64_t m_next;        // 下一次输出区间增量时的指令数
+    uint64_t m_intervals;
+    std::vector<Entry> m_entries;
+    std::vector<StatCounter*> m_counters;
+    std::vector<StatHistogram*> m_histograms;
+
+    template <typename T>
+    static uint64_t readValue(const void* src, size_t i) { return (uint64_t)((const T*)src)[i]; }
+
+    static uint64_t readCounter(const void* src, size_t i) { return ((const StatCounter*)src)->value(); }
+    static uint64_t readHistogram(const void* src, size_t i) { return ((const StatHistogram*)src)->value(i); }
+
+    static uint64_t read(const Entry& e, size_t i) { return e.reader(e.src, i); }
+
+    void addEntry(const std::string& name, const void* src, size_t n, Reader reader, bool histogram)
+    {
+        Entry e = { name, src, n, reader, histogram, std::vector<uint64_t>(n, 0) };
+        m_entries.push_back(e);
+    }
+};
+
+#endif // STATS_REGISTRY_H
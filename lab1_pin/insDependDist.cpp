@@ -13,6 +13,7 @@
 #include <fstream>
 #include <vector>
 #include "pin.H"
+#include "../common/statsRegistry.h"
 using std::cerr;
 using std::ofstream;
 using std::ios;
@@ -36,6 +37,11 @@ UINT64 *insDependDistance;
 INT32 maxSize;
 INT32 insPointer = 0;
 INT32 lastInsPointer[1024] = { 0 };
+// insPointer wraps after 2^31 instructions, so the statistics count in 64 bits
+UINT64 insCount = 0;
+
+// -stats exports the distance histogram, with its deltas every -stats_interval instructions
+StatsRegistry stats("insDependDist");
 
 // This function is called before every instruction is executed. 
 // You have to edit this function to determine the dependency distance
@@ -44,6 +50,8 @@ VOID updateInsDependDistance(VOID *v)
 {
 	// Update the instruction pointer
 	++insPointer;
+	if (stats.due(++insCount))
+		stats.writeInterval(insCount);
 
 	// regs contains the registers read and written by this instruction.
 	// regs->read contains the registers read.
@@ -123,6 +131,11 @@ KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "insDependDist.
 // This knob will set the maximum distance between two dependant instructions in the program
 KNOB<string> KnobMaxDistance(KNOB_MODE_WRITEONCE, "pintool", "s", "100", "specify the maximum distance between two dependant instructions in the program");
 
+// These knobs export the histogram for scripts
+KNOB<string> KnobStats(KNOB_MODE_WRITEONCE, "pintool", "stats", "", "also write the histogram to this file");
+KNOB<string> KnobStatsFormat(KNOB_MODE_WRITEONCE, "pintool", "stats_format", "json", "specify the format of -stats: json (one object per line) or csv");
+KNOB<UINT64> KnobStatsInterval(KNOB_MODE_WRITEONCE, "pintool", "stats_interval", "0", "also write the deltas of the histogram every this many instructions, 0 for the totals only");
+
 // This function is called when the application exits
 VOID Fini(INT32 code, VOID *v)
 {
@@ -131,6 +144,8 @@ VOID Fini(INT32 code, VOID *v)
     for (INT32 i = 0; i < maxSize; i++)
 	    OutFile << insDependDistance[i] << ",";
     OutFile.close();
+
+    stats.close(insCount);
 }
 
 /* ===================================================================== */
@@ -162,6 +177,17 @@ int main(int argc, char * argv[])
     insDependDistance = new UINT64[maxSize];
     memset((void*)insDependDistance, 0, sizeof(UINT64) * maxSize);
 
+    if (!KnobStats.Value().empty())
+    {
+        stats.watch("insts", &insCount);
+        stats.watchArray("dependence_distance", insDependDistance, maxSize);
+        if (!stats.open(KnobStats.Value(), KnobStatsFormat.Value(), KnobStatsInterval.Value()))
+        {
+            cerr << "Cannot write the statistics to " << KnobStats.Value() << " as " << KnobStatsFormat.Value() << endl;
+            return -1;
+        }
+    }
+
     // Register Instruction to be called to instrument instructions
     INS_AddInstrumentFunction(Instruction, 0);
 
@@ -5,6 +5,8 @@
 #include <cstdlib>
 #include <cstring>
 #include "pin.H"
+#include "../common/statsRegistry.h"
+#include "../common/regionOfInterest.h"
 
 using namespace std;
 
@@ -21,10 +23,14 @@ ofstream OutFile;
 // valض, ʹȱbits
 #define truncate(val, bits) ((val) & ((1 << (bits)) - 1))
 
-static UINT64 takenCorrect = 0;
-static UINT64 takenIncorrect = 0;
-static UINT64 notTakenCorrect = 0;
-static UINT64 notTakenIncorrect = 0;
+// The outcome counters keep one slot per thread, and -stats exports them
+StatsRegistry stats("brchPredict");
+PIN_LOCK stats_lock;
+
+static StatCounter& cntTakenCorrect = stats.counter("taken_correct");
+static StatCounter& cntTakenIncorrect = stats.counter("taken_incorrect");
+static StatCounter& cntNotTakenCorrect = stats.counter("not_taken_correct");
+static StatCounter& cntNotTakenIncorrect = stats.counter("not_taken_incorrect");
 
 // ͼ (N < 64)
 class SaturatingCnt
@@ -60,10 +66,10 @@ class ShiftReg
 
         bool shiftIn(bool b)
         {
-            bool ret = !!(m_val & (1 << (m_wid - 1)));
+            bool ret = !!(m_val & ((UINT128)1 << (m_wid - 1)));
             m_val <<= 1;
             m_val |= b;
-            m_val &= (1 << m_wid) - 1;
+            m_val &= ((UINT128)1 << m_wid) - 1;
             return ret;
         }
 
@@ -332,11 +338,13 @@ class TAGEPredictor: public BranchPredictor
         ~TAGEPredictor()
         {
             for (size_t i = 0; i < m_tnum; i++) delete m_T[i];
-            for (size_t i = 0; i < m_tnum; i++) delete[] m_useful[i];
+            for (size_t i = 1; i < m_tnum; i++) delete[] m_useful[i];
+            for (size_t i = 1; i < m_tnum; i++) delete[] m_tag[i];
 
             delete[] m_T;
             delete[] m_T_pred;
             delete[] m_useful;
+            delete[] m_tag;
         }
 
         bool predict(ADDRINT addr)
@@ -421,48 +429,375 @@ class TAGEPredictor: public BranchPredictor
 
 
 
-// This function is called every time a control-flow instruction is encountered
-void predictBranch(ADDRINT pc, BOOL direction)
+/* ===================================================================== */
+/* Compile-time specialized predictors                                   */
+/* ===================================================================== */
+/*   The predictors above with their geometry as template parameters:    */
+/*   table masks are constants, the loops over the TAGE tables have a    */
+/*   constant trip count, and predict/update are not virtual, so they    */
+/*   are inlined into the analysis routine of their configuration. A     */
+/*   configuration predicts exactly as the runtime one of the same        */
+/*   geometry; only alpha of TAGE must be an integer here.               */
+/* ===================================================================== */
+
+// Saturating counters of WIDTH bits, one per byte, as SaturatingCnt
+template<UINT32 WIDTH>
+struct ScntOps
+{
+    static const UINT8 MAX = (1 << WIDTH) - 1;
+    static const UINT8 INIT = (1 << WIDTH) / 2;
+
+    static void update(UINT8& cnt, bool taken)
+    {
+        if (taken) { if (cnt < MAX) cnt++; }
+        else if (cnt > 0) cnt--;
+    }
+
+    static bool isTaken(UINT8 cnt) { return cnt >= INIT; }
+};
+
+template<UINT32 ENTRIES_LOG, UINT32 SCNT_WIDTH = 2>
+class StaticBHTPredictor
+{
+    typedef ScntOps<SCNT_WIDTH> Scnt;
+    static const ADDRINT MASK = (1ul << ENTRIES_LOG) - 1;
+
+    UINT8 m_scnt[1 << ENTRIES_LOG];
+
+    public:
+        StaticBHTPredictor() { memset(m_scnt, Scnt::INIT, sizeof(m_scnt)); }
+
+        bool predict(ADDRINT addr) { return Scnt::isTaken(m_scnt[addr & MASK]); }
+
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            Scnt::update(m_scnt[addr & MASK], takenActually);
+        }
+};
+
+template<UINT128 (*hash)(UINT128 addr, UINT128 history), UINT32 GHR_WIDTH, UINT32 ENTRIES_LOG, UINT32 SCNT_WIDTH = 2>
+class StaticGlobalHistoryPredictor
+{
+    static_assert(GHR_WIDTH < 128, "the GHR is kept in 128 bits");
+
+    typedef ScntOps<SCNT_WIDTH> Scnt;
+    static const UINT32 MASK = (1u << ENTRIES_LOG) - 1;
+
+    UINT128 m_ghr;
+    UINT8 m_scnt[1 << ENTRIES_LOG];
+
+    UINT32 index(ADDRINT addr) { return hash(addr, m_ghr) & MASK; }
+
+    public:
+        StaticGlobalHistoryPredictor() : m_ghr(0) { memset(m_scnt, Scnt::INIT, sizeof(m_scnt)); }
+
+        bool predict(ADDRINT addr) { return Scnt::isTaken(m_scnt[index(addr)]); }
+
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            Scnt::update(m_scnt[index(addr)], takenActually);
+            m_ghr = ((m_ghr << 1) | takenActually) & ((((UINT128)1) << GHR_WIDTH) - 1);
+        }
+};
+
+template<class BP0, class BP1, UINT32 GSHR_WIDTH = 2>
+class StaticTournamentPredictor
+{
+    typedef ScntOps<GSHR_WIDTH> Scnt;
+
+    BP0 m_bp0;
+    BP1 m_bp1;
+    UINT8 m_gshr;
+
+    public:
+        StaticTournamentPredictor() : m_gshr(Scnt::INIT) {}
+
+        bool predict(ADDRINT addr) { return Scnt::isTaken(m_gshr) ? m_bp1.predict(addr) : m_bp0.predict(addr); }
+
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            m_bp0.update(takenActually, takenPredicted, addr);
+            m_bp1.update(takenActually, takenPredicted, addr);
+
+            // Like TournamentPredictor, the sub-predictors are compared after their update
+            bool result0 = m_bp0.predict(addr);
+            bool result1 = m_bp1.predict(addr);
+            if (result0 != result1) Scnt::update(m_gshr, result1 == takenActually);
+        }
+};
+
+// T[0] is a BHT of 2-bit counters, T[i] for i >= 1 a tagged global-history table whose GHR is
+// T1_GHR_LEN * ALPHA^(i-1) bits long
+template<UINT128 (*hash1)(UINT128 pc, UINT128 ghr), UINT128 (*hash2)(UINT128 pc, UINT128 ghr),
+         UINT32 TNUM, UINT32 T0_ENTRIES_LOG, UINT32 T1_GHR_LEN, UINT32 ALPHA, UINT32 TN_ENTRIES_LOG,
+         UINT32 SCNT_WIDTH = 3, UINT32 TAG_WIDTH = 3, UINT32 RST_PERIOD = 256 * 1024>
+class StaticTAGEPredictor
+{
+    typedef ScntOps<SCNT_WIDTH> Scnt;
+    static const UINT32 ENTRIES = 1 << TN_ENTRIES_LOG;
+    static const UINT32 TAG_MASK = (1u << TAG_WIDTH) - 1;
+
+    static constexpr UINT32 ghrLen(UINT32 i) { return i <= 1 ? T1_GHR_LEN : ghrLen(i - 1) * ALPHA; }
+
+    StaticBHTPredictor<T0_ENTRIES_LOG> m_T0;
+    UINT128 m_ghr[TNUM];
+    UINT8 m_scnt[TNUM][ENTRIES];
+    UINT8 m_useful[TNUM][ENTRIES];
+    UINT8 m_tag[TNUM][ENTRIES];
+    bool m_T_pred[TNUM];
+    UINT32 m_idx[TNUM];             // The entry of each table for the branch being predicted
+    UINT32 provider_indx;
+    UINT32 altpred_indx;
+    UINT32 m_rst_cnt;
+
+    UINT32 index(UINT32 i, ADDRINT addr) { return hash1(addr, m_ghr[i]) & (ENTRIES - 1); }
+    UINT32 tagOf(UINT32 i, ADDRINT addr) { return hash2(addr, m_ghr[i]) & TAG_MASK; }
+
+    public:
+        StaticTAGEPredictor() : provider_indx(0), altpred_indx(0), m_rst_cnt(0)
+        {
+            static_assert(TNUM >= 2 && ghrLen(TNUM - 1) < 128, "the GHRs are kept in 128 bits");
+            static_assert(TAG_WIDTH <= 8, "the tags are kept in 8 bits");
+
+            memset(m_ghr, 0, sizeof(m_ghr));
+            memset(m_scnt, Scnt::INIT, sizeof(m_scnt));
+            memset(m_useful, 0, sizeof(m_useful));
+            memset(m_tag, 0, sizeof(m_tag));
+        }
+
+        bool predict(ADDRINT addr)
+        {
+            m_T_pred[0] = m_T0.predict(addr);
+            provider_indx = 0;
+            altpred_indx = 0;
+
+            for (UINT32 i = 1; i < TNUM; i++)
+            {
+                m_idx[i] = index(i, addr);
+                m_T_pred[i] = Scnt::isTaken(m_scnt[i][m_idx[i]]);
+                if (m_tag[i][m_idx[i]] == tagOf(i, addr))
+                {
+                    altpred_indx = provider_indx;
+                    provider_indx = i;
+                }
+            }
+
+            return m_T_pred[provider_indx];
+        }
+
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            UINT32 p = provider_indx;
+            if (p == 0)
+            {
+                m_T0.update(takenActually, takenPredicted, addr);
+            }
+            else
+            {
+                Scnt::update(m_scnt[p][m_idx[p]], takenActually);
+                m_ghr[p] = ((m_ghr[p] << 1) | takenActually) & ((((UINT128)1) << ghrLen(p)) - 1);
+
+                // As in TAGEPredictor, the usefulness is indexed with the provider's new GHR
+                if (m_T_pred[p] != m_T_pred[altpred_indx])
+                {
+                    UINT8& useful = m_useful[p][index(p, addr)];
+                    if (m_T_pred[p] == takenActually) useful++;
+                    else if (useful > 0) useful--;
+                }
+            }
+
+            if (++m_rst_cnt == RST_PERIOD)
+            {
+                memset(m_useful, 0, sizeof(m_useful));
+                m_rst_cnt = 0;
+            }
+
+            bool find = false;
+            for (UINT32 i = p + 1; i < TNUM; i++)
+            {
+                if (m_useful[i][m_idx[i]] != 0) continue;
+                m_tag[i][m_idx[i]] = tagOf(i, addr);
+                m_scnt[i][m_idx[i]] = Scnt::INIT;
+                find = true;
+            }
+
+            if (!find)
+            {
+                for (UINT32 i = p + 1; i < TNUM; i++)
+                    if (m_useful[i][m_idx[i]] > 0) m_useful[i][m_idx[i]]--;
+            }
+        }
+};
+
+/* ===================================================================== */
+/* Region of Interest                                                    */
+/* ===================================================================== */
+/*   Branches are predicted only while every ROI gate given is open:     */
+/*   -roi_func foo, -roi_skip N -roi_len M (instruction window) and       */
+/*   -roi_magic (xchg %rcx,%rcx begins, xchg %rdx,%rdx ends), see         */
+/*   common/regionOfInterest.h.                                          */
+/* ===================================================================== */
+
+RegionOfInterest roi;
+
+UINT64 roi_insts = 0;
+UINT64 skipped_insts = 0;
+
+// Count the instructions of a basic block, only needed for the instruction window and -stats
+void countInsts(UINT32 num)
+{
+    if (roi.active()) roi_insts += num;
+    else skipped_insts += num;
+
+    if (stats.due(roi_insts))
+    {
+        PIN_GetLock(&stats_lock, 0);
+        if (stats.due(roi_insts)) stats.writeInterval(roi_insts);
+        PIN_ReleaseLock(&stats_lock);
+    }
+
+    roi.updateWindow(roi_insts + skipped_insts);
+}
+
+VOID Trace(TRACE trace, VOID * v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)countInsts, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+}
+
+// Count the outcome of one prediction
+inline void countOutcome(THREADID tid, BOOL prediction, BOOL direction)
 {
-    BOOL prediction = BP->predict(pc);
-    BP->update(direction, prediction, pc);
     if (prediction)
     {
         if (direction)
-            takenCorrect++;
+            cntTakenCorrect.add(tid);
         else
-            takenIncorrect++;
+            cntTakenIncorrect.add(tid);
     }
     else
     {
         if (direction)
-            notTakenIncorrect++;
+            cntNotTakenIncorrect.add(tid);
         else
-            notTakenCorrect++;
+            cntNotTakenCorrect.add(tid);
     }
 }
 
+// This function is called every time a control-flow instruction is encountered, with -bp dynamic
+void predictBranch(THREADID tid, ADDRINT pc, BOOL direction)
+{
+    BOOL prediction = BP->predict(pc);
+    BP->update(direction, prediction, pc);
+    countOutcome(tid, prediction, direction);
+}
+
+/* ===================================================================== */
+/* Predictor registry                                                    */
+/* ===================================================================== */
+/*   Every configuration compiled in has an analysis routine of its own, */
+/*   predictBranchWith<P>, with the predictor inlined. -bp selects one   */
+/*   by name; -bp dynamic predicts with BP as built in main instead.     */
+/*   To add a configuration, add a line to predictor_configs.            */
+/* ===================================================================== */
+
+void* static_bp;                // The predictor of the selected configuration
+AFUNPTR bp_analysis = (AFUNPTR)predictBranch;
+
+template<class P>
+void predictBranchWith(THREADID tid, ADDRINT pc, BOOL direction)
+{
+    P* bp = (P*)static_bp;
+    BOOL prediction = bp->predict(pc);
+    bp->update(direction, prediction, pc);
+    countOutcome(tid, prediction, direction);
+}
+
+template<class P> void* newPredictor() { return new P(); }
+template<class P> void deletePredictor(void* bp) { delete (P*)bp; }
+
+struct PredictorConfig
+{
+    const char* name;
+    const char* desc;
+    AFUNPTR analysis;
+    void* (*create)();
+    void (*destroy)(void*);
+};
+
+// The predictors of main, and a classic gshare
+typedef StaticBHTPredictor<15> BHT_15;
+typedef StaticGlobalHistoryPredictor<f_xor, 14, 14> Gshare_14;
+typedef StaticGlobalHistoryPredictor<f_xnor, 25, 15> GHR_25_15;
+typedef StaticTournamentPredictor<StaticGlobalHistoryPredictor<f_xor, 25, 15>,
+                                  StaticGlobalHistoryPredictor<f_xor1, 20, 15> > Tournament_25_20;
+typedef StaticTAGEPredictor<f_xnor, f_xor, 3, 12, 25, 5, 15, 2> TAGE_3_12_25_5_15;
+
+#define PREDICTOR_CONFIG(name, desc, P) \
+    { name, desc, (AFUNPTR)predictBranchWith<P>, newPredictor<P>, deletePredictor<P> }
+
+const PredictorConfig predictor_configs[] = {
+    PREDICTOR_CONFIG("bht",         "BHT of 2^15 2-bit counters", BHT_15),
+    PREDICTOR_CONFIG("gshare",      "14-bit GHR xor PC indexing 2^14 2-bit counters", Gshare_14),
+    PREDICTOR_CONFIG("ghr",         "25-bit GHR xnor PC indexing 2^15 2-bit counters", GHR_25_15),
+    PREDICTOR_CONFIG("tournament",  "tournament of a 25-bit and a 20-bit GHR predictor", Tournament_25_20),
+    PREDICTOR_CONFIG("tage",        "TAGE of a 2^12 BHT and 2 tagged tables of 2^15 entries, 25 and 125 bits of history", TAGE_3_12_25_5_15),
+};
+
+const PredictorConfig* bp_config;
+
+// The configuration named name, NULL if there is none
+const PredictorConfig* findPredictorConfig(const string& name)
+{
+    for (size_t i = 0; i < sizeof(predictor_configs) / sizeof(predictor_configs[0]); i++)
+        if (name == predictor_configs[i].name) return &predictor_configs[i];
+    return NULL;
+}
+
 // Pin calls this function every time a new instruction is encountered
 void Instruction(INS ins, void * v)
 {
+    roi.instrumentMarker(ins);
+    if (!roi.active()) return;
+
     if (INS_IsControlFlow(ins) && INS_HasFallThrough(ins))
     {
         // Insert a call to the branch target
-        INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)predictBranch,
-                        IARG_INST_PTR, IARG_BOOL, TRUE, IARG_END);
+        INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, bp_analysis,
+                        IARG_THREAD_ID, IARG_INST_PTR, IARG_BOOL, TRUE, IARG_END);
 
         // Insert a call to the next instruction of a branch
-        INS_InsertCall(ins, IPOINT_AFTER, (AFUNPTR)predictBranch,
-                        IARG_INST_PTR, IARG_BOOL, FALSE, IARG_END);
+        INS_InsertCall(ins, IPOINT_AFTER, bp_analysis,
+                        IARG_THREAD_ID, IARG_INST_PTR, IARG_BOOL, FALSE, IARG_END);
     }
 }
 
 // This knob sets the output file name
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "brchPredict.txt", "specify the output file name");
 
+// This knob selects the predictor
+KNOB<string> KnobPredictor(KNOB_MODE_WRITEONCE, "pintool", "bp", "tage", "specify the predictor: bht, gshare, ghr, tournament or tage compiled in, or dynamic for the one built in main");
+
+// These knobs restrict the prediction to a region of interest
+KNOB<string> KnobRoiFunc(KNOB_MODE_WRITEONCE, "pintool", "roi_func", "", "predict only while a call to this function is active");
+KNOB<UINT64> KnobRoiSkip(KNOB_MODE_WRITEONCE, "pintool", "roi_skip", "0", "predict from this instruction on");
+KNOB<UINT64> KnobRoiLen(KNOB_MODE_WRITEONCE, "pintool", "roi_len", "0", "predict for this many instructions, 0 for the rest of the run");
+KNOB<BOOL> KnobRoiMagic(KNOB_MODE_WRITEONCE, "pintool", "roi_magic", "0", "predict only between the markers xchg %rcx,%rcx and xchg %rdx,%rdx");
+
+// These knobs export the counters for scripts
+KNOB<string> KnobStats(KNOB_MODE_WRITEONCE, "pintool", "stats", "", "also write the counters to this file");
+KNOB<string> KnobStatsFormat(KNOB_MODE_WRITEONCE, "pintool", "stats_format", "json", "specify the format of -stats: json (one object per line) or csv");
+KNOB<UINT64> KnobStatsInterval(KNOB_MODE_WRITEONCE, "pintool", "stats_interval", "0", "also write the deltas of the counters every this many instructions, 0 for the totals only");
+
 // This function is called when the application exits
 VOID Fini(int, VOID * v)
 {
+    stats.close(roi_insts);
+
+    UINT64 takenCorrect = cntTakenCorrect.value();
+    UINT64 takenIncorrect = cntTakenIncorrect.value();
+    UINT64 notTakenCorrect = cntNotTakenCorrect.value();
+    UINT64 notTakenIncorrect = cntNotTakenIncorrect.value();
 	double precision = 100 * double(takenCorrect + notTakenCorrect) / (takenCorrect + notTakenCorrect + takenIncorrect + notTakenIncorrect);
     
     cout << "takenCorrect: " << takenCorrect << endl
@@ -477,9 +812,17 @@ VOID Fini(int, VOID * v)
     	<< "notTakenCorrect: " << notTakenCorrect << endl
     	<< "nnotTakenIncorrect: " << notTakenIncorrect << endl
     	<< "Precision: " << precision << endl;
+
+    // Instructions are only counted for the instruction window
+    if (roi.hasWindow())
+    {
+        cout << "ROI instructions: " << roi_insts << ", skipped: " << skipped_insts << endl;
+        OutFile << "ROI instructions: " << roi_insts << ", skipped: " << skipped_insts << endl;
+    }
     
     OutFile.close();
     delete BP;
+    if (bp_config) bp_config->destroy(static_bp);
 }
 
 /* ===================================================================== */
@@ -501,19 +844,50 @@ INT32 Usage()
 
 int main(int argc, char * argv[])
 {
-    // TODO: New your Predictor below.
-    BP = new BHTPredictor(15); //  BHT ķ֧Ԥ
-    BP = new GlobalHistoryPredictor<f_xnor>(25, 15); // ȫʷķ֧Ԥ
-    BranchPredictor* BP0 = new GlobalHistoryPredictor<f_xor>(25, 15);
-    BranchPredictor* BP1 = new GlobalHistoryPredictor<f_xor1>(20, 15);
-    BP = new TournamentPredictor(BP0, BP1); // ֧Ԥ
-    BP = new TAGEPredictor<f_xnor, f_xor>(3, 12, 25, 5, 15, 2); //  Tage ķ֧Ԥ
-
     // Initialize pin
     if (PIN_Init(argc, argv)) return Usage();
-    
+
+    bp_config = findPredictorConfig(KnobPredictor.Value());
+    if (bp_config)
+    {
+        static_bp = bp_config->create();
+        bp_analysis = bp_config->analysis;
+    }
+    else if (KnobPredictor.Value() == "dynamic")
+    {
+        // TODO: New your Predictor below.
+        BP = new BHTPredictor(15); //  BHT ķ֧Ԥ
+        BP = new GlobalHistoryPredictor<f_xnor>(25, 15); // ȫʷķ֧Ԥ
+        BranchPredictor* BP0 = new GlobalHistoryPredictor<f_xor>(25, 15);
+        BranchPredictor* BP1 = new GlobalHistoryPredictor<f_xor1>(20, 15);
+        BP = new TournamentPredictor(BP0, BP1); // ֧Ԥ
+        BP = new TAGEPredictor<f_xnor, f_xor>(3, 12, 25, 5, 15, 2); //  Tage ķ֧Ԥ
+    }
+    else
+    {
+        cerr << "Unknown predictor " << KnobPredictor.Value() << ", expected dynamic or one of" << endl;
+        for (size_t i = 0; i < sizeof(predictor_configs) / sizeof(predictor_configs[0]); i++)
+            cerr << "  " << predictor_configs[i].name << ": " << predictor_configs[i].desc << endl;
+        return -1;
+    }
+
     OutFile.open(KnobOutputFile.Value().c_str());
 
+    // Close the ROI gates that were asked for
+    roi.init(KnobRoiFunc.Value(), KnobRoiSkip.Value(), KnobRoiLen.Value(), KnobRoiMagic.Value());
+
+    if (!KnobStats.Value().empty())
+    {
+        stats.watch("insts", &roi_insts);
+        PIN_InitLock(&stats_lock);
+        if (!stats.open(KnobStats.Value(), KnobStatsFormat.Value(), KnobStatsInterval.Value()))
+        {
+            cerr << "Cannot write the statistics to " << KnobStats.Value() << " as " << KnobStatsFormat.Value() << endl;
+            return -1;
+        }
+    }
+    if (roi.hasWindow() || stats.isOpen()) TRACE_AddInstrumentFunction(Trace, 0);
+
     // Register Instruction to be called to instrument instructions
     INS_AddInstrumentFunction(Instruction, 0);
 
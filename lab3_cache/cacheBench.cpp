@@ -0,0 +1,339 @@
+/*
+ * Throughput benchmark of the cache models, without Pin: every model is driven
+ * by generated access streams over a grid of cache sizes and associativities,
+ * and the time per simulated access is reported with the hit rate, one result
+ * per line as CSV or JSON, to track the speed of the simulator as it grows.
+ *
+ * Build: g++ -O2 -std=c++11 -o cacheBench cacheBench.cpp
+ * Usage: cacheBench [-models fa,sa,vivt,pipt,vipt] [-streams seq,stride,random,zipf,chase] [-size 12,16] [-asso 1,4,16] ...
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include "cacheModel.h"
+
+struct Option
+{
+    const char* name;
+    string value;
+    const char* desc;
+};
+
+Option options[] = {
+    { "models",     "fa,sa,vivt,pipt,vipt",             "the models to time: fa, sa, vivt, pipt or vipt" },
+    { "streams",    "seq,stride,random,zipf,chase",     "the access streams: seq, stride, random, zipf or chase" },
+    { "p",          "lru",      "the replacement policy: lru, plru, nru, srrip, brrip, drrip, random or fifo" },
+    { "b",          "6",        "the log of the block size in bytes" },
+    { "size",       "12,16",    "the range of the log of the cache size in bytes" },
+    { "asso",       "1,4,16",   "the associativities of the set-associative models" },
+    { "n",          "1048576",  "the number of accesses of every stream" },
+    { "footprint",  "22",       "the log of the bytes every stream touches" },
+    { "stride",     "256",      "the stride of the stride stream in bytes" },
+    { "zipf",       "0.99",     "the exponent of the zipf stream" },
+    { "writes",     "0.25",     "the fraction of accesses that are writes" },
+    { "reps",       "3",        "time every run this many times and keep the fastest" },
+    { "format",     "csv",      "csv or json (one object per line)" },
+    { "seed",       "1",        "the seed of the generated streams" },
+};
+
+const UINT32 OPTION_NUM = sizeof(options) / sizeof(options[0]);
+
+Option* findOption(const char* name)
+{
+    for (UINT32 i = 0; i < OPTION_NUM; i++)
+        if (strcmp(options[i].name, name) == 0) return &options[i];
+    return NULL;
+}
+
+const string& optStr(const char* name) { return findOption(name)->value; }
+UINT32 optInt(const char* name) { return strtoul(optStr(name).c_str(), NULL, 0); }
+
+void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    for (UINT32 i = 0; i < OPTION_NUM; i++)
+        fprintf(stderr, "  -%-10s %-30s %s\n", options[i].name, options[i].value.c_str(), options[i].desc);
+}
+
+// The streams start here, like a heap
+#define STREAM_BASE     0x10000000ul
+#define ACCESS_SIZE     8
+
+/**************************************
+ * Access Streams
+ *
+ * Every stream is generated before it is timed, as 8-byte accesses within
+ * a footprint of 2^footprint bytes:
+ *   seq     consecutive words, wrapping around
+ *   stride  one word every stride bytes, wrapping around
+ *   random  uniformly random words
+ *   zipf    words of lines ranked by a zipf distribution, the hot lines
+ *           scattered over the footprint
+ *   chase   the lines in the order a pointer chase over a random cyclic
+ *           permutation visits them
+**************************************/
+struct Access
+{
+    UINT64 addr;
+    bool is_write;
+};
+
+UINT64 nextRand64(UINT64& state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// A random permutation of [0, n), as one cycle if cyclic (Sattolo's algorithm)
+vector<UINT64> randomPermutation(UINT64 n, bool cyclic, UINT64& seed)
+{
+    vector<UINT64> perm(n);
+    for (UINT64 i = 0; i < n; i++) perm[i] = i;
+    for (UINT64 i = n - 1; i > 0; i--)
+    {
+        UINT64 j = nextRand64(seed) % (cyclic ? i : i + 1);
+        std::swap(perm[i], perm[j]);
+    }
+    return perm;
+}
+
+// Generate the stream kind, return false if there is no such stream
+bool genStream(const string& kind, UINT64 n, UINT32 footprint_log, UINT32 line_log, UINT64 stride,
+               double zipf, double writes, UINT64 seed, vector<Access>& stream)
+{
+    UINT64 footprint = 1ul << footprint_log;
+    UINT64 lines = footprint >> line_log;
+    UINT64 words_per_line = (1ul << line_log) / ACCESS_SIZE;
+    // writes 为 1 时 2^64 超出 UINT64 的范围, 此时每次访问都是写
+    bool all_writes = (writes >= 1);
+    UINT64 write_limit = all_writes ? 0 : (UINT64)(writes * (double)~0ul);
+    if (words_per_line == 0) words_per_line = 1;
+
+    vector<UINT64> perm;
+    vector<double> cdf;
+    if (kind == "zipf")
+    {
+        perm = randomPermutation(lines, false, seed);
+        cdf.resize(lines);
+        double sum = 0;
+        for (UINT64 i = 0; i < lines; i++) cdf[i] = (sum += 1.0 / pow((double)(i + 1), zipf));
+        for (UINT64 i = 0; i < lines; i++) cdf[i] /= sum;
+    }
+    else if (kind == "chase")
+    {
+        perm = randomPermutation(lines, true, seed);
+    }
+    else if (kind != "seq" && kind != "stride" && kind != "random")
+    {
+        return false;
+    }
+
+    stream.resize(n);
+    UINT64 offset = 0, line = 0;
+    for (UINT64 i = 0; i < n; i++)
+    {
+        if (kind == "seq") offset = (i * ACCESS_SIZE) & (footprint - 1);
+        else if (kind == "stride") offset = (i * stride) & (footprint - 1) & ~(UINT64)(ACCESS_SIZE - 1);
+        else if (kind == "random") offset = (nextRand64(seed) & (footprint - 1)) & ~(UINT64)(ACCESS_SIZE - 1);
+        else if (kind == "zipf")
+        {
+            double u = (double)(nextRand64(seed) >> 11) / (1ul << 53);
+            UINT64 rank = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+            if (rank >= lines) rank = lines - 1;
+            offset = (perm[rank] << line_log) + (nextRand64(seed) % words_per_line) * ACCESS_SIZE;
+        }
+        else
+        {
+            line = perm[line];
+            offset = line << line_log;
+        }
+
+        stream[i].addr = STREAM_BASE + offset;
+        stream[i].is_write = all_writes || nextRand64(seed) < write_limit;
+    }
+    return true;
+}
+
+/**************************************
+ * Runs
+**************************************/
+
+// Build the model name with size_log bytes of 2^line_log-byte blocks, NULL if the geometry does
+// not fit or the name or the policy is unknown. Fully associative models ignore asso
+CacheModel* newBenchModel(const string& name, const string& policy, UINT32 size_log, UINT32 line_log, UINT32 asso)
+{
+    if (size_log < line_log) return NULL;
+    UINT32 blocks = 1u << (size_log - line_log);
+    if (name == "fa") return newCacheModel<FullAssoCache>(policy, blocks, line_log);
+
+    if (asso == 0 || (asso & (asso - 1)) || asso > blocks) return NULL;
+    UINT32 log_sets = 0;
+    while ((asso << log_sets) < blocks) log_sets++;
+
+    if (name == "sa")   return newCacheModel<SetAssoCache>(policy, log_sets, line_log, asso);
+    if (name == "vivt") return newCacheModel<SetAssoCache_VIVT>(policy, log_sets, line_log, asso);
+    if (name == "pipt") return newCacheModel<SetAssoCache_PIPT>(policy, log_sets, line_log, asso);
+    if (name == "vipt") return newCacheModel<SetAssoCache_VIPT>(policy, log_sets, line_log, asso);
+    return NULL;
+}
+
+double nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct RunResult
+{
+    double ns;              // 最快一次的总时间
+    UINT64 reqs;
+    UINT64 hits;
+};
+
+// Simulate the stream on a fresh model reps times. Return false if the model cannot be built
+bool runModel(const string& name, const string& policy, UINT32 size_log, UINT32 line_log, UINT32 asso,
+              const vector<Access>& stream, UINT32 reps, RunResult& result)
+{
+    result.ns = 0;
+    for (UINT32 r = 0; r < reps; r++)
+    {
+        CacheModel* cache = newBenchModel(name, policy, size_log, line_log, asso);
+        if (cache == NULL) return false;
+
+        double start = nowNs();
+        for (size_t i = 0; i < stream.size(); i++)
+        {
+            if (stream[i].is_write) cache->writeReq(stream[i].addr, ACCESS_SIZE);
+            else cache->readReq(stream[i].addr, ACCESS_SIZE);
+        }
+        double ns = nowNs() - start;
+
+        if (r == 0 || ns < result.ns) result.ns = ns;
+        result.reqs = cache->getReqs();
+        result.hits = cache->getHits();
+        delete cache;
+    }
+    return true;
+}
+
+void printResult(bool json, const string& model, const string& policy, const string& stream, UINT32 size_log,
+                 UINT32 line_log, UINT32 asso, const RunResult& r)
+{
+    double ns_per_access = r.ns / r.reqs;
+    double hit_rate = (double)r.hits / r.reqs;
+    if (json)
+        printf("{\"model\":\"%s\",\"policy\":\"%s\",\"stream\":\"%s\",\"size\":%lu,\"asso\":%u,\"block\":%lu,"
+               "\"accesses\":%lu,\"ns_per_access\":%.3f,\"accesses_per_s\":%.0f,\"hit_rate\":%.6f}\n",
+               model.c_str(), policy.c_str(), stream.c_str(), 1ul << size_log, asso, 1ul << line_log,
+               r.reqs, ns_per_access, 1e9 / ns_per_access, hit_rate);
+    else
+        printf("%s,%s,%s,%lu,%u,%lu,%lu,%.3f,%.0f,%.6f\n", model.c_str(), policy.c_str(), stream.c_str(),
+               1ul << size_log, asso, 1ul << line_log, r.reqs, ns_per_access, 1e9 / ns_per_access, hit_rate);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        Option* opt = (argv[i][0] == '-') ? findOption(argv[i] + 1) : NULL;
+        if (opt == NULL || i + 1 >= argc)
+        {
+            usage(argv[0]);
+            return -1;
+        }
+        opt->value = argv[++i];
+    }
+
+    string policy = optStr("p");
+    UINT32 line_log = optInt("b");
+    UINT32 footprint_log = optInt("footprint");
+    UINT32 reps = optInt("reps");
+    bool json = (optStr("format") == "json");
+
+    UINT32 min_size, max_size;
+    if (sscanf(optStr("size").c_str(), "%u,%u", &min_size, &max_size) != 2 || min_size > max_size
+        || min_size < line_log || max_size > 30 || footprint_log < line_log || footprint_log > 40 || reps == 0
+        || (!json && optStr("format") != "csv"))
+    {
+        fprintf(stderr, "Malformed benchmark, expected -size min_log,max_log of at least -b, -footprint -b..40, "
+                        "-reps 1 or more and -format csv|json\n");
+        return -1;
+    }
+
+    double writes = atof(optStr("writes").c_str());
+    if (!(writes >= 0 && writes <= 1))
+    {
+        fprintf(stderr, "The write fraction must be in [0, 1]: %s\n", optStr("writes").c_str());
+        return -1;
+    }
+    if (optInt("n") == 0)
+    {
+        fprintf(stderr, "The stream needs at least one access, -n must be 1 or more\n");
+        return -1;
+    }
+
+    CacheModel* probe = newCacheModel<SetAssoCache>(policy, 0u, line_log, 1u);
+    if (probe == NULL)
+    {
+        fprintf(stderr, "Unknown replacement policy: %s\n", policy.c_str());
+        return -1;
+    }
+    delete probe;
+
+    vector<string> models = splitList(optStr("models"));
+    vector<string> streams = splitList(optStr("streams"));
+    vector<string> assos = splitList(optStr("asso"));
+    for (size_t m = 0; m < models.size(); m++)
+    {
+        if (models[m] != "fa" && models[m] != "sa" && models[m] != "vivt" && models[m] != "pipt" && models[m] != "vipt")
+        {
+            fprintf(stderr, "Unknown model %s, expected fa, sa, vivt, pipt or vipt\n", models[m].c_str());
+            return -1;
+        }
+    }
+    for (size_t a = 0; a < assos.size(); a++)
+    {
+        UINT32 asso = strtoul(assos[a].c_str(), NULL, 0);
+        if (asso == 0 || (asso & (asso - 1)))
+        {
+            fprintf(stderr, "The associativity must be a power of two: %s\n", assos[a].c_str());
+            return -1;
+        }
+    }
+
+    if (!json) printf("model,policy,stream,size,asso,block,accesses,ns_per_access,accesses_per_s,hit_rate\n");
+
+    for (size_t s = 0; s < streams.size(); s++)
+    {
+        vector<Access> stream;
+        if (!genStream(streams[s], optInt("n"), footprint_log, line_log, optInt("stride"), atof(optStr("zipf").c_str()),
+                       writes, optInt("seed") | 1, stream) || stream.empty())
+        {
+            fprintf(stderr, "Unknown stream %s, expected seq, stride, random, zipf or chase\n", streams[s].c_str());
+            return -1;
+        }
+
+        for (size_t m = 0; m < models.size(); m++)
+        {
+            for (UINT32 size_log = min_size; size_log <= max_size; size_log++)
+            {
+                // 全相联只有一种相联度
+                size_t asso_num = (models[m] == "fa") ? 1 : assos.size();
+                for (size_t a = 0; a < asso_num; a++)
+                {
+                    UINT32 asso = (models[m] == "fa") ? 1u << (size_log - line_log) : strtoul(assos[a].c_str(), NULL, 0);
+                    // 相联度超过块数的组合跳过
+                    RunResult result;
+                    if (!runModel(models[m], policy, size_log, line_log, asso, stream, reps, result)) continue;
+                    printResult(json, models[m], policy, streams[s], size_log, line_log, asso, result);
+                }
+            }
+        }
+    }
+    return 0;
+}
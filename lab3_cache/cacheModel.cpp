@@ -1,455 +1,1090 @@
 #include <cstdio>
 #include <cmath>
 #include <ctime>
+#include <string>
+#include <vector>
+#include <cstddef>
 #include "pin.H"
+#include "cacheModel.h"
+#include "memTrace.h"
+#include "../common/regionOfInterest.h"
 
-typedef unsigned int        UINT32;
-typedef unsigned long int   UINT64;
+CacheModel* my_fa_cache;
+CacheModel* my_sa_cache;
+CacheModel* my_sa_cache_vivt;
+CacheModel* my_sa_cache_pipt;
+CacheModel* my_sa_cache_vipt;
+
+// -org 所列的其它组织方式, 与 my_sa_cache 几何参数相同
+vector<CacheModel*> my_org_caches;
+vector<string> my_org_names;
+
+CacheHierarchy* my_hierarchy;
+MMU* my_mmu;
+MissRatioCurve* my_mrc;
+SampledReuseDistance* my_shards;
+MissAttribution* my_attrib;
+CoherentCaches* my_coherence;
+
+UINT64 inst_count = 0;      // The number of instructions executed inside the region of interest
+UINT64 measured_insts = 0;  // 其中各模型都看到其访存的指令数, 即除去 -sample 预热阶段的指令
 
+// -stats 导出的各模型计数器, 每 -stats_interval 条指令输出一次增量
+StatsRegistry stats("cacheModel");
 
-#define PAGE_SIZE_LOG       12
-#define PHY_MEM_SIZE_LOG    30
+UINT32 line_size_log;       // 访问按此粒度拆分, 与各 Cache 的块大小相同
 
-#define get_vir_page_no(virtual_addr)   (virtual_addr >> PAGE_SIZE_LOG)
-#define get_page_offset(addr)           (addr & ((1u << PAGE_SIZE_LOG) - 1))
+UINT32 core_num;            // 线程 tid 运行在核 tid % core_num 上
 
-// Obtain physical page number according to a given virtual page number
-UINT32 get_phy_page_no(UINT32 virtual_page_no)
+// 应用线程直接模拟时, 串行化各线程对共享模型的更新以及 malloc/free 包装函数对分配表的修改
+PIN_LOCK sim_lock;
+
+volatile bool sample_warming = false;   // -sample 的预热阶段只更新被采样模型的状态
+
+// Functional warming: update the state of the sampled models, without counting; the caller holds sim_lock
+inline void warmLine(UINT64 addr)
+{
+    my_fa_cache->warmReq(addr);
+    my_sa_cache->warmReq(addr);
+    my_sa_cache_vivt->warmReq(addr);
+    my_sa_cache_pipt->warmReq(addr);
+    my_sa_cache_vipt->warmReq(addr);
+}
+
+// Update every model with one access that stays within a line; the caller holds sim_lock
+inline void accessLine(THREADID tid, ADDRINT pc, UINT64 addr, UINT32 size, bool is_write)
 {
-    UINT32 vpn = virtual_page_no;
-    vpn = (~vpn ^ (vpn << 16)) + (vpn & (vpn << 16)) + (~vpn | (vpn << 2));
+    // 写共享页时先复制, 各模型随后看到的是写者自己的页框
+    if (is_write && page_allocator) page_allocator->translate(addr, true);
+
+    if (sample_warming)
+    {
+        warmLine(addr);
+        return;
+    }
 
-    UINT32 mask = (UINT32)(~0) << (32 - PHY_MEM_SIZE_LOG);
-    mask = mask >> (32 - PHY_MEM_SIZE_LOG + PAGE_SIZE_LOG);
-    mask = mask << PAGE_SIZE_LOG;
+    if (my_mmu) my_mmu->translate(addr);
+    if (my_mrc) my_mrc->access(addr);
+    if (my_shards) my_shards->access(addr);
+    if (my_coherence) my_coherence->access(tid % core_num, pc, addr, size, is_write);
 
-    return vpn & mask;
+    if (is_write)
+    {
+        my_fa_cache->writeReq(addr, size);
+        bool hit = my_sa_cache->writeReq(addr, size);
+
+        my_sa_cache_vivt->writeReq(addr, size);
+        my_sa_cache_pipt->writeReq(addr, size);
+        my_sa_cache_vipt->writeReq(addr, size);
+        for (size_t i = 0; i < my_org_caches.size(); i++) my_org_caches[i]->writeReq(addr, size);
+
+        if (my_hierarchy) my_hierarchy->write(get_hier_addr(addr), size, pc);
+        if (my_attrib) my_attrib->record(pc, addr, hit);
+    }
+    else
+    {
+        my_fa_cache->readReq(addr, size);
+        bool hit = my_sa_cache->readReq(addr, size);
+
+        my_sa_cache_vivt->readReq(addr, size);
+        my_sa_cache_pipt->readReq(addr, size);
+        my_sa_cache_vipt->readReq(addr, size);
+        for (size_t i = 0; i < my_org_caches.size(); i++) my_org_caches[i]->readReq(addr, size);
+
+        if (my_hierarchy) my_hierarchy->read(get_hier_addr(addr), size, pc);
+        if (my_attrib) my_attrib->record(pc, addr, hit);
+    }
 }
 
-// Transform a virtual address into a physical address
-UINT32 get_phy_addr(UINT32 virtual_addr)
+// Split [mem_addr, mem_addr + size) into the lines it touches
+inline void accessMem(THREADID tid, ADDRINT pc, ADDRINT mem_addr, UINT32 size, bool is_write)
 {
-    return (get_phy_page_no(get_vir_page_no(virtual_addr)) << PAGE_SIZE_LOG) + get_page_offset(virtual_addr);
+    PIN_GetLock(&sim_lock, tid + 1);
+    UINT64 end = mem_addr + size;
+    for (UINT64 addr = mem_addr, next; addr < end; addr = next)
+    {
+        next = lineChunkEnd(addr, end, line_size_log);
+        accessLine(tid, pc, addr, next - addr, is_write);
+    }
+    PIN_ReleaseLock(&sim_lock);
 }
 
-/**************************************
- * Cache Model Base Class
-**************************************/
-class CacheModel
+// Cache reading analysis routine, called once per read memory operand
+void readCache(THREADID tid, ADDRINT pc, ADDRINT mem_addr, UINT32 size) { accessMem(tid, pc, mem_addr, size, false); }
+
+// Cache writing analysis routine, called once per written memory operand
+void writeCache(THREADID tid, ADDRINT pc, ADDRINT mem_addr, UINT32 size) { accessMem(tid, pc, mem_addr, size, true); }
+
+// Gather/scatter analysis routine, one access per element that is not masked off
+void accessMultiMem(THREADID tid, ADDRINT pc, PIN_MULTI_MEM_ACCESS_INFO* info)
 {
-public:
-    // Constructor
-    CacheModel(UINT32 block_num, UINT32 log_block_size)
-        : m_block_num(block_num), m_blksz_log(log_block_size),
-          m_rd_reqs(0), m_wr_reqs(0), m_rd_hits(0), m_wr_hits(0)
+    for (UINT32 i = 0; i < info->numberOfMemops; i++)
     {
-        m_valids = new bool[m_block_num];
-        m_tags = new UINT32[m_block_num];
-        m_replace_q = new UINT32[m_block_num];
+        PIN_MEM_ACCESS_INFO& op = info->memop[i];
+        if (op.maskOn)
+            accessMem(tid, pc, op.memoryAddress, op.bytesAccessed, op.memopType == PIN_MEMOP_STORE);
+    }
+}
 
-        for (UINT i = 0; i < m_block_num; i++)
-        {
-            m_valids[i] = false;
-            m_replace_q[i] = i;
-        }
+// Instruction fetch analysis routine for the L1I of the hierarchy
+void fetchInst(THREADID tid, ADDRINT inst_addr, UINT32 size)
+{
+    PIN_GetLock(&sim_lock, tid + 1);
+    UINT64 end = inst_addr + size;
+    for (UINT64 addr = inst_addr, next; addr < end; addr = next)
+    {
+        next = lineChunkEnd(addr, end, line_size_log);
+        my_hierarchy->fetchInst(get_hier_addr(addr), next - addr);
     }
+    PIN_ReleaseLock(&sim_lock);
+}
+
+/**************************************
+ * Heap Allocation Tracking
+ *
+ * With -attrib, malloc/calloc/realloc/free and mmap/munmap are replaced
+ * by wrappers that call the original and keep the live blocks, with the
+ * return address of the call as the allocation site. Blocks allocated
+ * inside another allocator call (e.g. malloc growing its arena with
+ * mmap) are not recorded, so the live blocks never nest.
+**************************************/
+#define MMAP_FAILED     ((VOID*)-1)
 
-    // Destructor
-    virtual ~CacheModel()
+UINT32 alloc_depth[PIN_MAX_THREADS];    // 每个线程嵌套在分配函数中的层数
+
+inline void recordAllocation(VOID* start, UINT64 size, ADDRINT site)
+{
+    PIN_GetLock(&sim_lock, 1);
+    my_attrib->addAllocation((ADDRINT)start, size, site);
+    PIN_ReleaseLock(&sim_lock);
+}
+
+inline void recordFree(VOID* start)
+{
+    PIN_GetLock(&sim_lock, 1);
+    my_attrib->removeAllocation((ADDRINT)start);
+    PIN_ReleaseLock(&sim_lock);
+}
+
+VOID* MallocWrapper(CONTEXT* ctxt, THREADID tid, AFUNPTR orig, size_t size, ADDRINT site)
+{
+    VOID* ret;
+    bool outer = (alloc_depth[tid]++ == 0);
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL,
+                                PIN_PARG(VOID*), &ret, PIN_PARG(size_t), size, PIN_PARG_END());
+    alloc_depth[tid]--;
+
+    if (outer && ret) recordAllocation(ret, size, site);
+    return ret;
+}
+
+VOID* CallocWrapper(CONTEXT* ctxt, THREADID tid, AFUNPTR orig, size_t num, size_t size, ADDRINT site)
+{
+    VOID* ret;
+    bool outer = (alloc_depth[tid]++ == 0);
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL,
+                                PIN_PARG(VOID*), &ret, PIN_PARG(size_t), num, PIN_PARG(size_t), size, PIN_PARG_END());
+    alloc_depth[tid]--;
+
+    if (outer && ret) recordAllocation(ret, num * size, site);
+    return ret;
+}
+
+VOID* ReallocWrapper(CONTEXT* ctxt, THREADID tid, AFUNPTR orig, VOID* ptr, size_t size, ADDRINT site)
+{
+    VOID* ret;
+    bool outer = (alloc_depth[tid]++ == 0);
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL,
+                                PIN_PARG(VOID*), &ret, PIN_PARG(VOID*), ptr, PIN_PARG(size_t), size, PIN_PARG_END());
+    alloc_depth[tid]--;
+
+    // 失败时原内存块保持不变
+    if (outer && (ret || size == 0))
     {
-        delete[] m_valids;
-        delete[] m_tags;
-        delete[] m_replace_q;
+        if (ptr) recordFree(ptr);
+        if (ret) recordAllocation(ret, size, site);
     }
+    return ret;
+}
 
-    // Update the cache state whenever data is read
-    void readReq(UINT32 mem_addr)
+VOID FreeWrapper(CONTEXT* ctxt, THREADID tid, AFUNPTR orig, VOID* ptr)
+{
+    bool outer = (alloc_depth[tid]++ == 0);
+    if (outer && ptr) recordFree(ptr);
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL,
+                                PIN_PARG(void), PIN_PARG(VOID*), ptr, PIN_PARG_END());
+    alloc_depth[tid]--;
+}
+
+VOID* MmapWrapper(CONTEXT* ctxt, THREADID tid, AFUNPTR orig, VOID* addr, size_t len,
+                  INT32 prot, INT32 flags, INT32 fd, INT64 offset, ADDRINT site)
+{
+    VOID* ret;
+    bool outer = (alloc_depth[tid]++ == 0);
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL,
+                                PIN_PARG(VOID*), &ret, PIN_PARG(VOID*), addr, PIN_PARG(size_t), len,
+                                PIN_PARG(INT32), prot, PIN_PARG(INT32), flags, PIN_PARG(INT32), fd,
+                                PIN_PARG(INT64), offset, PIN_PARG_END());
+    alloc_depth[tid]--;
+
+    if (outer && ret != MMAP_FAILED) recordAllocation(ret, len, site);
+    return ret;
+}
+
+INT32 MunmapWrapper(CONTEXT* ctxt, THREADID tid, AFUNPTR orig, VOID* addr, size_t len)
+{
+    INT32 ret;
+    bool outer = (alloc_depth[tid]++ == 0);
+    if (outer) recordFree(addr);
+    PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, orig, NULL,
+                                PIN_PARG(INT32), &ret, PIN_PARG(VOID*), addr, PIN_PARG(size_t), len, PIN_PARG_END());
+    alloc_depth[tid]--;
+    return ret;
+}
+
+// Pin calls this function every time a new image is loaded, to replace its allocator routines
+VOID ImageLoad(IMG img, VOID* v)
+{
+    RTN rtn = RTN_FindByName(img, "malloc");
+    if (RTN_Valid(rtn))
     {
-        m_rd_reqs++;
-        if (access(mem_addr)) m_rd_hits++;
+        PROTO proto = PROTO_Allocate(PIN_PARG(VOID*), CALLINGSTD_DEFAULT, "malloc", PIN_PARG(size_t), PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)MallocWrapper, IARG_PROTOTYPE, proto, IARG_CONTEXT, IARG_THREAD_ID,
+                             IARG_ORIG_FUNCPTR, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_RETURN_IP, IARG_END);
+        PROTO_Free(proto);
     }
 
-    // Update the cache state whenever data is written
-    void writeReq(UINT32 mem_addr)
+    rtn = RTN_FindByName(img, "calloc");
+    if (RTN_Valid(rtn))
     {
-        m_wr_reqs++;
-        if (access(mem_addr)) m_wr_hits++;
+        PROTO proto = PROTO_Allocate(PIN_PARG(VOID*), CALLINGSTD_DEFAULT, "calloc",
+                                     PIN_PARG(size_t), PIN_PARG(size_t), PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)CallocWrapper, IARG_PROTOTYPE, proto, IARG_CONTEXT, IARG_THREAD_ID,
+                             IARG_ORIG_FUNCPTR, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+                             IARG_RETURN_IP, IARG_END);
+        PROTO_Free(proto);
     }
 
-    UINT32 getRdReq() { return m_rd_reqs; }
-    UINT32 getWrReq() { return m_wr_reqs; }
+    rtn = RTN_FindByName(img, "realloc");
+    if (RTN_Valid(rtn))
+    {
+        PROTO proto = PROTO_Allocate(PIN_PARG(VOID*), CALLINGSTD_DEFAULT, "realloc",
+                                     PIN_PARG(VOID*), PIN_PARG(size_t), PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)ReallocWrapper, IARG_PROTOTYPE, proto, IARG_CONTEXT, IARG_THREAD_ID,
+                             IARG_ORIG_FUNCPTR, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+                             IARG_RETURN_IP, IARG_END);
+        PROTO_Free(proto);
+    }
 
-    void dumpResults()
+    rtn = RTN_FindByName(img, "free");
+    if (RTN_Valid(rtn))
     {
-        float rdHitRate = 100 * (float)m_rd_hits/m_rd_reqs;
-        float wrHitRate = 100 * (float)m_wr_hits/m_wr_reqs;
-        printf("\tread req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_rd_reqs, m_rd_hits, rdHitRate);
-        printf("\twrite req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_wr_reqs, m_wr_hits, wrHitRate);
+        PROTO proto = PROTO_Allocate(PIN_PARG(void), CALLINGSTD_DEFAULT, "free", PIN_PARG(VOID*), PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)FreeWrapper, IARG_PROTOTYPE, proto, IARG_CONTEXT, IARG_THREAD_ID,
+                             IARG_ORIG_FUNCPTR, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
+        PROTO_Free(proto);
     }
 
-protected:
-    UINT32 m_block_num;     // The number of cache blocks
-    UINT32 m_blksz_log;     // 块大小的对数
+    rtn = RTN_FindByName(img, "mmap");
+    if (RTN_Valid(rtn))
+    {
+        PROTO proto = PROTO_Allocate(PIN_PARG(VOID*), CALLINGSTD_DEFAULT, "mmap",
+                                     PIN_PARG(VOID*), PIN_PARG(size_t), PIN_PARG(INT32), PIN_PARG(INT32),
+                                     PIN_PARG(INT32), PIN_PARG(INT64), PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)MmapWrapper, IARG_PROTOTYPE, proto, IARG_CONTEXT, IARG_THREAD_ID,
+                             IARG_ORIG_FUNCPTR, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+                             IARG_FUNCARG_ENTRYPOINT_VALUE, 2, IARG_FUNCARG_ENTRYPOINT_VALUE, 3,
+                             IARG_FUNCARG_ENTRYPOINT_VALUE, 4, IARG_FUNCARG_ENTRYPOINT_VALUE, 5,
+                             IARG_RETURN_IP, IARG_END);
+        PROTO_Free(proto);
+    }
 
-    bool* m_valids;
-    UINT32* m_tags;
-    UINT32* m_replace_q;    // Cache块替换的候选队列
+    rtn = RTN_FindByName(img, "munmap");
+    if (RTN_Valid(rtn))
+    {
+        PROTO proto = PROTO_Allocate(PIN_PARG(INT32), CALLINGSTD_DEFAULT, "munmap",
+                                     PIN_PARG(VOID*), PIN_PARG(size_t), PIN_PARG_END());
+        RTN_ReplaceSignature(rtn, (AFUNPTR)MunmapWrapper, IARG_PROTOTYPE, proto, IARG_CONTEXT, IARG_THREAD_ID,
+                             IARG_ORIG_FUNCPTR, IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+                             IARG_END);
+        PROTO_Free(proto);
+    }
+}
 
-    UINT64 m_rd_reqs;       // The number of read-requests
-    UINT64 m_wr_reqs;       // The number of write-requests
-    UINT64 m_rd_hits;       // The number of hit read-requests
-    UINT64 m_wr_hits;       // The number of hit write-requests
+// Name a code address as function+offset, with the source line when there is debug info
+string describeAddress(UINT64 addr)
+{
+    INT32 line = 0;
+    string file;
+
+    PIN_LockClient();
+    RTN rtn = RTN_FindByAddress(addr);
+    string name = RTN_Valid(rtn) ? RTN_Name(rtn) : "?";
+    ADDRINT offset = RTN_Valid(rtn) ? addr - RTN_Address(rtn) : 0;
+    PIN_GetSourceLocation(addr, NULL, &line, &file);
+    PIN_UnlockClient();
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "+%#lx", offset);
+    name += buf;
+    if (!file.empty())
+    {
+        snprintf(buf, sizeof(buf), ":%d", line);
+        name += " (" + file + buf + ")";
+    }
+    return name;
+}
 
-    // Look up the cache to decide whether the access is hit or missed
-    virtual bool lookup(UINT32 mem_addr, UINT32& blk_id) = 0;
+/**************************************
+ * Trace Record Mode
+ *
+ * With -trace_out, references are only written to a memTrace.h file for
+ * cacheReplay to simulate later, without running any model here.
+**************************************/
+TraceWriter* trace_writer;
+PIN_LOCK trace_lock;
 
-    // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    virtual bool access(UINT32 mem_addr) = 0;
+// Append one reference to the trace, unsplit
+void recordRef(ADDRINT pc, ADDRINT addr, UINT32 size, UINT32 type)
+{
+    PIN_GetLock(&trace_lock, 1);
+    trace_writer->write(type, addr, size, pc);
+    PIN_ReleaseLock(&trace_lock);
+}
 
-    // Update m_replace_q
-    virtual void updateReplaceQ(UINT32 blk_id) = 0;
-};
+void recordMultiRef(ADDRINT pc, PIN_MULTI_MEM_ACCESS_INFO* info)
+{
+    PIN_GetLock(&trace_lock, 1);
+    for (UINT32 i = 0; i < info->numberOfMemops; i++)
+    {
+        PIN_MEM_ACCESS_INFO& op = info->memop[i];
+        if (op.maskOn)
+            trace_writer->write(op.memopType == PIN_MEMOP_STORE ? REF_WRITE : REF_READ,
+                                op.memoryAddress, op.bytesAccessed, pc);
+    }
+    PIN_ReleaseLock(&trace_lock);
+}
 
 /**************************************
- * Fully Associative Cache Class
+ * Buffered Reference Pipeline
+ *
+ * With -workers N, application threads only append their references to
+ * Pin trace buffers. Full buffers are queued in order and every worker
+ * (a Pin internal thread) consumes the whole queue, feeding only the
+ * simulation units assigned to it, so each unit still sees a single
+ * ordered reference stream.
 **************************************/
-class FullAssoCache : public CacheModel
+// One memory reference recorded by an application thread
+struct MemRef
 {
-public:
-    // Constructor
-    FullAssoCache(UINT32 block_num, UINT32 log_block_size)
-        : CacheModel(block_num, log_block_size) {}
+    ADDRINT addr;
+    ADDRINT pc;             // Trains the prefetchers of the hierarchy
+    UINT32 size;
+    UINT32 type;
+};
 
-    // Destructor
-    ~FullAssoCache() {}
+// The units a worker can own: the five cache models, the hierarchy, the MMU, the exact and sampled
+// curves, and the alternative set organizations together
+enum SimUnit { UNIT_FA, UNIT_SA, UNIT_VIVT, UNIT_PIPT, UNIT_VIPT, UNIT_HIERARCHY, UNIT_MMU, UNIT_MRC, UNIT_SHARDS, UNIT_ORGS, SIM_UNITS };
 
-private:
-    UINT32 getTag(UINT32 addr) { /* TODO */ return addr >> m_blksz_log; }
+#define MAX_PENDING_CHUNKS  64      // 队列满时应用线程等待 worker
 
-    // Look up the cache to decide whether the access is hit or missed
-    bool lookup(UINT32 mem_addr, UINT32& blk_id)
+// A buffer of references waiting for the workers
+struct RefChunk
+{
+    MemRef* refs;
+    UINT64 num;
+    bool pin_buffer;        // Allocated by PIN_AllocateBuffer, otherwise by new[]
+    UINT32 pending;         // Workers that have not consumed it yet
+};
+
+BUFFER_ID ref_buffer;
+TLS_KEY side_refs_key;      // 每个线程的 gather/scatter 引用, 无法写入 Pin 的 trace buffer
+
+UINT32 worker_num = 0;
+CacheModel* sim_models[UNIT_HIERARCHY];
+PIN_THREAD_UID worker_uids[SIM_UNITS];
+PIN_SEMAPHORE work_ready[SIM_UNITS];
+PIN_SEMAPHORE space_ready;
+
+// Everything below is protected by queue_lock
+PIN_LOCK queue_lock;
+RefChunk* chunk_ring[MAX_PENDING_CHUNKS];
+UINT64 chunk_tail = 0;
+UINT64 worker_pos[SIM_UNITS];
+vector<VOID*> free_buffers;
+bool pipeline_closed = false;       // 此后到达的引用在应用线程上直接模拟
+UINT32 workers_running = 0;
+
+// Feed one buffered reference to one unit
+inline void simulateRef(UINT32 unit, const MemRef& ref)
+{
+    UINT64 end = ref.addr + ref.size;
+    for (UINT64 addr = ref.addr, next; addr < end; addr = next)
     {
-        UINT32 tag = getTag(mem_addr);
+        next = lineChunkEnd(addr, end, line_size_log);
+        UINT32 size = next - addr;
 
-        // TODO
-        for (UINT32 i = 0; i < m_block_num; i++)
+        if (unit == UNIT_HIERARCHY)
+        {
+            UINT64 hier_addr = get_hier_addr(addr);
+            if (ref.type == REF_READ) my_hierarchy->read(hier_addr, size, ref.pc);
+            else if (ref.type == REF_WRITE) my_hierarchy->write(hier_addr, size, ref.pc);
+            else my_hierarchy->fetchInst(hier_addr, size);
+        }
+        else if (unit == UNIT_MMU)
+        {
+            if (ref.type != REF_FETCH) my_mmu->translate(addr);
+        }
+        else if (unit == UNIT_MRC)
         {
-            if ((m_tags[i] == tag) && (m_valids[i] == true))
+            if (ref.type != REF_FETCH) my_mrc->access(addr);
+        }
+        else if (unit == UNIT_SHARDS)
+        {
+            if (ref.type != REF_FETCH) my_shards->access(addr);
+        }
+        else if (unit == UNIT_ORGS)
+        {
+            for (size_t i = 0; i < my_org_caches.size(); i++)
             {
-                blk_id = i;
-                return true;
+                if (ref.type == REF_READ) my_org_caches[i]->readReq(addr, size);
+                else if (ref.type == REF_WRITE) my_org_caches[i]->writeReq(addr, size);
             }
         }
-
-        return false;
+        else
+        {
+            if (ref.type == REF_READ) sim_models[unit]->readReq(addr, size);
+            else if (ref.type == REF_WRITE) sim_models[unit]->writeReq(addr, size);
+        }
     }
+}
 
-    // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    bool access(UINT32 mem_addr)
+inline bool unitEnabled(UINT32 unit)
+{
+    return (unit < UNIT_HIERARCHY) || (unit == UNIT_HIERARCHY && my_hierarchy) || (unit == UNIT_MMU && my_mmu)
+        || (unit == UNIT_MRC && my_mrc) || (unit == UNIT_SHARDS && my_shards) || (unit == UNIT_ORGS && !my_org_caches.empty());
+}
+
+// Feed a chunk to the units of worker w, or to every unit when w is worker_num
+void simulateChunk(UINT32 w, const RefChunk* chunk)
+{
+    for (UINT32 unit = 0; unit < SIM_UNITS; unit++)
     {
-        UINT32 blk_id;
-        if (lookup(mem_addr, blk_id))
-        {
-            updateReplaceQ(blk_id);     // Update m_replace_q
-            return true;
-        }
+        if (!unitEnabled(unit) || (w != worker_num && unit % worker_num != w)) continue;
 
-        // Get the to-be-replaced block id using m_replace_q
-        UINT32 bid_2be_replaced = m_replace_q[0]; // TODO
+        for (UINT64 i = 0; i < chunk->num; i++)
+            simulateRef(unit, chunk->refs[i]);
+    }
+}
 
-        // Replace the cache block
-        // TODO
-        m_tags[bid_2be_replaced] = getTag(mem_addr);
-        m_valids[bid_2be_replaced] = true;
-        updateReplaceQ(bid_2be_replaced);
+// Return a consumed chunk's buffer to the pool; the caller holds queue_lock
+void releaseChunk(RefChunk* chunk)
+{
+    if (chunk->pin_buffer) free_buffers.push_back(chunk->refs);
+    else delete[] chunk->refs;
+    delete chunk;
+}
 
-        return false;
+// Hand a chunk to the workers, waiting while the queue is full
+void enqueueChunk(THREADID tid, RefChunk* chunk)
+{
+    PIN_GetLock(&queue_lock, tid + 1);
+    while (!pipeline_closed)
+    {
+        UINT64 head = chunk_tail;
+        for (UINT32 w = 0; w < worker_num; w++)
+            head = (worker_pos[w] < head) ? worker_pos[w] : head;
+        if (chunk_tail - head < MAX_PENDING_CHUNKS) break;
+
+        PIN_SemaphoreClear(&space_ready);
+        PIN_ReleaseLock(&queue_lock);
+        PIN_SemaphoreWait(&space_ready);
+        PIN_GetLock(&queue_lock, tid + 1);
     }
 
-    // Update m_replace_q
-    void updateReplaceQ(UINT32 blk_id)
+    if (!pipeline_closed)
     {
-        // TODO
-        for (UINT32 i = 0; i < m_block_num; i++)
-        {
-            if (m_replace_q[i] == blk_id)
-            {
-                for (UINT32 j = i + 1; j < m_block_num; j++)
-                {
-                    m_replace_q[j - 1] = m_replace_q[j];
-                }
-                m_replace_q[m_block_num - 1] = blk_id;
-                break;
-            }
-        }
+        chunk->pending = worker_num;
+        chunk_ring[chunk_tail++ % MAX_PENDING_CHUNKS] = chunk;
+        PIN_ReleaseLock(&queue_lock);
+
+        for (UINT32 w = 0; w < worker_num; w++)
+            PIN_SemaphoreSet(&work_ready[w]);
+        return;
     }
-};
 
-/**************************************
- * Set-Associative Cache Class
-**************************************/
-class SetAssoCache : public CacheModel
-{
-public:
-    // Constructor
-    SetAssoCache(/* TODO */ UINT32 log_sets, UINT32 log_block_size, UINT32 asso)
-        : CacheModel((asso * (1 << log_sets)), log_block_size)
+    // The workers are gone once the process is exiting: simulate here, one thread at a time
+    while (workers_running > 0)
     {
-        m_sets_log = log_sets;
-        m_asso = asso;
+        PIN_ReleaseLock(&queue_lock);
+        PIN_Sleep(1);
+        PIN_GetLock(&queue_lock, tid + 1);
     }
+    simulateChunk(worker_num, chunk);
+    releaseChunk(chunk);
+    PIN_ReleaseLock(&queue_lock);
+}
 
-    // Destructor
-    ~SetAssoCache() {}
+// Queue the gather/scatter references recorded aside by thread tid. They are simulated
+// after the trace buffer they were interleaved with, which reorders them by at most one buffer
+void flushSideRefs(THREADID tid)
+{
+    vector<MemRef>* side = (vector<MemRef>*)PIN_GetThreadData(side_refs_key, tid);
+    if (side == NULL || side->empty()) return;
 
-protected:
+    RefChunk* chunk = new RefChunk();
+    chunk->num = side->size();
+    chunk->refs = new MemRef[chunk->num];
+    chunk->pin_buffer = false;
+    std::copy(side->begin(), side->end(), chunk->refs);
+    side->clear();
 
-    // the log of the number of rows & the m_asso
-    UINT32 m_sets_log;
-    UINT32 m_asso;
+    enqueueChunk(tid, chunk);
+}
 
-    // 获得当前主存地址的区内块号
-    virtual UINT32 getIndex(UINT32 addr) {
-        return (addr >> m_blksz_log) & ((1 << m_sets_log) - 1);
+// Pin calls this function when a thread's trace buffer is full or the thread exits
+VOID* BufferFull(BUFFER_ID id, THREADID tid, const CONTEXT* ctxt, VOID* buf, UINT64 num_elements, VOID* v)
+{
+    RefChunk* chunk = new RefChunk();
+    chunk->refs = (MemRef*)buf;
+    chunk->num = num_elements;
+    chunk->pin_buffer = true;
+    enqueueChunk(tid, chunk);
+    flushSideRefs(tid);
+
+    VOID* next = NULL;
+    PIN_GetLock(&queue_lock, tid + 1);
+    if (!free_buffers.empty())
+    {
+        next = free_buffers.back();
+        free_buffers.pop_back();
     }
+    PIN_ReleaseLock(&queue_lock);
 
-    // 获得当前主存地址的区号
-    virtual UINT32 getTag(UINT32 addr) {
-        return (addr >> (m_blksz_log + m_sets_log));
-    }
+    return next ? next : PIN_AllocateBuffer(id);
+}
 
-    // Look up the cache to decide whether the access is hit or missed
-    bool lookup(UINT32 mem_addr, UINT32& blk_id)
+// Buffered gather/scatter analysis routine
+void recordMultiMem(THREADID tid, ADDRINT pc, PIN_MULTI_MEM_ACCESS_INFO* info)
+{
+    vector<MemRef>* side = (vector<MemRef>*)PIN_GetThreadData(side_refs_key, tid);
+    for (UINT32 i = 0; i < info->numberOfMemops; i++)
     {
-        // TODO
-        UINT32 index = getIndex(mem_addr);
-        UINT32 tag = getTag(mem_addr);
+        PIN_MEM_ACCESS_INFO& op = info->memop[i];
+        if (!op.maskOn) continue;
+
+        MemRef ref = { op.memoryAddress, pc, op.bytesAccessed, op.memopType == PIN_MEMOP_STORE ? REF_WRITE : REF_READ };
+        side->push_back(ref);
+    }
+}
+
+// Worker thread: consume every queued chunk in order for the units owned by worker w
+VOID SimWorker(VOID* arg)
+{
+    UINT32 w = (UINT32)(ADDRINT)arg;
+    THREADID tid = PIN_ThreadId();
 
-        for (UINT32 i = (index * m_asso); i < (index * m_asso + m_asso); i++)
+    while (true)
+    {
+        PIN_GetLock(&queue_lock, tid + 1);
+        RefChunk* chunk = (worker_pos[w] < chunk_tail) ? chunk_ring[worker_pos[w] % MAX_PENDING_CHUNKS] : NULL;
+        bool done = (chunk == NULL) && pipeline_closed;
+        if (chunk == NULL) PIN_SemaphoreClear(&work_ready[w]);
+        PIN_ReleaseLock(&queue_lock);
+
+        if (done) break;
+        if (chunk == NULL)
         {
-            if ((m_tags[i] == tag) && (m_valids[i] == true))
-            {
-                blk_id = i;
-                return true;
-            }
+            PIN_SemaphoreWait(&work_ready[w]);
+            continue;
         }
 
-        return false;
+        simulateChunk(w, chunk);
+
+        PIN_GetLock(&queue_lock, tid + 1);
+        worker_pos[w]++;
+        if (--chunk->pending == 0) releaseChunk(chunk);
+        PIN_ReleaseLock(&queue_lock);
+        PIN_SemaphoreSet(&space_ready);
     }
 
-    // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    bool access(UINT32 mem_addr)
-    {
-        // TODO
-        UINT32 blk_id;
+    PIN_GetLock(&queue_lock, tid + 1);
+    workers_running--;
+    PIN_ReleaseLock(&queue_lock);
+}
 
-        if (lookup(mem_addr, blk_id))
-        {
-            updateReplaceQ(blk_id);     // Update m_replace_q
-            return true;
-        }
+VOID ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    PIN_SetThreadData(side_refs_key, new vector<MemRef>(), tid);
+}
 
-        // Get the to-be-replaced block id using m_replace_q
-        UINT32 bid_2be_replaced = getIndex(mem_addr) * m_asso;
-        for (UINT32 i = 0; i < m_block_num; i++)
-        {
-            if (m_replace_q[i] / m_asso == getIndex(mem_addr)) {
-                bid_2be_replaced = m_replace_q[i];
-                break;
-            }
-        }
+VOID ThreadFini(THREADID tid, const CONTEXT* ctxt, INT32 code, VOID* v)
+{
+    flushSideRefs(tid);
+    delete (vector<MemRef>*)PIN_GetThreadData(side_refs_key, tid);
+    PIN_SetThreadData(side_refs_key, NULL, tid);
+}
 
-        // Replace the cache block
-        m_tags[bid_2be_replaced] = getTag(mem_addr);
-        m_valids[bid_2be_replaced] = true;
-        updateReplaceQ(bid_2be_replaced);
+// Let the workers drain the queue and stop before the tool's Fini runs
+VOID PrepareForFini(VOID* v)
+{
+    PIN_GetLock(&queue_lock, 0);
+    pipeline_closed = true;
+    PIN_ReleaseLock(&queue_lock);
 
-        return false;
+    for (UINT32 w = 0; w < worker_num; w++)
+    {
+        PIN_SemaphoreSet(&work_ready[w]);
+        PIN_WaitForThreadTermination(worker_uids[w], PIN_INFINITE_TIMEOUT, NULL);
     }
+}
+
+// Start worker_num workers, each owning the units unit % worker_num == w
+bool startWorkers()
+{
+    sim_models[UNIT_FA] = my_fa_cache;
+    sim_models[UNIT_SA] = my_sa_cache;
+    sim_models[UNIT_VIVT] = my_sa_cache_vivt;
+    sim_models[UNIT_PIPT] = my_sa_cache_pipt;
+    sim_models[UNIT_VIPT] = my_sa_cache_vipt;
+
+    PIN_InitLock(&queue_lock);
+    PIN_SemaphoreInit(&space_ready);
+    side_refs_key = PIN_CreateThreadDataKey(NULL);
 
-    // Update m_replace_q
-    void updateReplaceQ(UINT32 blk_id)
+    for (UINT32 w = 0; w < worker_num; w++)
     {
-        // TODO
-        for (UINT32 i = 0; i < m_block_num; i++)
-        {
-            if (m_replace_q[i] == blk_id)
-            {
-                for (UINT32 j = i + 1; j < m_block_num; j++)
-                {
-                    m_replace_q[j - 1] = m_replace_q[j];
-                }
-                m_replace_q[m_block_num - 1] = blk_id;
-                break;
-            }
-        }
+        PIN_SemaphoreInit(&work_ready[w]);
+        worker_pos[w] = 0;
+        workers_running++;
+        if (PIN_SpawnInternalThread(SimWorker, (VOID*)(ADDRINT)w, 0, &worker_uids[w]) == INVALID_THREADID)
+            return false;
     }
-};
+    return true;
+}
 
 /**************************************
- * Set-Associative Cache Class (VIVT)
+ * Address Spaces
+ *
+ * After a fork the child goes on with the caches its parent left behind,
+ * in an address space of its own whose pages are shared with the parent
+ * copy-on-write (with -palloc). The VIVT and VIPT caches see the switch
+ * to the new ASID. With -ctx_switch the process is also switched out and
+ * back in every N instructions, so that flushing virtual tags can be
+ * compared with keeping them apart by ASID. An exec starts a new instance
+ * of the tool under -follow_execv, with caches as cold as after a flush.
 **************************************/
-class SetAssoCache_VIVT : public SetAssoCache
-{
-public:
-    // Constructor
-    SetAssoCache_VIVT(/* TODO */ UINT32 log_sets, UINT32 log_block_size, UINT32 asso)
-        : SetAssoCache(log_sets, log_block_size, asso) {}
-
-    // Destructor
-    ~SetAssoCache_VIVT() {}
+UINT64 ctx_switch_every = 0;
+UINT64 next_ctx_switch = ~0ul;  // 下一次切换时的指令数
 
-private:
+// Tell the models that the address space changed or the process was switched; the caller holds sim_lock
+void switchContexts()
+{
+    my_fa_cache->switchContext();
+    my_sa_cache->switchContext();
+    my_sa_cache_vivt->switchContext();
+    my_sa_cache_pipt->switchContext();
+    my_sa_cache_vipt->switchContext();
+    for (size_t i = 0; i < my_org_caches.size(); i++) my_org_caches[i]->switchContext();
+}
 
-    /* 直接继承 SetAssoCache 类的成员变量及方法, 无需重复实现 */
+// Called in the child of a fork. Only the forking thread survives there, so no lock is taken
+VOID ForkChild(THREADID tid, const CONTEXT* ctxt, VOID* v)
+{
+    switchAddressSpace(forkAddressSpace());
+    switchContexts();
+}
 
-    // Add your members
+/**************************************
+ * Region of Interest
+ *
+ * By default everything from process start is simulated. Each ROI knob
+ * adds a gate of RegionOfInterest, and references are simulated only while
+ * all gates are open:
+ *   -roi_func foo          while a call to foo is active
+ *   -roi_skip N -roi_len M from instruction N on, for M instructions (0 for the rest)
+ *   -roi_magic 1           between markers executed by the application,
+ *                          xchg %rcx,%rcx to begin and xchg %rdx,%rdx to end
+**************************************/
+RegionOfInterest roi;
 
-    // // Look up the cache to decide whether the access is hit or missed
-    // bool lookup(UINT32 mem_addr, UINT32& blk_id)
-    // {
-    //     // TODO
-    // }
+UINT64 skipped_insts = 0;       // Instructions executed outside the ROI
 
-    // // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    // bool access(UINT32 mem_addr)
-    // {
-    //     // TODO
-    // }
+void dumpROI()
+{
+    if (!roi.hasGates()) return;
 
-    // // Update m_replace_q
-    // void updateReplaceQ(UINT32 blk_id)
-    // {
-    //     // TODO
-    // }
-};
+    printf("\nRegion of interest: %lu instructions simulated,\t%lu skipped,\tentered %u times\n",
+           inst_count, skipped_insts, roi.entries());
+}
 
 /**************************************
- * Set-Associative Cache Class (PIPT)
+ * Sampling
+ *
+ * With -sample period,warm,measure, the run is split into units of period
+ * instructions (SMARTS). The last measure instructions of each unit are a
+ * detailed window whose hits are sampled, and the warm instructions before
+ * it only update the state of the five sampled models, without counting
+ * (functional warming). The rest of the unit is fast-forwarded. The calls
+ * into the models are guarded by if-calls on the phase, so moving between
+ * phases does not re-instrument the code, and fast-forwarding only costs
+ * the checks and the instruction count. warm = period - measure warms the
+ * models continuously, as SMARTS does. The sampled hit rates are reported
+ * with their confidence intervals; the other statistics cover the measured
+ * references only, and their rates per kilo-instruction the measured
+ * instructions.
+ *
+ * With -bbv file, nothing is simulated: the basic block vector of every
+ * -bbv_interval instructions is written in the SimPoint format, and with
+ * -bbv_k K the intervals are clustered into K phases. The interval closest
+ * to the center of each phase is printed with its weight and the -roi_skip
+ * and -roi_len that simulate it.
 **************************************/
-class SetAssoCache_PIPT : public SetAssoCache
+enum SamplePhase { SAMPLE_FORWARD, SAMPLE_WARM, SAMPLE_MEASURE };
+
+bool sampling = false;
+volatile SamplePhase sample_phase = SAMPLE_FORWARD;
+UINT64 sample_period, sample_warm, sample_measure;
+
+const UINT32 SAMPLED_MODELS = 5;
+CacheModel* sampled_models[SAMPLED_MODELS];
+const char* sampled_names[SAMPLED_MODELS] = { "fully associative", "set-associative", "VIVT", "PIPT", "VIPT" };
+UINT64 sample_reqs[SAMPLED_MODELS];     // 测量窗口开始时各模型的计数
+UINT64 sample_hits[SAMPLED_MODELS];
+SampledRatio sampled_rates[SAMPLED_MODELS];
+
+// The caller holds sim_lock
+void beginSample()
 {
-public:
-    // Constructor
-    SetAssoCache_PIPT(/* TODO */ UINT32 log_sets, UINT32 log_block_size, UINT32 asso)
-        : SetAssoCache(log_sets, log_block_size, asso) {}
+    for (UINT32 i = 0; i < SAMPLED_MODELS; i++)
+    {
+        sample_reqs[i] = sampled_models[i]->getReqs();
+        sample_hits[i] = sampled_models[i]->getHits();
+    }
+}
 
-    // Destructor
-    ~SetAssoCache_PIPT() {}
+// The caller holds sim_lock
+void endSample()
+{
+    for (UINT32 i = 0; i < SAMPLED_MODELS; i++)
+        sampled_rates[i].add(sampled_models[i]->getHits() - sample_hits[i], sampled_models[i]->getReqs() - sample_reqs[i]);
+}
 
-private:
+// If-routines guarding the calls into the models: data references are simulated while warming
+// and measuring, instruction fetches (only the hierarchy uses them) while measuring
+ADDRINT sampleSimulated() { return sample_phase != SAMPLE_FORWARD; }
+ADDRINT sampleMeasured() { return sample_phase == SAMPLE_MEASURE; }
 
-    /* 除了 getIndex 和 getTag 方法需要修改为根据物理地址来获取 index 和 tag, 其它成员变量和方法则是直接继承自 SetAssoCache 类, 无需重复实现 */
+// Move to the phase of instruction total within its sampling unit; the caller holds sim_lock
+void updateSample(UINT64 total)
+{
+    UINT64 pos = total % sample_period;
+    SamplePhase phase = SAMPLE_MEASURE;
+    if (pos < sample_period - sample_warm - sample_measure) phase = SAMPLE_FORWARD;
+    else if (pos < sample_period - sample_measure) phase = SAMPLE_WARM;
+    if (phase == sample_phase) return;
+
+    if (sample_phase == SAMPLE_MEASURE) endSample();
+    if (phase == SAMPLE_MEASURE) beginSample();
+    sample_phase = phase;
+    sample_warming = (phase == SAMPLE_WARM);
+}
 
-    // Add your members
+void dumpSamples()
+{
+    if (!sampling) return;
 
-    // 获得当前主存地址的区内块号
-    UINT32 getIndex(UINT32 addr) {
-        UINT32 paddr = get_phy_addr(addr);
-        return (paddr >> m_blksz_log) & ((1 << m_sets_log) - 1);
-    }
+    // 最后一个窗口在程序结束时可能尚未测量完, 也计入样本
+    if (sample_phase == SAMPLE_MEASURE) endSample();
+
+    printf("\nSampled Hit Rates: %lu instructions measured every %lu, after %lu of warming\n",
+           sample_measure, sample_period, sample_warm);
+    for (UINT32 i = 0; i < SAMPLED_MODELS; i++)
+        sampled_rates[i].dumpResults(sampled_names[i]);
+}
 
-    // 获得当前主存地址的区号
-    UINT32 getTag(UINT32 addr) {
-        UINT32 paddr = get_phy_addr(addr);
-        return (paddr >> (m_blksz_log + m_sets_log));
+const UINT32 BBV_DIMS = 15;     // SimPoint 默认的随机投影维数
+
+FILE* bbv_file;
+UINT64 bbv_interval;
+UINT64 bbv_insts = 0;           // Instructions of the current interval
+vector<UINT64> bbv_counts;      // Instructions executed in each block during this interval
+vector<UINT32> bbv_touched;     // Blocks with a non-zero count
+vector<vector<double> > bbv_points;     // The projected vector of every interval
+unordered_map<ADDRINT, UINT32> bbv_ids;
+
+// A fixed pseudo-random weight in [-1, 1) for block id and dimension d
+double bbvWeight(UINT32 id, UINT32 d)
+{
+    UINT64 x = ((UINT64)id << 8 | d) * 0x9e3779b97f4a7c15ul;
+    x ^= x >> 29;
+    x *= 0xbf58476d1ce4e5b9ul;
+    x ^= x >> 32;
+    return (double)(x >> 11) / (1ul << 52) - 1;
+}
+
+// Write the vector of the finished interval and project it for the clustering
+void endInterval()
+{
+    vector<double> point(BBV_DIMS, 0);
+    fputc('T', bbv_file);
+    for (size_t i = 0; i < bbv_touched.size(); i++)
+    {
+        UINT32 id = bbv_touched[i];
+        fprintf(bbv_file, ":%u:%lu ", id + 1, bbv_counts[id]);
+
+        double share = (double)bbv_counts[id] / bbv_insts;
+        for (UINT32 d = 0; d < BBV_DIMS; d++) point[d] += share * bbvWeight(id, d);
+        bbv_counts[id] = 0;
     }
+    fputc('\n', bbv_file);
 
-    // // Look up the cache to decide whether the access is hit or missed
-    // bool lookup(UINT32 mem_addr, UINT32& blk_id)
-    // {
-    //     // TODO
-    // }
+    bbv_points.push_back(point);
+    bbv_touched.clear();
+    bbv_insts = 0;
+}
 
-    // // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    // bool access(UINT32 mem_addr)
-    // {
-    //     // TODO
-    // }
+// Basic block counting routine of the -bbv pass
+void countBlock(UINT32 id, UINT32 num)
+{
+    PIN_GetLock(&sim_lock, 0);
+    if (bbv_counts[id] == 0) bbv_touched.push_back(id);
+    bbv_counts[id] += num;
+    bbv_insts += num;
+    inst_count += num;
+    if (bbv_insts >= bbv_interval) endInterval();
+    PIN_ReleaseLock(&sim_lock);
+}
 
-    // // Update m_replace_q
-    // void updateReplaceQ(UINT32 blk_id)
-    // {
-    //     // TODO
-    // }
-};
+VOID BbvTrace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        PIN_GetLock(&sim_lock, 0);
+        unordered_map<ADDRINT, UINT32>::iterator it = bbv_ids.find(BBL_Address(bbl));
+        UINT32 id;
+        if (it != bbv_ids.end())
+        {
+            id = it->second;
+        }
+        else
+        {
+            id = bbv_counts.size();
+            bbv_ids[BBL_Address(bbl)] = id;
+            bbv_counts.push_back(0);
+        }
+        PIN_ReleaseLock(&sim_lock);
 
-/**************************************
- * Set-Associative Cache Class (VIPT)
-**************************************/
-class SetAssoCache_VIPT : public SetAssoCache
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)countBlock, IARG_UINT32, id, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+    }
+}
+
+double distance2(const vector<double>& a, const vector<double>& b)
 {
-public:
-    // Constructor
-    SetAssoCache_VIPT(/* TODO */ UINT32 log_sets, UINT32 log_block_size, UINT32 asso)
-        : SetAssoCache(log_sets, log_block_size, asso) {}
+    double d = 0;
+    for (UINT32 i = 0; i < BBV_DIMS; i++) d += (a[i] - b[i]) * (a[i] - b[i]);
+    return d;
+}
 
-    // Destructor
-    ~SetAssoCache_VIPT() {}
+// Cluster the intervals with k-means, seeded by k-means++, and print the representative of each cluster
+void pickSimPoints(UINT32 k)
+{
+    size_t n = bbv_points.size();
+    if (k > n) k = n;
+    if (k == 0) return;
+
+    UINT64 seed = 0x2545f4914f6cdd1dul;
+    vector<vector<double> > centers(1, bbv_points[0]);
+    vector<double> nearest(n);
+    while (centers.size() < k)
+    {
+        double total = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            nearest[i] = distance2(bbv_points[i], centers[0]);
+            for (size_t c = 1; c < centers.size(); c++) nearest[i] = std::min(nearest[i], distance2(bbv_points[i], centers[c]));
+            total += nearest[i];
+        }
+
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        double r = total * (double)(seed >> 11) / (1ul << 53);
+        size_t pick = n - 1;
+        for (size_t i = 0; i < n; i++)
+        {
+            r -= nearest[i];
+            if (r < 0) { pick = i; break; }
+        }
+        centers.push_back(bbv_points[pick]);
+    }
 
-private:
+    vector<UINT32> cluster(n, 0);
+    for (UINT32 iter = 0; iter < 100; iter++)
+    {
+        bool changed = false;
+        for (size_t i = 0; i < n; i++)
+        {
+            UINT32 best = 0;
+            for (UINT32 c = 1; c < k; c++)
+                if (distance2(bbv_points[i], centers[c]) < distance2(bbv_points[i], centers[best])) best = c;
+            if (best != cluster[i] || iter == 0) changed = true;
+            cluster[i] = best;
+        }
+        if (!changed) break;
 
-    /* 除了 getTag 方法需要修改为根据物理地址来获取 tag, 其它成员变量和方法则是直接继承自 SetAssoCache 类, 无需重复实现 */
+        vector<UINT64> sizes(k, 0);
+        for (UINT32 c = 0; c < k; c++) centers[c].assign(BBV_DIMS, 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            sizes[cluster[i]]++;
+            for (UINT32 d = 0; d < BBV_DIMS; d++) centers[cluster[i]][d] += bbv_points[i][d];
+        }
+        for (UINT32 c = 0; c < k; c++)
+            for (UINT32 d = 0; d < BBV_DIMS; d++)
+                if (sizes[c]) centers[c][d] /= sizes[c];
+    }
 
-    // Add your members
+    printf("\nSimulation points (k = %u):\n", k);
+    for (UINT32 c = 0; c < k; c++)
+    {
+        size_t best = n, size = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (cluster[i] != c) continue;
+            size++;
+            if (best == n || distance2(bbv_points[i], centers[c]) < distance2(bbv_points[best], centers[c])) best = i;
+        }
+        if (size == 0) continue;
 
-    // 获得当前主存地址的区号
-    UINT32 getTag(UINT32 addr) {
-        UINT32 paddr = get_phy_addr(addr);
-        return (paddr >> (m_blksz_log + m_sets_log));
+        printf("\tinterval %lu,\tweight: %.4f,\t-roi_skip %lu -roi_len %lu\n",
+               best, (double)size / n, best * bbv_interval, bbv_interval);
     }
+}
 
-    // // Look up the cache to decide whether the access is hit or missed
-    // bool lookup(UINT32 mem_addr, UINT32& blk_id)
-    // {
-    //     // TODO
-    // }
+void dumpBBV(UINT32 k)
+{
+    if (bbv_insts) endInterval();
+    fclose(bbv_file);
 
-    // // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
-    // bool access(UINT32 mem_addr)
-    // {
-    //     // TODO
-    // }
+    printf("\nWrote %lu basic block vectors of %lu instructions (%lu blocks, %lu instructions in total)\n",
+           bbv_points.size(), bbv_interval, bbv_counts.size(), inst_count);
+    pickSimPoints(k);
+}
 
-    // // Update m_replace_q
-    // void updateReplaceQ(UINT32 blk_id)
-    // {
-    //     // TODO
-    // }
-};
+// 各线程分别计数, 只在可能越过采样阶段, 指令窗口, 上下文切换或 -stats 区间的边界时才汇总
+StatCounter roi_insts;          // inst_count
+StatCounter warm_insts;         // 其中 -sample 预热阶段的指令
+StatCounter outside_insts;      // skipped_insts
 
-CacheModel* my_fa_cache;
-CacheModel* my_sa_cache;
-CacheModel* my_sa_cache_vivt;
-CacheModel* my_sa_cache_pipt;
-CacheModel* my_sa_cache_vipt;
+struct InstBudget
+{
+    UINT64 left;                // 本线程在下一次汇总前还可计的指令数
+    char pad[56];
+};
+InstBudget inst_budgets[PIN_MAX_THREADS];
+UINT32 counting_threads = 0;    // 计过指令的线程号上界
 
-// Cache reading analysis routine
-void readCache(UINT32 mem_addr)
+// Sum the counts of all threads into inst_count, measured_insts and skipped_insts; the caller
+// holds sim_lock, or the application has exited
+void syncInsts()
 {
-    mem_addr = (mem_addr >> 2) << 2;
+    inst_count = roi_insts.value();
+    measured_insts = inst_count - warm_insts.value();
+    skipped_insts = outside_insts.value();
+}
 
-    my_fa_cache->readReq(mem_addr);
-    my_sa_cache->readReq(mem_addr);
+// The instructions left before the next boundary that countInsts must see, ~0 for none
+UINT64 nextBoundary()
+{
+    UINT64 total = inst_count + skipped_insts;
+    UINT64 left = std::min(roi.windowLeft(total), std::min(stats.nextDue(), next_ctx_switch) - inst_count);
 
-    my_sa_cache_vivt->readReq(mem_addr);
-    my_sa_cache_pipt->readReq(mem_addr);
-    my_sa_cache_vipt->readReq(mem_addr);
+    if (sampling)
+    {
+        UINT64 pos = total % sample_period;
+        UINT64 forward_end = sample_period - sample_warm - sample_measure;
+        UINT64 warm_end = sample_period - sample_measure;
+        left = std::min(left, pos < forward_end ? forward_end - pos : pos < warm_end ? warm_end - pos : sample_period - pos);
+    }
+    return left;
 }
 
-// Cache writing analysis routine
-void writeCache(UINT32 mem_addr)
+// Instruction counting routine, called once per basic block inside the ROI, or everywhere
+// when the ROI is an instruction window or with -sample. Each thread counts in its own slot,
+// and takes sim_lock to sum the counts only once it has used up its share of the instructions
+// left before the next boundary, so the phase and window changes they cause stay exact with
+// one thread, and at most a basic block late per thread with several
+void countInsts(THREADID tid, UINT32 num)
 {
-    mem_addr = (mem_addr >> 2) << 2;
+    if (roi.active() && !(sampling && sample_phase == SAMPLE_FORWARD))
+    {
+        roi_insts.add(tid, num);
+        if (sample_warming) warm_insts.add(tid, num);
+    }
+    else outside_insts.add(tid, num);
+
+    if (inst_budgets[tid].left > num)
+    {
+        inst_budgets[tid].left -= num;
+        return;
+    }
+
+    PIN_GetLock(&sim_lock, tid + 1);
+    syncInsts();
+    counting_threads = std::max(counting_threads, (UINT32)tid + 1);
 
-    my_fa_cache->writeReq(mem_addr);
-    my_sa_cache->writeReq(mem_addr);
+    if (sampling) updateSample(inst_count + skipped_insts);
 
-    my_sa_cache_vivt->writeReq(mem_addr);
-    my_sa_cache_pipt->writeReq(mem_addr);
-    my_sa_cache_vipt->writeReq(mem_addr);
+    if (stats.due(inst_count)) stats.writeInterval(inst_count);
+
+    if (inst_count >= next_ctx_switch)
+    {
+        next_ctx_switch = inst_count - inst_count % ctx_switch_every + ctx_switch_every;
+        switchContexts();
+    }
+
+    roi.updateWindow(inst_count + skipped_insts);
+
+    inst_budgets[tid].left = nextBoundary() / counting_threads;
+    PIN_ReleaseLock(&sim_lock);
 }
 
+// These knobs restrict the simulation to a region of interest
+KNOB<string> KnobRoiFunc(KNOB_MODE_WRITEONCE, "pintool",
+        "roi_func", "", "simulate only while a call to this function is active");
+
+KNOB<UINT64> KnobRoiSkip(KNOB_MODE_WRITEONCE, "pintool",
+        "roi_skip", "0", "simulate from this instruction on");
+
+KNOB<UINT64> KnobRoiLen(KNOB_MODE_WRITEONCE, "pintool",
+        "roi_len", "0", "simulate this many instructions, 0 for the rest of the run");
+
+KNOB<BOOL> KnobRoiMagic(KNOB_MODE_WRITEONCE, "pintool",
+        "roi_magic", "0", "simulate only between the markers xchg %rcx,%rcx and xchg %rdx,%rdx");
+
+// These knobs export the statistics for scripts
+KNOB<string> KnobStats(KNOB_MODE_WRITEONCE, "pintool",
+        "stats", "", "also write the counters of every model to this file");
+
+KNOB<string> KnobStatsFormat(KNOB_MODE_WRITEONCE, "pintool",
+        "stats_format", "json", "specify the format of -stats: json (one object per line) or csv");
+
+KNOB<UINT64> KnobStatsInterval(KNOB_MODE_WRITEONCE, "pintool",
+        "stats_interval", "0", "also write the deltas of the counters every this many instructions, 0 for the totals only");
+
+// These knobs control the sampled simulation and the basic block vector pass
+KNOB<string> KnobSample(KNOB_MODE_WRITEONCE, "pintool",
+        "sample", "", "measure the last measure instructions of every period, after warm instructions of warming: period,warm,measure");
+
+KNOB<string> KnobBBV(KNOB_MODE_WRITEONCE, "pintool",
+        "bbv", "", "write the basic block vectors to this file for SimPoint instead of simulating");
+
+KNOB<UINT64> KnobBBVInterval(KNOB_MODE_WRITEONCE, "pintool",
+        "bbv_interval", "10000000", "specify the instructions of each basic block vector");
+
+KNOB<UINT32> KnobBBVClusters(KNOB_MODE_WRITEONCE, "pintool",
+        "bbv_k", "0", "cluster the intervals into this many phases and print a simulation point for each");
+
 // This knob will set the cache param m_block_num
 KNOB<UINT32> KnobBlockNum(KNOB_MODE_WRITEONCE, "pintool",
         "n", "512", "specify the number of blocks in bytes");
@@ -466,18 +1101,309 @@ KNOB<UINT32> KnobSetsLog(KNOB_MODE_WRITEONCE, "pintool",
 KNOB<UINT32> KnobAssociativity(KNOB_MODE_WRITEONCE, "pintool",
         "a", "4", "specify the m_asso");
 
+// This knob will select the replacement policy of every cache model
+KNOB<string> KnobReplPolicy(KNOB_MODE_WRITEONCE, "pintool",
+        "p", "lru", "specify the replacement policy: lru, plru, nru, srrip, brrip, drrip, random or fifo");
+
+// This knob classifies the misses of the set-associative caches
+KNOB<BOOL> KnobClassify(KNOB_MODE_WRITEONCE, "pintool",
+        "3c", "0", "classify the misses of the set-associative caches as compulsory, capacity or conflict");
+
+// This knob adds other organizations of the set-associative cache, with the same geometry
+KNOB<string> KnobOrganizations(KNOB_MODE_WRITEONCE, "pintool",
+        "org", "", "also simulate these set organizations, comma separated: xor or prime (hashed index), skew (LRU only), or v<N> (N-line victim cache)");
+
+// These knobs describe the multi-level hierarchy, which shares the block size and replacement policy
+KNOB<BOOL> KnobHierarchy(KNOB_MODE_WRITEONCE, "pintool",
+        "hier", "0", "also simulate the L1I/L1D/L2/LLC hierarchy");
+
+KNOB<string> KnobL1I(KNOB_MODE_WRITEONCE, "pintool",
+        "l1i", "6,8,wb,wa,nine", "specify L1I as log_sets,asso,wb|wt,wa|nwa,nine|incl|excl[,prefetcher][,xor|prime|skew][,v<N>]");
+
+KNOB<string> KnobL1D(KNOB_MODE_WRITEONCE, "pintool",
+        "l1d", "6,8,wb,wa,nine", "specify L1D as log_sets,asso,wb|wt,wa|nwa,nine|incl|excl[,prefetcher][,xor|prime|skew][,v<N>]");
+
+KNOB<string> KnobL2(KNOB_MODE_WRITEONCE, "pintool",
+        "l2", "10,8,wb,wa,nine", "specify L2 as log_sets,asso,wb|wt,wa|nwa,nine|incl|excl[,prefetcher][,xor|prime|skew][,v<N>]");
+
+KNOB<string> KnobLLC(KNOB_MODE_WRITEONCE, "pintool",
+        "llc", "13,16,wb,wa,incl", "specify the LLC as log_sets,asso,wb|wt,wa|nwa,nine|incl|excl[,prefetcher][,xor|prime|skew][,v<N>]");
+
+// These knobs add latencies to the hierarchy, in core cycles
+KNOB<BOOL> KnobTiming(KNOB_MODE_WRITEONCE, "pintool",
+        "timing", "0", "estimate AMAT and memory-stall cycles of the hierarchy (with -hier)");
+
+KNOB<string> KnobLatency(KNOB_MODE_WRITEONCE, "pintool",
+        "lat", "4,4,10,26", "the lookup latencies of L1I,L1D,L2,LLC");
+
+KNOB<string> KnobMSHRs(KNOB_MODE_WRITEONCE, "pintool",
+        "mshrs", "8,16,32,64", "the MSHRs of L1I,L1D,L2,LLC");
+
+KNOB<string> KnobMemory(KNOB_MODE_WRITEONCE, "pintool",
+        "mem", "160,16", "the memory latency and bandwidth in bytes per cycle");
+
+// These knobs replace the stateless get_phy_page_no with a page allocator
+KNOB<string> KnobPageAlloc(KNOB_MODE_WRITEONCE, "pintool",
+        "palloc", "", "map pages on first touch with this allocator: buddy, random or color; the hierarchy is then physically addressed");
+
+KNOB<UINT32> KnobColorBits(KNOB_MODE_WRITEONCE, "pintool",
+        "color_bits", "0", "specify the log of the number of page colors, 0 to derive it from the LLC (with -hier) or -r and -b");
+
+KNOB<UINT32> KnobTHP(KNOB_MODE_WRITEONCE, "pintool",
+        "thp", "0", "promote a 2 MB region to a huge page once this many of its 4 KB pages are touched, 0 to disable");
+
+// These knobs choose how the VIVT and VIPT caches handle address spaces and synonyms
+KNOB<string> KnobContext(KNOB_MODE_WRITEONCE, "pintool",
+        "ctx", "flush", "on a context switch, flush the VIVT cache (flush) or keep the lines apart by ASID (asid)");
+
+KNOB<string> KnobSynonym(KNOB_MODE_WRITEONCE, "pintool",
+        "synonym", "none", "on a miss to a line resident under another virtual address: none, invalidate, rmap or ptag");
+
+KNOB<UINT64> KnobCtxSwitch(KNOB_MODE_WRITEONCE, "pintool",
+        "ctx_switch", "0", "switch the process out and back in every this many instructions, 0 to switch only at fork");
+
+// These knobs describe the TLBs as entries,asso and the page walk caches as PML4E,PDPTE,PDE entries
+KNOB<BOOL> KnobTLB(KNOB_MODE_WRITEONCE, "pintool",
+        "tlb", "0", "also simulate the dTLB/STLB and the page walker");
+
+KNOB<UINT32> KnobPageSizeLog(KNOB_MODE_WRITEONCE, "pintool",
+        "page", "12", "specify the log of the page size backing all data without -palloc: 12, 21 or 30");
+
+KNOB<string> KnobDTLB4K(KNOB_MODE_WRITEONCE, "pintool",
+        "dtlb4k", "64,4", "specify the L1 dTLB array for 4 KB pages");
+
+KNOB<string> KnobDTLB2M(KNOB_MODE_WRITEONCE, "pintool",
+        "dtlb2m", "32,4", "specify the L1 dTLB array for 2 MB pages");
+
+KNOB<string> KnobDTLB1G(KNOB_MODE_WRITEONCE, "pintool",
+        "dtlb1g", "4,4", "specify the L1 dTLB array for 1 GB pages");
+
+KNOB<string> KnobSTLB(KNOB_MODE_WRITEONCE, "pintool",
+        "stlb", "1024,8", "specify the STLB array shared by 4 KB and 2 MB pages");
+
+KNOB<string> KnobSTLB1G(KNOB_MODE_WRITEONCE, "pintool",
+        "stlb1g", "16,4", "specify the STLB array for 1 GB pages");
+
+KNOB<string> KnobPWC(KNOB_MODE_WRITEONCE, "pintool",
+        "pwc", "2,4,32", "specify the page walk cache entries for PML4E,PDPTE,PDE, 0 for none at a level");
+
+// These knobs control the one-pass LRU miss-ratio curves
+KNOB<string> KnobMRC(KNOB_MODE_WRITEONCE, "pintool",
+        "mrc", "", "write the LRU miss-ratio curves of every cache size to this CSV file");
+
+KNOB<string> KnobMRCSets(KNOB_MODE_WRITEONCE, "pintool",
+        "mrc_sets", "4,13", "specify the range of log_sets of the set-associative curves");
+
+KNOB<UINT32> KnobMRCAsso(KNOB_MODE_WRITEONCE, "pintool",
+        "mrc_asso", "16", "specify the largest associativity of the set-associative curves");
+
+// These knobs control the sampled (SHARDS) miss-ratio curve for footprints too large for -mrc
+KNOB<string> KnobShards(KNOB_MODE_WRITEONCE, "pintool",
+        "shards", "", "write the sampled fully associative LRU miss-ratio curve to this CSV file");
+
+KNOB<FLT64> KnobShardsRate(KNOB_MODE_WRITEONCE, "pintool",
+        "shards_rate", "0.01", "specify the initial fraction of lines sampled");
+
+KNOB<UINT64> KnobShardsLines(KNOB_MODE_WRITEONCE, "pintool",
+        "shards_lines", "65536", "lower the rate to track at most this many lines, 0 for a fixed rate");
+
+// These knobs describe the private L1s of the coherence simulation
+KNOB<UINT32> KnobCores(KNOB_MODE_WRITEONCE, "pintool",
+        "cores", "0", "also simulate this many cores with private L1s kept coherent, 0 to disable");
+
+KNOB<string> KnobCohL1(KNOB_MODE_WRITEONCE, "pintool",
+        "coh_l1", "6,8", "specify each private L1 as log_sets,asso");
+
+KNOB<string> KnobProtocol(KNOB_MODE_WRITEONCE, "pintool",
+        "protocol", "mesi", "specify the coherence protocol: mesi or moesi");
+
+KNOB<UINT32> KnobFalseSharingTop(KNOB_MODE_WRITEONCE, "pintool",
+        "fs_top", "10", "report this many lines with the most false sharing misses");
+
+// This knob enables the miss attribution of the set-associative cache
+KNOB<UINT32> KnobAttrib(KNOB_MODE_WRITEONCE, "pintool",
+        "attrib", "0", "report the top N instructions and heap allocation sites by misses, 0 to disable");
+
+// These knobs control the buffered pipeline
+KNOB<UINT32> KnobWorkers(KNOB_MODE_WRITEONCE, "pintool",
+        "workers", "0", "simulate on this many internal threads fed by trace buffers, 0 to simulate inline");
+
+KNOB<UINT32> KnobBufferPages(KNOB_MODE_WRITEONCE, "pintool",
+        "buf_pages", "256", "specify the size of each thread's trace buffer in 4 KB pages");
+
+// These knobs control the trace record mode
+KNOB<string> KnobTraceOut(KNOB_MODE_WRITEONCE, "pintool",
+        "trace_out", "", "write the memory references to this file for cacheReplay instead of simulating");
+
+KNOB<BOOL> KnobTracePC(KNOB_MODE_WRITEONCE, "pintool",
+        "trace_pc", "0", "also record the PC of each reference");
+
+KNOB<BOOL> KnobTraceFetch(KNOB_MODE_WRITEONCE, "pintool",
+        "trace_fetch", "0", "also record instruction fetches, needed to replay the L1I of -hier");
+
+// Pin calls this function every time a new trace is encountered
+VOID Trace(TRACE trace, VOID *v)
+{
+    if (!roi.active() && !roi.hasWindow() && !sampling) return;
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)countInsts, IARG_THREAD_ID, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+}
+
+// Record a memory operand in the trace buffer
+void fillRef(INS ins, UINT32 op, UINT32 size, RefType type)
+{
+    INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, ref_buffer,
+                                   IARG_MEMORYOP_EA, op, offsetof(MemRef, addr),
+                                   IARG_INST_PTR, offsetof(MemRef, pc),
+                                   IARG_UINT32, size, offsetof(MemRef, size),
+                                   IARG_UINT32, type, offsetof(MemRef, type), IARG_END);
+}
+
+// Instrument the references of an instruction for the trace record mode
+VOID RecordInstruction(INS ins)
+{
+    if (INS_HasScatteredMemoryAccess(ins))
+    {
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)recordMultiRef,
+                                 IARG_INST_PTR, IARG_MULTI_MEMORYACCESS_EA, IARG_END);
+    }
+    else
+    {
+        UINT32 mem_ops = INS_MemoryOperandCount(ins);
+        for (UINT32 op = 0; op < mem_ops; op++)
+        {
+            UINT32 size = INS_MemoryOperandSize(ins, op);
+            if (INS_MemoryOperandIsRead(ins, op))
+                INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)recordRef, IARG_INST_PTR,
+                                         IARG_MEMORYOP_EA, op, IARG_UINT32, size, IARG_UINT32, REF_READ, IARG_END);
+            if (INS_MemoryOperandIsWritten(ins, op))
+                INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)recordRef, IARG_INST_PTR,
+                                         IARG_MEMORYOP_EA, op, IARG_UINT32, size, IARG_UINT32, REF_WRITE, IARG_END);
+        }
+    }
+
+    if (KnobTraceFetch.Value())
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)recordRef, IARG_INST_PTR,
+                       IARG_INST_PTR, IARG_UINT32, INS_Size(ins), IARG_UINT32, REF_FETCH, IARG_END);
+}
+
+// Insert a call of fn with args before ins, predicated or not. Under -sample the call only
+// runs while guard returns non-zero, so the phases change without re-instrumenting
+void insertModelCall(INS ins, bool predicated, AFUNPTR guard, AFUNPTR fn, IARGLIST args)
+{
+    if (sampling && predicated)
+    {
+        INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE, guard, IARG_END);
+        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, fn, IARG_IARGLIST, args, IARG_END);
+    }
+    else if (sampling)
+    {
+        INS_InsertIfCall(ins, IPOINT_BEFORE, guard, IARG_END);
+        INS_InsertThenCall(ins, IPOINT_BEFORE, fn, IARG_IARGLIST, args, IARG_END);
+    }
+    else if (predicated)
+    {
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, fn, IARG_IARGLIST, args, IARG_END);
+    }
+    else
+    {
+        INS_InsertCall(ins, IPOINT_BEFORE, fn, IARG_IARGLIST, args, IARG_END);
+    }
+    IARGLIST_Free(args);
+}
+
+IARGLIST memArgs(UINT32 op, UINT32 size)
+{
+    IARGLIST args = IARGLIST_Alloc();
+    IARGLIST_AddArguments(args, IARG_THREAD_ID, IARG_INST_PTR, IARG_MEMORYOP_EA, op, IARG_UINT32, size, IARG_END);
+    return args;
+}
+
 // Pin calls this function every time a new instruction is encountered
 VOID Instruction(INS ins, VOID *v)
 {
-    if (INS_IsMemoryRead(ins))
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)readCache, IARG_MEMORYREAD_EA, IARG_END);
-    if (INS_IsMemoryWrite(ins))
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)writeCache, IARG_MEMORYWRITE_EA, IARG_END);
+    roi.instrumentMarker(ins);
+    if (!roi.active()) return;
+
+    if (trace_writer)
+    {
+        RecordInstruction(ins);
+        return;
+    }
+
+    bool buffered = (worker_num > 0);
+
+    // Predicated calls skip false cmov and zero-count rep iterations, and a rep
+    // string instruction calls them once per iteration with its element size
+    if (INS_HasScatteredMemoryAccess(ins))
+    {
+        IARGLIST args = IARGLIST_Alloc();
+        IARGLIST_AddArguments(args, IARG_THREAD_ID, IARG_INST_PTR, IARG_MULTI_MEMORYACCESS_EA, IARG_END);
+        insertModelCall(ins, true, (AFUNPTR)sampleSimulated, buffered ? (AFUNPTR)recordMultiMem : (AFUNPTR)accessMultiMem, args);
+    }
+    else
+    {
+        UINT32 mem_ops = INS_MemoryOperandCount(ins);
+        for (UINT32 op = 0; op < mem_ops; op++)
+        {
+            UINT32 size = INS_MemoryOperandSize(ins, op);
+            if (INS_MemoryOperandIsRead(ins, op))
+            {
+                if (buffered) fillRef(ins, op, size, REF_READ);
+                else insertModelCall(ins, true, (AFUNPTR)sampleSimulated, (AFUNPTR)readCache, memArgs(op, size));
+            }
+            if (INS_MemoryOperandIsWritten(ins, op))
+            {
+                if (buffered) fillRef(ins, op, size, REF_WRITE);
+                else insertModelCall(ins, true, (AFUNPTR)sampleSimulated, (AFUNPTR)writeCache, memArgs(op, size));
+            }
+        }
+    }
+
+    if (my_hierarchy == NULL) return;
+
+    if (buffered)
+        INS_InsertFillBuffer(ins, IPOINT_BEFORE, ref_buffer,
+                             IARG_INST_PTR, offsetof(MemRef, addr),
+                             IARG_INST_PTR, offsetof(MemRef, pc),
+                             IARG_UINT32, INS_Size(ins), offsetof(MemRef, size),
+                             IARG_UINT32, REF_FETCH, offsetof(MemRef, type), IARG_END);
+    else
+    {
+        IARGLIST args = IARGLIST_Alloc();
+        IARGLIST_AddArguments(args, IARG_THREAD_ID, IARG_INST_PTR, IARG_UINT32, INS_Size(ins), IARG_END);
+        insertModelCall(ins, false, (AFUNPTR)sampleMeasured, (AFUNPTR)fetchInst, args);
+    }
 }
 
 // This function is called when the application exits
 VOID Fini(INT32 code, VOID *v)
 {
+    if (bbv_file)
+    {
+        dumpBBV(KnobBBVClusters.Value());
+        return;
+    }
+
+    syncInsts();
+    dumpROI();
+
+    if (trace_writer)
+    {
+        printf("\nRecorded %lu references of %lu instructions to %s\n",
+               trace_writer->getRefCount(), inst_count, KnobTraceOut.Value().c_str());
+        trace_writer->close(inst_count);
+        delete trace_writer;
+        return;
+    }
+
+    // 各模型在下面输出后即被删除
+    stats.close(inst_count);
+    dumpSamples();
+
+    printf("\nReplacement policy: %s\n", KnobReplPolicy.Value().c_str());
+
     printf("\nFully Associative Cache:\n");
     my_fa_cache->dumpResults();
 
@@ -493,12 +1419,94 @@ VOID Fini(INT32 code, VOID *v)
     printf("\nSet-Associative Cache (VIPT):\n");
     my_sa_cache_vipt->dumpResults();
 
+    for (size_t i = 0; i < my_org_caches.size(); i++)
+    {
+        printf("\nSet-Associative Cache (%s):\n", my_org_names[i].c_str());
+        my_org_caches[i]->dumpResults();
+        dumpConflictReduction(my_org_caches[i], my_sa_cache);
+        delete my_org_caches[i];
+    }
+
     delete my_fa_cache;
     delete my_sa_cache;
 
     delete my_sa_cache_vivt;
     delete my_sa_cache_pipt;
     delete my_sa_cache_vipt;
+
+    if (page_allocator)
+    {
+        printf("\nPage Allocation:\n");
+        page_allocator->dumpResults();
+        delete page_allocator;
+        page_allocator = NULL;
+    }
+
+    if (my_mmu)
+    {
+        printf("\nTLB:");
+        my_mmu->dumpResults(measured_insts);
+        delete my_mmu;
+    }
+
+    if (my_hierarchy)
+    {
+        printf("\nCache Hierarchy:\n");
+        my_hierarchy->dumpResults(KnobBlockSizeLog.Value(), measured_insts);
+        delete my_hierarchy;
+    }
+
+    if (my_mrc)
+    {
+        printf("\nMiss-Ratio Curves:\n");
+        my_mrc->dumpResults();
+
+        FILE* fp = fopen(KnobMRC.Value().c_str(), "w");
+        if (fp)
+        {
+            my_mrc->writeCSV(fp);
+            fclose(fp);
+            printf("\tcurves written to %s\n", KnobMRC.Value().c_str());
+        }
+        else
+        {
+            fprintf(stderr, "Cannot create %s\n", KnobMRC.Value().c_str());
+        }
+        delete my_mrc;
+    }
+
+    if (my_shards)
+    {
+        printf("\nSampled Miss-Ratio Curve:\n");
+        my_shards->dumpResults();
+
+        FILE* fp = fopen(KnobShards.Value().c_str(), "w");
+        if (fp)
+        {
+            my_shards->writeCSV(fp);
+            fclose(fp);
+            printf("\tcurve written to %s\n", KnobShards.Value().c_str());
+        }
+        else
+        {
+            fprintf(stderr, "Cannot create %s\n", KnobShards.Value().c_str());
+        }
+        delete my_shards;
+    }
+
+    if (my_coherence)
+    {
+        printf("\nCoherence:\n");
+        my_coherence->dumpResults(KnobFalseSharingTop.Value(), describeAddress);
+        delete my_coherence;
+    }
+
+    if (my_attrib)
+    {
+        printf("\nMiss Attribution (Set-Associative Cache):\n");
+        my_attrib->dumpResults(KnobAttrib.Value(), describeAddress);
+        delete my_attrib;
+    }
 }
 
 // argc, argv are the entire command line, including pin -t <toolname> -- ...
@@ -506,17 +1514,283 @@ int main(int argc, char* argv[])
 {
     // Initialize pin
     PIN_Init(argc, argv);
+    PIN_InitLock(&sim_lock);
 
-    my_fa_cache = new FullAssoCache(KnobBlockNum.Value(), KnobBlockSizeLog.Value());
-    my_sa_cache = new SetAssoCache(KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
+    // 各个门在区域开始之前关闭
+    roi.init(KnobRoiFunc.Value(), KnobRoiSkip.Value(), KnobRoiLen.Value(), KnobRoiMagic.Value());
+
+    if (!KnobSample.Value().empty())
+    {
+        sampling = true;
+        if (sscanf(KnobSample.Value().c_str(), "%lu,%lu,%lu", &sample_period, &sample_warm, &sample_measure) != 3
+            || sample_measure == 0 || sample_warm + sample_measure > sample_period)
+        {
+            fprintf(stderr, "Malformed sampling, expected period,warm,measure with warm + measure <= period\n");
+            return -1;
+        }
+    }
 
-    my_sa_cache_vivt = new SetAssoCache_VIVT(KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
-    my_sa_cache_pipt = new SetAssoCache_PIPT(KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
-    my_sa_cache_vipt = new SetAssoCache_VIPT(KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
+    if (!KnobBBV.Value().empty())
+    {
+        bbv_interval = KnobBBVInterval.Value();
+        bbv_file = fopen(KnobBBV.Value().c_str(), "w");
+        if (bbv_file == NULL || bbv_interval == 0)
+        {
+            fprintf(stderr, "Cannot create the basic block vector file %s\n", KnobBBV.Value().c_str());
+            return -1;
+        }
+
+        TRACE_AddInstrumentFunction(BbvTrace, 0);
+        PIN_AddFiniFunction(Fini, 0);
+        PIN_StartProgram();
+        return 0;
+    }
+
+    if (!KnobTraceOut.Value().empty())
+    {
+        if (sampling)
+        {
+            fprintf(stderr, "-sample only applies to the simulation, not to -trace_out\n");
+            return -1;
+        }
+
+        trace_writer = new TraceWriter();
+        if (!trace_writer->open(KnobTraceOut.Value().c_str(), KnobTracePC.Value()))
+        {
+            fprintf(stderr, "Cannot create the trace file %s\n", KnobTraceOut.Value().c_str());
+            return -1;
+        }
+        PIN_InitLock(&trace_lock);
+
+        INS_AddInstrumentFunction(Instruction, 0);
+        TRACE_AddInstrumentFunction(Trace, 0);
+        PIN_AddFiniFunction(Fini, 0);
+        PIN_StartProgram();
+        return 0;
+    }
+
+    string policy = KnobReplPolicy.Value();
+    line_size_log = KnobBlockSizeLog.Value();
+
+    ContextMode ctx_mode;
+    SynonymPolicy syn_policy;
+    if (!parseContextMode(KnobContext.Value(), ctx_mode) || !parseSynonymPolicy(KnobSynonym.Value(), syn_policy))
+    {
+        fprintf(stderr, "Malformed virtual cache configuration, expected -ctx flush|asid and -synonym none|invalidate|rmap|ptag\n");
+        return -1;
+    }
+
+    my_fa_cache = newCacheModel<FullAssoCache>(policy, KnobBlockNum.Value(), KnobBlockSizeLog.Value());
+    my_sa_cache = newCacheModel<SetAssoCache>(policy, KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
+
+    my_sa_cache_vivt = newCacheModel<SetAssoCache_VIVT>(policy, KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value(),
+                                                        ctx_mode, syn_policy);
+    my_sa_cache_pipt = newCacheModel<SetAssoCache_PIPT>(policy, KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
+    my_sa_cache_vipt = newCacheModel<SetAssoCache_VIPT>(policy, KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value(),
+                                                        ctx_mode, syn_policy);
+
+    if (my_fa_cache == NULL)
+    {
+        fprintf(stderr, "Unknown replacement policy: %s\n", policy.c_str());
+        return -1;
+    }
+
+    if (KnobClassify.Value())
+    {
+        my_sa_cache->enableMissClassification();
+        my_sa_cache_vivt->enableMissClassification();
+        my_sa_cache_pipt->enableMissClassification();
+        my_sa_cache_vipt->enableMissClassification();
+    }
+
+    my_org_names = splitList(KnobOrganizations.Value());
+    for (size_t i = 0; i < my_org_names.size(); i++)
+    {
+        CacheModel* cache = newCacheOrganization(policy, my_org_names[i], KnobSetsLog.Value(),
+                                                 KnobBlockSizeLog.Value(), KnobAssociativity.Value());
+        if (cache == NULL)
+        {
+            fprintf(stderr, "Malformed organization %s, expected xor, prime, skew (with -p lru only) or v<N>\n", my_org_names[i].c_str());
+            return -1;
+        }
+
+        // 冲突缺失的减少量相对于同样几何参数的 my_sa_cache
+        cache->enableMissClassification();
+        my_sa_cache->enableMissClassification();
+        my_org_caches.push_back(cache);
+    }
+
+    if (KnobHierarchy.Value())
+    {
+        my_hierarchy = newCacheHierarchy(policy, KnobBlockSizeLog.Value(), KnobL1I.Value(),
+                                         KnobL1D.Value(), KnobL2.Value(), KnobLLC.Value());
+        if (my_hierarchy == NULL)
+        {
+            fprintf(stderr, "Malformed cache level, expected log_sets,asso,wb|wt,wa|nwa,nine|incl|excl"
+                            "[,nextline|stride|stream|bo][,xor|prime|skew][,v<N>], skew with -p lru only\n");
+            return -1;
+        }
+
+        if (KnobTiming.Value() && !my_hierarchy->setTiming(KnobLatency.Value(), KnobMSHRs.Value(), KnobMemory.Value()))
+        {
+            fprintf(stderr, "Malformed timing, expected l1i,l1d,l2,llc latencies and MSHRs, and latency,bytes_per_cycle of memory\n");
+            return -1;
+        }
+    }
+
+    if (!KnobPageAlloc.Value().empty())
+    {
+        UINT32 color_bits = KnobColorBits.Value(), llc_log_sets;
+        if (color_bits == 0 && KnobHierarchy.Value() && sscanf(KnobLLC.Value().c_str(), "%u", &llc_log_sets) == 1)
+            color_bits = get_color_bits(llc_log_sets, KnobBlockSizeLog.Value());
+        else if (color_bits == 0)
+            color_bits = get_color_bits(KnobSetsLog.Value(), KnobBlockSizeLog.Value());
+
+        page_allocator = newPageAllocator(KnobPageAlloc.Value(), color_bits, KnobTHP.Value());
+        if (page_allocator == NULL)
+        {
+            fprintf(stderr, "Malformed page allocation, expected -palloc buddy|random|color and -thp 0..512\n");
+            return -1;
+        }
+    }
+
+    if (KnobTLB.Value())
+    {
+        my_mmu = newMMU(KnobPageSizeLog.Value(), KnobPWC.Value(), KnobDTLB4K.Value(), KnobDTLB2M.Value(),
+                        KnobDTLB1G.Value(), KnobSTLB.Value(), KnobSTLB1G.Value());
+        if (my_mmu == NULL)
+        {
+            fprintf(stderr, "Malformed TLB configuration, expected power-of-two entries,asso arrays\n");
+            return -1;
+        }
+    }
+
+    if (!KnobMRC.Value().empty())
+    {
+        my_mrc = newMissRatioCurve(KnobBlockSizeLog.Value(), KnobMRCSets.Value(), KnobMRCAsso.Value());
+        if (my_mrc == NULL)
+        {
+            fprintf(stderr, "Malformed miss-ratio curve configuration, expected min_log_sets,max_log_sets\n");
+            return -1;
+        }
+    }
+
+    if (!KnobShards.Value().empty())
+    {
+        my_shards = newSampledReuseDistance(KnobBlockSizeLog.Value(), KnobShardsRate.Value(), KnobShardsLines.Value());
+        if (my_shards == NULL)
+        {
+            fprintf(stderr, "The sampling rate must be in (0, 1]\n");
+            return -1;
+        }
+    }
+
+    worker_num = KnobWorkers.Value();
+    if (worker_num > SIM_UNITS) worker_num = SIM_UNITS;
+
+    core_num = KnobCores.Value();
+    if (core_num > 0)
+    {
+        UINT32 log_sets, asso;
+        string protocol = KnobProtocol.Value();
+        if (core_num > CoherentCaches::MAX_CORES
+            || sscanf(KnobCohL1.Value().c_str(), "%u,%u", &log_sets, &asso) != 2
+            || (protocol != "mesi" && protocol != "moesi"))
+        {
+            fprintf(stderr, "Malformed coherence configuration, expected -cores 1..64, -coh_l1 log_sets,asso and mesi|moesi\n");
+            return -1;
+        }
+        my_coherence = new CoherentCaches(core_num, policy, log_sets, KnobBlockSizeLog.Value(), asso,
+                                          protocol == "mesi" ? COH_MESI : COH_MOESI);
+
+        // 一致性依赖各线程访问的真实交错, 而 trace buffer 只保留每个线程内部的顺序
+        if (worker_num > 0) fprintf(stderr, "-cores simulates inline, ignoring -workers\n");
+        worker_num = 0;
+        PIN_InitSymbols();
+    }
+
+    if (page_allocator)
+    {
+        // 页框在首次访问时分配, 各模型必须按同一顺序看到这些访问
+        if (worker_num > 0) fprintf(stderr, "-palloc simulates inline, ignoring -workers\n");
+        worker_num = 0;
+    }
+
+    ctx_switch_every = KnobCtxSwitch.Value();
+    if (ctx_switch_every > 0)
+    {
+        next_ctx_switch = ctx_switch_every;
+
+        // 切换按指令数发生, 模型必须与指令计数同步更新
+        if (worker_num > 0) fprintf(stderr, "-ctx_switch simulates inline, ignoring -workers\n");
+        worker_num = 0;
+    }
+
+    if (sampling)
+    {
+        sampled_models[0] = my_fa_cache;
+        sampled_models[1] = my_sa_cache;
+        sampled_models[2] = my_sa_cache_vivt;
+        sampled_models[3] = my_sa_cache_pipt;
+        sampled_models[4] = my_sa_cache_vipt;
+
+        // 测量窗口的边界按指令数划分, 模型必须与指令计数同步更新
+        if (worker_num > 0) fprintf(stderr, "-sample simulates inline, ignoring -workers\n");
+        worker_num = 0;
+    }
+
+    if (KnobAttrib.Value())
+    {
+        // 归因需要每次访问的 PC 和当时的分配表, 只能在应用线程上直接模拟
+        if (worker_num > 0) fprintf(stderr, "-attrib simulates inline, ignoring -workers\n");
+        worker_num = 0;
+
+        my_attrib = new MissAttribution();
+        PIN_InitSymbols();
+        IMG_AddInstrumentFunction(ImageLoad, 0);
+    }
+
+    if (!KnobStats.Value().empty())
+    {
+        stats.watch("insts", &inst_count);
+        my_fa_cache->registerStats(stats, "fa");
+        my_sa_cache->registerStats(stats, "sa");
+        my_sa_cache_vivt->registerStats(stats, "vivt");
+        my_sa_cache_pipt->registerStats(stats, "pipt");
+        my_sa_cache_vipt->registerStats(stats, "vipt");
+        for (size_t i = 0; i < my_org_caches.size(); i++) my_org_caches[i]->registerStats(stats, my_org_names[i]);
+        if (my_hierarchy) my_hierarchy->registerStats(stats, "hier");
+
+        if (!stats.open(KnobStats.Value(), KnobStatsFormat.Value(), KnobStatsInterval.Value()))
+        {
+            fprintf(stderr, "Cannot write the statistics to %s as %s\n", KnobStats.Value().c_str(), KnobStatsFormat.Value().c_str());
+            return -1;
+        }
+    }
+
+    if (worker_num > 0)
+    {
+        ref_buffer = PIN_DefineTraceBuffer(sizeof(MemRef), KnobBufferPages.Value(), BufferFull, 0);
+        if (ref_buffer == BUFFER_ID_INVALID || !startWorkers())
+        {
+            fprintf(stderr, "Cannot set up the buffered pipeline\n");
+            return -1;
+        }
+
+        PIN_AddThreadStartFunction(ThreadStart, 0);
+        PIN_AddThreadFiniFunction(ThreadFini, 0);
+        PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
+    }
 
     // Register Instruction to be called to instrument instructions
     INS_AddInstrumentFunction(Instruction, 0);
 
+    // Register Trace to be called to count instructions
+    TRACE_AddInstrumentFunction(Trace, 0);
+
+    // Register ForkChild to be called in the child of a fork
+    PIN_AddForkFunction(FPOINT_AFTER_IN_CHILD, ForkChild, 0);
+
     // Register Fini to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
 
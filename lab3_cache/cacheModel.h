@@ -0,0 +1,4102 @@
+/*
+ * Cache, TLB and hierarchy models shared by the cacheModel Pin tool and the
+ * standalone cacheReplay simulator. Nothing here depends on Pin.
+ */
+#ifndef CACHE_MODEL_H
+#define CACHE_MODEL_H
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include "../common/statsRegistry.h"
+
+using std::string;
+using std::vector;
+using std::pair;
+using std::unordered_map;
+
+typedef int                 INT32;
+typedef unsigned char       UINT8;
+typedef unsigned int        UINT32;
+typedef unsigned long int   UINT64;
+typedef long int            INT64;
+
+
+#define PAGE_SIZE_LOG       12
+#define PHY_MEM_SIZE_LOG    30
+#define VIR_ADDR_BITS       48      // x86-64 的 4 级页表
+
+#define get_vir_page_no(virtual_addr)   (virtual_addr >> PAGE_SIZE_LOG)
+#define get_page_offset(addr)           (addr & ((1u << PAGE_SIZE_LOG) - 1))
+
+// Obtain physical page number according to a given virtual page number
+inline UINT64 get_phy_page_no(UINT64 virtual_page_no)
+{
+    // Fold the upper bits of a 48-bit address into the hashed ones so that they do not alias
+    UINT32 vpn = (UINT32)(virtual_page_no ^ (virtual_page_no >> 32));
+    vpn = (~vpn ^ (vpn << 16)) + (vpn & (vpn << 16)) + (~vpn | (vpn << 2));
+
+    UINT32 mask = (UINT32)(~0) << (32 - PHY_MEM_SIZE_LOG);
+    mask = mask >> (32 - PHY_MEM_SIZE_LOG + PAGE_SIZE_LOG);
+    mask = mask << PAGE_SIZE_LOG;
+
+    return vpn & mask;
+}
+
+/**************************************
+ * Page Allocation
+ *
+ * get_phy_page_no scrambles page numbers without any state, and distinct
+ * pages may share a frame. A PageAllocator instead maps each page on its
+ * first touch to a free frame of a PHY_MEM_SIZE_LOG physical memory,
+ * managed by a binary buddy allocator, and records the mapping in a
+ * four-level radix page table. The frame is chosen by mode:
+ *   buddy   the lowest free frame, so pages touched in order are contiguous
+ *   random  a free frame near a random one, like a long-running system
+ *   color   a frame whose color (the bits of the frame number that index
+ *           the cache sets) equals that of the page number, so pages
+ *           contiguous in virtual memory do not conflict in the cache
+ * With a THP threshold, an aligned 2 MB region is promoted to a huge page
+ * once that many of its 4 KB pages have been touched: an order-9 block is
+ * allocated, and the frames of the base pages are freed.
+ * Every address space has a page table of its own. fork() copies the
+ * current one with all its pages shared copy-on-write: the first write to
+ * a shared page from either space gives the writer a copy in a new frame.
+**************************************/
+enum PageAllocMode { PALLOC_BUDDY, PALLOC_RANDOM, PALLOC_COLOR };
+
+class PageAllocator
+{
+public:
+    PageAllocator(PageAllocMode mode, UINT32 color_bits, UINT32 thp_threshold)
+        : m_mode(mode), m_color_bits(color_bits), m_thp(thp_threshold), m_seed(0x9e3779b97f4a7c15ul),
+          m_last_vpn(~0ul), m_last_pfn(0), m_last_writable(false), m_nodes(1), m_pages(0), m_frames(0),
+          m_huge(0), m_thp_failed(0), m_color_missed(0), m_cow_copies(0)
+    {
+        if (m_color_bits > MAX_ORDER) m_color_bits = MAX_ORDER;
+        m_root = new Node();
+        m_spaces.push_back(m_root);
+        for (UINT64 f = 0; f < FRAME_NUM; f += 1ul << MAX_ORDER) insertFree(MAX_ORDER, f);
+    }
+
+    ~PageAllocator()
+    {
+        for (size_t i = 0; i < m_spaces.size(); i++) freeNode(m_spaces[i], 0);
+    }
+
+    // Translate virtual_addr in the current address space, mapping its page on the first touch.
+    // A write to a page shared copy-on-write first copies it
+    UINT64 translate(UINT64 virtual_addr, bool is_write = false)
+    {
+        UINT64 vpn = get_vir_page_no(virtual_addr);
+        if (vpn != m_last_vpn || (is_write && !m_last_writable))
+        {
+            m_last_pfn = lookup(vpn, is_write, m_last_writable);
+            m_last_vpn = vpn;
+        }
+        return (m_last_pfn << PAGE_SIZE_LOG) + get_page_offset(virtual_addr);
+    }
+
+    // The log of the size of the page mapping virtual_addr in the current address space, PAGE_SIZE_LOG
+    // or that of a huge page, mapping it on the first touch
+    UINT32 pageLog(UINT64 virtual_addr)
+    {
+        translate(virtual_addr);
+
+        UINT64 vpn = get_vir_page_no(virtual_addr);
+        Node* node = m_root;
+        for (UINT32 level = 0; level < LEVELS - 2; level++) node = (Node*)node->entry[slot(vpn, level)];
+        return (node->entry[slot(vpn, LEVELS - 2)] & HUGE_BIT) ? PAGE_SIZE_LOG + HUGE_ORDER : PAGE_SIZE_LOG;
+    }
+
+    // Copy the current address space, sharing all its pages copy-on-write, and return the id of the copy
+    UINT32 fork()
+    {
+        m_spaces.push_back(copyNode(m_root, 0));
+        m_last_vpn = ~0ul;
+        return m_spaces.size() - 1;
+    }
+
+    // Translate the later addresses in address space id, 0 being the first one
+    void switchTo(UINT32 id)
+    {
+        m_root = m_spaces[id];
+        m_last_vpn = ~0ul;
+    }
+
+    void dumpResults()
+    {
+        static const char* names[] = { "buddy", "random", "color" };
+        printf("\tallocator: %s,\t4 KB pages mapped: %lu,\tframes in use: %lu of %lu,\tpage table nodes: %lu (%lu KB)\n",
+               names[m_mode], m_pages, m_frames, FRAME_NUM, m_nodes, m_nodes * sizeof(Node) >> 10);
+        if (m_mode == PALLOC_COLOR)
+            printf("\tcolors: %u,\tpages given another color: %lu\n", 1u << m_color_bits, m_color_missed);
+        if (m_thp)
+            printf("\thuge pages: %lu,\tregions left unpromoted for lack of a 2 MB block: %lu\n", m_huge, m_thp_failed);
+        if (m_spaces.size() > 1)
+            printf("\taddress spaces: %lu,\tshared pages copied on write: %lu,\tstill shared: %lu\n",
+                   (UINT64)m_spaces.size(), m_cow_copies, (UINT64)m_shares.size());
+        printf("\tfree blocks by order:");
+        for (UINT32 o = 0; o <= MAX_ORDER; o++) printf(" %lu", (UINT64)m_free[o].size());
+        printf("\n");
+    }
+
+private:
+    static const UINT32 MAX_ORDER = 10;             // 4 MB blocks
+    static const UINT32 HUGE_ORDER = 21 - PAGE_SIZE_LOG;
+    static const UINT64 FRAME_NUM = 1ul << (PHY_MEM_SIZE_LOG - PAGE_SIZE_LOG);
+    static const UINT32 LEVEL_BITS = 9;
+    static const UINT32 LEVELS = (VIR_ADDR_BITS - PAGE_SIZE_LOG) / LEVEL_BITS;
+    static const UINT32 FLAG_BITS = 2;
+    static const UINT64 MAPPED_BIT = 1;             // 页表项有效
+    static const UINT64 HUGE_BIT = 1;               // 页目录项映射 2 MB 大页
+    static const UINT64 COW_BIT = 2;                // 与其它地址空间写时复制共享
+
+    // An entry of the upper levels points to the next node, or at the page directory level
+    // holds (pfn << FLAG_BITS) | HUGE_BIT; a page table entry holds (pfn << FLAG_BITS) | MAPPED_BIT.
+    // Either may also have COW_BIT. used counts the entries set; thp_failed marks a page table whose
+    // region could not be promoted for lack of a 2 MB block
+    struct Node
+    {
+        UINT64 entry[1 << LEVEL_BITS];
+        UINT32 used;
+        bool thp_failed;
+
+        Node() : used(0), thp_failed(false) { memset(entry, 0, sizeof(entry)); }
+    };
+
+    PageAllocMode m_mode;
+    UINT32 m_color_bits;
+    UINT32 m_thp;
+    UINT64 m_seed;
+    UINT64 m_last_vpn;      // 最近一次翻译, 连续访问同一页时不必遍历页表
+    UINT64 m_last_pfn;
+    bool m_last_writable;
+    Node* m_root;           // 当前地址空间的页表
+    vector<Node*> m_spaces;
+    unordered_map<UINT64, UINT32> m_shares;     // 共享页 (大页按首帧) -> 另外还映射它的地址空间数
+    std::set<UINT64> m_free[MAX_ORDER + 1];     // Free blocks of each order, by first frame
+    std::set<pair<UINT64, UINT64> > m_free_colored[MAX_ORDER + 1];  // 同样的空闲块, 按 (首帧颜色, 首帧) 排序
+
+    UINT64 m_nodes;
+    UINT64 m_pages;
+    UINT64 m_frames;
+    UINT64 m_huge;
+    UINT64 m_thp_failed;
+    UINT64 m_color_missed;
+    UINT64 m_cow_copies;
+
+    static UINT32 slot(UINT64 vpn, UINT32 level)
+    {
+        return (vpn >> ((LEVELS - 1 - level) * LEVEL_BITS)) & ((1 << LEVEL_BITS) - 1);
+    }
+
+    void freeNode(Node* node, UINT32 level)
+    {
+        if (level < LEVELS - 1)
+            for (UINT32 i = 0; i < (1u << LEVEL_BITS); i++)
+                if (node->entry[i] && !(level == LEVELS - 2 && (node->entry[i] & HUGE_BIT)))
+                    freeNode((Node*)node->entry[i], level + 1);
+        delete node;
+    }
+
+    Node* child(Node* node, UINT32 i)
+    {
+        if (node->entry[i] == 0)
+        {
+            node->entry[i] = (UINT64)new Node();
+            node->used++;
+            m_nodes++;
+        }
+        return (Node*)node->entry[i];
+    }
+
+    // A copy of node and the nodes below it, marking the pages mapped by both copy-on-write
+    Node* copyNode(Node* node, UINT32 level)
+    {
+        Node* copy = new Node(*node);
+        m_nodes++;
+        for (UINT32 i = 0; i < (1u << LEVEL_BITS); i++)
+        {
+            UINT64& entry = node->entry[i];
+            if (entry == 0) continue;
+
+            if (level == LEVELS - 1 || (level == LEVELS - 2 && (entry & HUGE_BIT)))
+            {
+                entry |= COW_BIT;
+                copy->entry[i] = entry;
+                m_shares[entry >> FLAG_BITS]++;
+            }
+            else
+            {
+                copy->entry[i] = (UINT64)copyNode((Node*)entry, level + 1);
+            }
+        }
+        return copy;
+    }
+
+    UINT64 lookup(UINT64 vpn, bool is_write, bool& writable)
+    {
+        Node* node = m_root;
+        for (UINT32 level = 0; level < LEVELS - 2; level++) node = child(node, slot(vpn, level));
+
+        // 页目录层: 大页直接给出帧号
+        Node* pd = node;
+        UINT32 pd_slot = slot(vpn, LEVELS - 2);
+        UINT64& pde = pd->entry[pd_slot];
+        if (pde & HUGE_BIT)
+        {
+            if (is_write && (pde & COW_BIT)) copyOnWrite(pde, vpn, HUGE_ORDER);
+            writable = !(pde & COW_BIT);
+            return (pde >> FLAG_BITS) + (vpn & ((1ul << HUGE_ORDER) - 1));
+        }
+
+        Node* pt = child(pd, pd_slot);
+        UINT64& pte = pt->entry[slot(vpn, LEVELS - 1)];
+        if (pte)
+        {
+            if (is_write && (pte & COW_BIT)) copyOnWrite(pte, vpn, 0);
+            writable = !(pte & COW_BIT);
+            return pte >> FLAG_BITS;
+        }
+
+        pte = (allocFrame(vpn) << FLAG_BITS) | MAPPED_BIT;
+        pt->used++;
+        m_pages++;
+        writable = true;
+
+        // 提升失败过的区域只在又有 2 MB 空闲块时重试
+        if (m_thp && pt->used >= m_thp && (!pt->thp_failed || hugeBlockFree())) return promote(vpn, pd, pd_slot);
+        return pte >> FLAG_BITS;
+    }
+
+    // Give the writer of a shared page of order its own copy, or just the page back if no other
+    // address space maps it any more
+    void copyOnWrite(UINT64& entry, UINT64 vpn, UINT32 order)
+    {
+        UINT64 frame = entry >> FLAG_BITS;
+        unordered_map<UINT64, UINT32>::iterator it = m_shares.find(frame);
+        entry &= ~COW_BIT;
+        if (it == m_shares.end()) return;
+
+        // 物理内存耗尽时两个地址空间继续共享原来的页框
+        UINT64 copy;
+        if (order == 0) copy = allocFrame(vpn);
+        else if (allocBlock(order, copy)) m_frames += 1ul << order;
+        else return;
+
+        entry = (copy << FLAG_BITS) | (entry & ((1ul << FLAG_BITS) - 1));
+        m_cow_copies++;
+        if (--it->second == 0) m_shares.erase(it);
+    }
+
+    // Map the 2 MB region of vpn with a huge page and free the frames of its base pages
+    UINT64 promote(UINT64 vpn, Node* pd, UINT32 pd_slot)
+    {
+        Node* pt = (Node*)pd->entry[pd_slot];
+        UINT64 pfn = pt->entry[slot(vpn, LEVELS - 1)] >> FLAG_BITS;
+
+        // 仍与其它地址空间共享的区域保持 4 KB 页
+        for (UINT32 i = 0; i < (1u << LEVEL_BITS); i++)
+            if (pt->entry[i] & COW_BIT) return pfn;
+
+        UINT64 block;
+        if (!allocBlock(HUGE_ORDER, block))
+        {
+            if (!pt->thp_failed) m_thp_failed++;
+            pt->thp_failed = true;
+            return pfn;
+        }
+
+        for (UINT32 i = 0; i < (1u << LEVEL_BITS); i++)
+        {
+            if (pt->entry[i] == 0) continue;
+            freeBlock(pt->entry[i] >> FLAG_BITS, 0);
+            m_frames--;
+        }
+        delete pt;
+        m_nodes--;
+
+        pd->entry[pd_slot] = (block << FLAG_BITS) | HUGE_BIT;
+        m_frames += 1ul << HUGE_ORDER;
+        m_huge++;
+        return block + (vpn & ((1ul << HUGE_ORDER) - 1));
+    }
+
+    UINT64 random()
+    {
+        m_seed ^= m_seed << 13;
+        m_seed ^= m_seed >> 7;
+        m_seed ^= m_seed << 17;
+        return m_seed;
+    }
+
+    UINT64 allocFrame(UINT64 vpn)
+    {
+        UINT64 frame = 0;
+        bool found = false;
+        if (m_mode == PALLOC_RANDOM) found = allocNear(random() % FRAME_NUM, frame);
+        else if (m_mode == PALLOC_COLOR) found = allocColored(vpn & ((1ul << m_color_bits) - 1), frame);
+        else found = allocBlock(0, frame);
+
+        // 物理内存耗尽时退回到无状态的散列映射
+        if (!found) return get_phy_page_no(vpn) >> PAGE_SIZE_LOG;
+        m_frames++;
+        return frame;
+    }
+
+    // Allocate a block of order from the lowest free block of the smallest order, as the buddy
+    // allocator does
+    bool allocBlock(UINT32 order, UINT64& block)
+    {
+        for (UINT32 o = order; o <= MAX_ORDER; o++)
+        {
+            if (m_free[o].empty()) continue;
+            block = split(*m_free[o].begin(), o, order, 0);
+            return true;
+        }
+        return false;
+    }
+
+    bool hugeBlockFree() const
+    {
+        for (UINT32 o = HUGE_ORDER; o <= MAX_ORDER; o++)
+            if (!m_free[o].empty()) return true;
+        return false;
+    }
+
+    // Allocate the free frame nearest at or after hint, wrapping around
+    bool allocNear(UINT64 hint, UINT64& frame)
+    {
+        if (m_frames >= FRAME_NUM) return false;
+
+        UINT64 best = 0, best_dist = ~0ul;
+        UINT32 best_order = 0;
+        for (UINT64 from = hint; best_dist == ~0ul; from = 0)
+        {
+            for (UINT32 o = 0; o <= MAX_ORDER; o++)
+            {
+                // The block holding from, or the first one after it
+                std::set<UINT64>::iterator it = m_free[o].lower_bound(from & ~((1ul << o) - 1));
+                if (it == m_free[o].end()) continue;
+
+                UINT64 dist = (*it <= from) ? 0 : *it - from;
+                if (dist < best_dist)
+                {
+                    best = *it;
+                    best_dist = dist;
+                    best_order = o;
+                }
+            }
+        }
+        frame = split(best, best_order, 0, hint);
+        return true;
+    }
+
+    // Allocate a frame of the color, from a block that holds one
+    bool allocColored(UINT64 color, UINT64& frame)
+    {
+        UINT64 colors = 1ul << m_color_bits;
+        for (UINT32 o = 0; o <= MAX_ORDER; o++)
+        {
+            if (m_free[o].empty()) continue;
+
+            // A block of 2^o frames aligned to 2^o holds the colors [start % colors, + 2^o)
+            UINT64 block = *m_free[o].begin();
+            if ((1ul << o) < colors)
+            {
+                UINT64 first = color & ~((1ul << o) - 1);
+                std::set<pair<UINT64, UINT64> >::iterator it = m_free_colored[o].lower_bound(std::make_pair(first, 0ul));
+                if (it == m_free_colored[o].end() || it->first != first) continue;
+                block = it->second;
+            }
+
+            UINT64 target = block + ((color - block) & (colors - 1));
+            frame = split(block, o, 0, target);
+            return true;
+        }
+
+        m_color_missed++;
+        return allocBlock(0, frame);
+    }
+
+    void insertFree(UINT32 order, UINT64 block)
+    {
+        m_free[order].insert(block);
+        m_free_colored[order].insert(std::make_pair(block & ((1ul << m_color_bits) - 1), block));
+    }
+
+    bool eraseFree(UINT32 order, UINT64 block)
+    {
+        if (m_free[order].erase(block) == 0) return false;
+        m_free_colored[order].erase(std::make_pair(block & ((1ul << m_color_bits) - 1), block));
+        return true;
+    }
+
+    // Take the free block of order o and split it down to order, keeping the half with target
+    UINT64 split(UINT64 block, UINT32 o, UINT32 order, UINT64 target)
+    {
+        eraseFree(o, block);
+        while (o > order)
+        {
+            o--;
+            UINT64 half = 1ul << o;
+            if (target >= block + half && target < block + 2 * half)
+            {
+                insertFree(o, block);
+                block += half;
+            }
+            else
+            {
+                insertFree(o, block + half);
+            }
+        }
+        return block;
+    }
+
+    // Return a block to the free lists, merging it with its free buddies
+    void freeBlock(UINT64 block, UINT32 order)
+    {
+        while (order < MAX_ORDER)
+        {
+            UINT64 buddy = block ^ (1ul << order);
+            if (!eraseFree(order, buddy)) break;
+            block &= ~(1ul << order);
+            order++;
+        }
+        insertFree(order, block);
+    }
+};
+
+// The global state of the address spaces. Static members of a class template may be defined
+// in a header included by several translation units, which C++11 does not allow for variables
+template<class T = void>
+struct AddressSpaceState
+{
+    static PageAllocator* allocator;
+    static UINT32 current;
+    static UINT32 count;
+};
+
+template<class T> PageAllocator* AddressSpaceState<T>::allocator = NULL;
+template<class T> UINT32 AddressSpaceState<T>::current = 0;
+template<class T> UINT32 AddressSpaceState<T>::count = 1;
+
+// When set, get_phy_addr maps pages with this allocator instead of get_phy_page_no
+static PageAllocator*& page_allocator = AddressSpaceState<>::allocator;
+
+// Build the allocator of mode buddy, random or color, NULL for an unknown mode
+inline PageAllocator* newPageAllocator(const string& mode, UINT32 color_bits, UINT32 thp_threshold)
+{
+    if (thp_threshold > 512) return NULL;
+    if (mode == "buddy")  return new PageAllocator(PALLOC_BUDDY, color_bits, thp_threshold);
+    if (mode == "random") return new PageAllocator(PALLOC_RANDOM, color_bits, thp_threshold);
+    if (mode == "color")  return new PageAllocator(PALLOC_COLOR, color_bits, thp_threshold);
+    return NULL;
+}
+
+// The address space the references come from, and the number of them created so far
+static UINT32& current_asid = AddressSpaceState<>::current;
+static UINT32& asid_num = AddressSpaceState<>::count;
+
+// Create a copy of the current address space, as fork does, and return its ASID
+inline UINT32 forkAddressSpace()
+{
+    if (page_allocator) page_allocator->fork();
+    return asid_num++;
+}
+
+// Make the later references come from address space asid. The caches are told by the caller
+inline void switchAddressSpace(UINT32 asid)
+{
+    current_asid = asid;
+    if (page_allocator) page_allocator->switchTo(asid);
+}
+
+// Transform a virtual address into a physical address
+inline UINT64 get_phy_addr(UINT64 virtual_addr)
+{
+    if (page_allocator) return page_allocator->translate(virtual_addr);
+    return (get_phy_page_no(get_vir_page_no(virtual_addr)) << PAGE_SIZE_LOG) + get_page_offset(virtual_addr);
+}
+
+// The address seen by the multi-level hierarchy: physical once a PageAllocator is set, virtual otherwise
+inline UINT64 get_hier_addr(UINT64 virtual_addr)
+{
+    return page_allocator ? page_allocator->translate(virtual_addr) : virtual_addr;
+}
+
+// The color bits of a physically indexed cache: the set index bits above the page offset
+inline UINT32 get_color_bits(UINT32 log_sets, UINT32 log_block_size)
+{
+    return log_sets + log_block_size > PAGE_SIZE_LOG ? log_sets + log_block_size - PAGE_SIZE_LOG : 0;
+}
+
+/**************************************
+ * Replacement Policies
+ *
+ * Each policy owns its per-set metadata and is plugged into the cache
+ * classes as a template parameter, so the replacement path is resolved
+ * at compile time. Every policy provides:
+ *   Policy(set_num, asso)
+ *   void   touch(set, way)     called on a hit
+ *   void   insert(set, way)    called after a block is filled on a miss
+ *   UINT32 victim(set)         pick the way to evict, all ways being valid
+ * Policies that own per-set arrays are not copyable.
+**************************************/
+
+// xorshift32, cheap enough to be called on every miss
+inline UINT32 nextRand(UINT32& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// True LRU: one timestamp per block, the oldest one is evicted
+class LRUPolicy
+{
+public:
+    static const char* name() { return "LRU"; }
+
+    LRUPolicy(UINT32 set_num, UINT32 asso) : m_asso(asso), m_clock(0)
+    {
+        m_stamps = new UINT64[set_num * asso]();
+    }
+
+    ~LRUPolicy() { delete[] m_stamps; }
+
+    // The metadata array is owned, so the policy is not copied
+    LRUPolicy(const LRUPolicy&) = delete;
+    LRUPolicy& operator=(const LRUPolicy&) = delete;
+
+    void touch(UINT32 set, UINT32 way) { m_stamps[set * m_asso + way] = ++m_clock; }
+    void insert(UINT32 set, UINT32 way) { touch(set, way); }
+    UINT64 getStamp(UINT32 set, UINT32 way) { return m_stamps[set * m_asso + way]; }
+
+    UINT32 victim(UINT32 set)
+    {
+        UINT64* stamps = m_stamps + set * m_asso;
+        UINT32 way = 0;
+        for (UINT32 i = 1; i < m_asso; i++)
+            way = (stamps[i] < stamps[way]) ? i : way;
+        return way;
+    }
+
+private:
+    UINT32 m_asso;
+    UINT64 m_clock;
+    UINT64* m_stamps;       // 每个块最近一次被访问的时间
+};
+
+// Tree pseudo-LRU: asso - 1 direction bits per set, each pointing away from the last access
+class TreePLRUPolicy
+{
+public:
+    static const char* name() { return "Tree-PLRU"; }
+
+    TreePLRUPolicy(UINT32 set_num, UINT32 asso) : m_asso(asso), m_leaves(1)
+    {
+        while (m_leaves < asso) m_leaves <<= 1;
+        m_bits = new UINT8[set_num * m_leaves]();
+    }
+
+    ~TreePLRUPolicy() { delete[] m_bits; }
+
+    // The metadata array is owned, so the policy is not copied
+    TreePLRUPolicy(const TreePLRUPolicy&) = delete;
+    TreePLRUPolicy& operator=(const TreePLRUPolicy&) = delete;
+
+    void touch(UINT32 set, UINT32 way)
+    {
+        UINT8* bits = m_bits + set * m_leaves;
+        for (UINT32 node = way + m_leaves; node > 1; node >>= 1)
+            bits[node >> 1] = (node & 1) ^ 1;
+    }
+
+    void insert(UINT32 set, UINT32 way) { touch(set, way); }
+
+    UINT32 victim(UINT32 set)
+    {
+        UINT8* bits = m_bits + set * m_leaves;
+        UINT32 node = 1, way = 0;
+        for (UINT32 span = m_leaves >> 1; span > 0; span >>= 1)
+        {
+            // Never descend into the padding leaves when asso is not a power of two
+            UINT32 right = bits[node] & (way + span < m_asso);
+            node = 2 * node + right;
+            way += right * span;
+        }
+        return way;
+    }
+
+private:
+    UINT32 m_asso;
+    UINT32 m_leaves;        // asso 向上取整到 2 的幂
+    UINT8* m_bits;          // 每组一棵二叉树, 结点 1..m_leaves-1 按堆序存放
+};
+
+// Not-recently-used: one reference bit per block, cleared in bulk when all are set
+class NRUPolicy
+{
+public:
+    static const char* name() { return "NRU"; }
+
+    NRUPolicy(UINT32 set_num, UINT32 asso) : m_asso(asso)
+    {
+        m_refs = new UINT8[set_num * asso]();
+    }
+
+    ~NRUPolicy() { delete[] m_refs; }
+
+    // The metadata array is owned, so the policy is not copied
+    NRUPolicy(const NRUPolicy&) = delete;
+    NRUPolicy& operator=(const NRUPolicy&) = delete;
+
+    void touch(UINT32 set, UINT32 way) { m_refs[set * m_asso + way] = 1; }
+    void insert(UINT32 set, UINT32 way) { touch(set, way); }
+
+    UINT32 victim(UINT32 set)
+    {
+        UINT8* refs = m_refs + set * m_asso;
+        for (UINT32 i = 0; i < m_asso; i++)
+            if (!refs[i]) return i;
+
+        memset(refs, 0, m_asso);
+        return 0;
+    }
+
+private:
+    UINT32 m_asso;
+    UINT8* m_refs;
+};
+
+// Re-reference interval prediction with 2-bit RRPVs (Jaleel et al., ISCA 2010)
+class RRIPPolicy
+{
+public:
+    RRIPPolicy(UINT32 set_num, UINT32 asso) : m_asso(asso), m_rand(2463534242u)
+    {
+        m_rrpv = new UINT8[set_num * asso];
+        memset(m_rrpv, RRPV_MAX, set_num * asso);
+    }
+
+    ~RRIPPolicy() { delete[] m_rrpv; }
+
+    // The metadata array is owned, so the policy is not copied
+    RRIPPolicy(const RRIPPolicy&) = delete;
+    RRIPPolicy& operator=(const RRIPPolicy&) = delete;
+
+    void touch(UINT32 set, UINT32 way) { m_rrpv[set * m_asso + way] = 0; }
+
+    // Evict the first block with a distant RRPV, ageing the whole set until one exists
+    UINT32 victim(UINT32 set)
+    {
+        UINT8* rrpv = m_rrpv + set * m_asso;
+        UINT32 way = 0;
+        for (UINT32 i = 1; i < m_asso; i++)
+            way = (rrpv[i] > rrpv[way]) ? i : way;
+
+        UINT8 age = RRPV_MAX - rrpv[way];
+        for (UINT32 i = 0; i < m_asso; i++)
+            rrpv[i] += age;
+
+        return way;
+    }
+
+protected:
+    static const UINT8 RRPV_MAX = 3;
+
+    UINT32 m_asso;
+    UINT32 m_rand;
+    UINT8* m_rrpv;
+
+    void insertStatic(UINT32 set, UINT32 way) { m_rrpv[set * m_asso + way] = RRPV_MAX - 1; }
+
+    // Bimodal insertion: distant RRPV, except a long one for 1 out of 32 fills
+    void insertBimodal(UINT32 set, UINT32 way)
+    {
+        m_rrpv[set * m_asso + way] = RRPV_MAX - ((nextRand(m_rand) & 31) == 0);
+    }
+};
+
+class SRRIPPolicy : public RRIPPolicy
+{
+public:
+    static const char* name() { return "SRRIP"; }
+
+    SRRIPPolicy(UINT32 set_num, UINT32 asso) : RRIPPolicy(set_num, asso) {}
+
+    void insert(UINT32 set, UINT32 way) { insertStatic(set, way); }
+};
+
+class BRRIPPolicy : public RRIPPolicy
+{
+public:
+    static const char* name() { return "BRRIP"; }
+
+    BRRIPPolicy(UINT32 set_num, UINT32 asso) : RRIPPolicy(set_num, asso) {}
+
+    void insert(UINT32 set, UINT32 way) { insertBimodal(set, way); }
+};
+
+// Dynamic RRIP: SRRIP and BRRIP leader sets duel through a saturating PSEL counter,
+// the follower sets use whichever of the two currently misses less
+class DRRIPPolicy : public RRIPPolicy
+{
+public:
+    static const char* name() { return "DRRIP"; }
+
+    // Up to 32 leader sets per policy. Below 64 sets every group of 4 sets has one leader of
+    // each kind and two followers; with fewer than 4 sets there would be no followers to steer,
+    // so dueling is off and the policy is plain SRRIP
+    DRRIPPolicy(UINT32 set_num, UINT32 asso)
+        : RRIPPolicy(set_num, asso), m_psel(PSEL_MAX / 2)
+    {
+        m_stride = (set_num >= 64) ? set_num / 32 : (set_num >= 4) ? 4 : 0;
+    }
+
+    // Only called on misses, so this is also where the leader sets vote
+    void insert(UINT32 set, UINT32 way)
+    {
+        if (m_stride == 0)
+        {
+            insertStatic(set, way);
+            return;
+        }
+
+        UINT32 slot = set % m_stride;
+        bool srrip_leader = (slot == 0);
+        bool brrip_leader = (slot == 1);
+
+        m_psel += srrip_leader & (m_psel < PSEL_MAX);
+        m_psel -= brrip_leader & (m_psel > 0);
+
+        if (brrip_leader || (!srrip_leader && m_psel > PSEL_MAX / 2))
+            insertBimodal(set, way);
+        else
+            insertStatic(set, way);
+    }
+
+private:
+    static const UINT32 PSEL_MAX = (1 << 10) - 1;
+
+    UINT32 m_stride;        // 每 m_stride 组中各有一个 SRRIP 和 BRRIP 的 leader set, 0 表示不竞争
+    UINT32 m_psel;
+};
+
+// Random replacement, no per-set metadata at all
+class RandomPolicy
+{
+public:
+    static const char* name() { return "Random"; }
+
+    RandomPolicy(UINT32 set_num, UINT32 asso) : m_asso(asso), m_rand(2463534242u) {}
+
+    void touch(UINT32 set, UINT32 way) {}
+    void insert(UINT32 set, UINT32 way) {}
+    UINT32 victim(UINT32 set) { return nextRand(m_rand) % m_asso; }
+
+private:
+    UINT32 m_asso;
+    UINT32 m_rand;
+};
+
+// FIFO: a round-robin fill pointer per set, hits do not change anything
+class FIFOPolicy
+{
+public:
+    static const char* name() { return "FIFO"; }
+
+    FIFOPolicy(UINT32 set_num, UINT32 asso) : m_asso(asso)
+    {
+        m_next = new UINT32[set_num]();
+    }
+
+    ~FIFOPolicy() { delete[] m_next; }
+
+    // The metadata array is owned, so the policy is not copied
+    FIFOPolicy(const FIFOPolicy&) = delete;
+    FIFOPolicy& operator=(const FIFOPolicy&) = delete;
+
+    void touch(UINT32 set, UINT32 way) {}
+    void insert(UINT32 set, UINT32 way) { m_next[set] = (way + 1 == m_asso) ? 0 : way + 1; }
+    UINT32 victim(UINT32 set) { return m_next[set]; }
+
+private:
+    UINT32 m_asso;
+    UINT32* m_next;
+};
+
+/**************************************
+ * 3C Miss Classification
+ *
+ * A miss is compulsory on the first touch of its line, a capacity miss
+ * if a fully associative LRU cache with as many blocks also misses, and
+ * a conflict miss otherwise.
+**************************************/
+class MissClassifier
+{
+public:
+    MissClassifier(UINT32 block_num)
+        : m_capacity(block_num), m_size(0), m_head(NIL), m_compulsory(0), m_capacity_misses(0), m_conflict(0)
+    {
+        m_lines = new UINT64[block_num];
+        m_prev = new UINT32[block_num];
+        m_next = new UINT32[block_num];
+        m_where.reserve(2 * block_num);
+    }
+
+    ~MissClassifier()
+    {
+        delete[] m_lines;
+        delete[] m_prev;
+        delete[] m_next;
+    }
+
+    // Update the shadows with line and classify the access if the real cache missed
+    void access(UINT64 line, bool hit)
+    {
+        bool first = markSeen(line);
+        bool shadow_hit = touchShadow(line);
+        if (hit) return;
+
+        if (first) m_compulsory++;
+        else if (!shadow_hit) m_capacity_misses++;
+        else m_conflict++;
+    }
+
+    UINT64 getConflictMisses() { return m_conflict; }
+
+    void dumpResults()
+    {
+        UINT64 misses = m_compulsory + m_capacity_misses + m_conflict;
+        double scale = misses ? 100.0 / misses : 0;
+        printf("\tcompulsory: %lu (%.2f%%),\tcapacity: %lu (%.2f%%),\tconflict: %lu (%.2f%%)\n",
+               m_compulsory, m_compulsory * scale, m_capacity_misses, m_capacity_misses * scale,
+               m_conflict, m_conflict * scale);
+    }
+
+private:
+    static const UINT32 NIL = ~0u;
+    static const UINT32 CHUNK_LOG = 12;     // 每个位图覆盖 4096 行
+
+    // 见过的行: 按 4096 行一组的位图, 只为访问过的组分配
+    unordered_map<UINT64, vector<UINT64> > m_seen;
+
+    // 全相联 LRU 影子: 哈希表定位结点, 数组实现的双向循环链表维护 LRU 顺序, m_head 为 MRU
+    UINT32 m_capacity;
+    UINT32 m_size;
+    UINT32 m_head;
+    UINT64* m_lines;
+    UINT32* m_prev;
+    UINT32* m_next;
+    unordered_map<UINT64, UINT32> m_where;
+
+    UINT64 m_compulsory;
+    UINT64 m_capacity_misses;
+    UINT64 m_conflict;
+
+    // Return true if line had never been seen
+    bool markSeen(UINT64 line)
+    {
+        vector<UINT64>& bits = m_seen[line >> CHUNK_LOG];
+        if (bits.empty()) bits.resize((1u << CHUNK_LOG) / 64, 0);
+
+        UINT32 bit = line & ((1u << CHUNK_LOG) - 1);
+        UINT64 mask = 1ul << (bit & 63);
+        bool first = !(bits[bit >> 6] & mask);
+        bits[bit >> 6] |= mask;
+        return first;
+    }
+
+    void unlink(UINT32 node)
+    {
+        m_next[m_prev[node]] = m_next[node];
+        m_prev[m_next[node]] = m_prev[node];
+        if (m_head == node) m_head = (m_next[node] == node) ? NIL : m_next[node];
+    }
+
+    void pushFront(UINT32 node)
+    {
+        if (m_head == NIL)
+        {
+            m_prev[node] = m_next[node] = node;
+        }
+        else
+        {
+            m_next[node] = m_head;
+            m_prev[node] = m_prev[m_head];
+            m_next[m_prev[m_head]] = node;
+            m_prev[m_head] = node;
+        }
+        m_head = node;
+    }
+
+    // Access line in the LRU shadow in O(1), return true if hit
+    bool touchShadow(UINT64 line)
+    {
+        unordered_map<UINT64, UINT32>::iterator it = m_where.find(line);
+        if (it != m_where.end())
+        {
+            if (it->second != m_head)
+            {
+                unlink(it->second);
+                pushFront(it->second);
+            }
+            return true;
+        }
+
+        UINT32 node;
+        if (m_size < m_capacity)
+        {
+            node = m_size++;
+        }
+        else
+        {
+            node = m_prev[m_head];      // LRU 结点
+            m_where.erase(m_lines[node]);
+            unlink(node);
+        }
+        m_lines[node] = line;
+        m_where[line] = node;
+        pushFront(node);
+        return false;
+    }
+};
+
+/**************************************
+ * Cache Model Base Class
+**************************************/
+class CacheModel
+{
+public:
+    // Constructor
+    CacheModel(UINT32 block_num, UINT32 log_block_size)
+        : m_block_num(block_num), m_blksz_log(log_block_size),
+          m_rd_reqs(0), m_wr_reqs(0), m_rd_hits(0), m_wr_hits(0), m_rd_bytes(0), m_wr_bytes(0), m_3c(NULL), m_warming(false)
+    {
+        m_valids = new bool[m_block_num];
+        m_dirty = new bool[m_block_num];
+        m_tags = new UINT64[m_block_num];
+
+        for (UINT32 i = 0; i < m_block_num; i++)
+        {
+            m_valids[i] = false;
+            m_dirty[i] = false;
+        }
+    }
+
+    // Destructor
+    virtual ~CacheModel()
+    {
+        delete[] m_valids;
+        delete[] m_dirty;
+        delete[] m_tags;
+        delete m_3c;
+    }
+
+    // Classify the misses of later accesses as compulsory, capacity or conflict.
+    // Return false if the model does not support it
+    virtual bool enableMissClassification() { return false; }
+
+    // The references now come from address space current_asid, or the process was switched out
+    // and back in. Only virtually tagged models care
+    virtual void switchContext() {}
+
+    // Update the cache state whenever size bytes are read, all within one block. Return true if hit
+    bool readReq(UINT64 mem_addr, UINT32 size)
+    {
+        m_rd_reqs++;
+        m_rd_bytes += size;
+        bool hit = access(mem_addr);
+        if (hit) m_rd_hits++;
+        return hit;
+    }
+
+    // Update the cache state whenever size bytes are written, all within one block. Return true if hit
+    bool writeReq(UINT64 mem_addr, UINT32 size)
+    {
+        m_wr_reqs++;
+        m_wr_bytes += size;
+        bool hit = access(mem_addr);
+        if (hit) m_wr_hits++;
+        return hit;
+    }
+
+    // Update the cache state only, for functional warming: neither the request nor the
+    // classification of its miss or any synonym it meets is counted
+    void warmReq(UINT64 mem_addr)
+    {
+        m_warming = true;
+        access(mem_addr);
+        m_warming = false;
+    }
+
+    UINT32 getRdReq() { return m_rd_reqs; }
+    UINT32 getWrReq() { return m_wr_reqs; }
+    UINT64 getReqs() { return m_rd_reqs + m_wr_reqs; }
+    UINT64 getHits() { return m_rd_hits + m_wr_hits; }
+    UINT32 getBlockSizeLog() { return m_blksz_log; }
+    UINT32 getBlockNum() { return m_block_num; }
+
+    /* 以下接口供多级 Cache 层次结构 (CacheLevel) 使用, 不更新本类的读写统计 */
+
+    // Look up mem_addr and update the replacement state if hit, marking the block dirty on request
+    virtual bool probe(UINT64 mem_addr, bool mark_dirty) = 0;
+
+    // Allocate a block for mem_addr, which must not be present.
+    // Return true if a valid block was evicted, together with its address and dirty bit
+    virtual bool fill(UINT64 mem_addr, bool dirty, UINT64& victim_addr, bool& victim_dirty) = 0;
+
+    // Invalidate the block holding mem_addr. Return true if it was present
+    virtual bool invalidate(UINT64 mem_addr, bool& was_dirty) = 0;
+
+    // Return true if mem_addr is present, without touching the replacement state
+    bool contains(UINT64 mem_addr)
+    {
+        UINT32 blk_id;
+        return lookup(mem_addr, blk_id);
+    }
+
+    MissClassifier* getMissClassifier() { return m_3c; }
+
+    // Export the read/write counters as prefix.read_reqs, prefix.read_hits, ...
+    void registerStats(StatsRegistry& stats, const string& prefix)
+    {
+        stats.watch(prefix + ".read_reqs", &m_rd_reqs);
+        stats.watch(prefix + ".read_hits", &m_rd_hits);
+        stats.watch(prefix + ".write_reqs", &m_wr_reqs);
+        stats.watch(prefix + ".write_hits", &m_wr_hits);
+    }
+
+    virtual void dumpResults()
+    {
+        float rdHitRate = 100 * (float)m_rd_hits/m_rd_reqs;
+        float wrHitRate = 100 * (float)m_wr_hits/m_wr_reqs;
+        printf("\tread req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_rd_reqs, m_rd_hits, rdHitRate);
+        printf("\twrite req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_wr_reqs, m_wr_hits, wrHitRate);
+        printf("\tbytes read: %lu,\tbytes written: %lu\n", m_rd_bytes, m_wr_bytes);
+        if (m_3c) m_3c->dumpResults();
+    }
+
+protected:
+    UINT32 m_block_num;     // The number of cache blocks
+    UINT32 m_blksz_log;     // 块大小的对数
+
+    bool* m_valids;
+    bool* m_dirty;          // 脏位, 仅在层次结构中使用
+    UINT64* m_tags;
+
+    UINT64 m_rd_reqs;       // The number of read-requests
+    UINT64 m_wr_reqs;       // The number of write-requests
+    UINT64 m_rd_hits;       // The number of hit read-requests
+    UINT64 m_wr_hits;       // The number of hit write-requests
+    UINT64 m_rd_bytes;      // The number of bytes read
+    UINT64 m_wr_bytes;      // The number of bytes written
+
+    MissClassifier* m_3c;   // NULL unless the misses are classified
+    bool m_warming;         // 功能预热中, 只更新状态不计数
+
+    // Update the 3C shadows with line, and classify the access unless it is warming
+    void classify(UINT64 line, bool hit)
+    {
+        if (m_3c) m_3c->access(line, hit || m_warming);
+    }
+
+    // Return the first invalid block among [first, first + count), or count if they are all valid
+    UINT32 findInvalid(UINT32 first, UINT32 count)
+    {
+        for (UINT32 i = 0; i < count; i++)
+            if (!m_valids[first + i]) return i;
+        return count;
+    }
+
+    // Look up the cache to decide whether the access is hit or missed
+    virtual bool lookup(UINT64 mem_addr, UINT32& blk_id) = 0;
+
+    // Access the cache: update the replacement state if hit, otherwise replace a block
+    virtual bool access(UINT64 mem_addr) = 0;
+};
+
+/**************************************
+ * Fully Associative Cache Class
+**************************************/
+template<class ReplPolicy>
+class FullAssoCache : public CacheModel
+{
+public:
+    // Constructor
+    FullAssoCache(UINT32 block_num, UINT32 log_block_size)
+        : CacheModel(block_num, log_block_size), m_repl(1, block_num), m_victim_tag(0), m_victim_dirty(false) {}
+
+    // Destructor
+    ~FullAssoCache() {}
+
+private:
+    ReplPolicy m_repl;      // 全相联 Cache 视为只有一组
+
+    UINT64 getTag(UINT64 addr) { /* TODO */ return addr >> m_blksz_log; }
+
+    // Look up the cache to decide whether the access is hit or missed
+    bool lookup(UINT64 mem_addr, UINT32& blk_id)
+    {
+        UINT64 tag = getTag(mem_addr);
+
+        // TODO
+        for (UINT32 i = 0; i < m_block_num; i++)
+        {
+            if ((m_tags[i] == tag) && (m_valids[i] == true))
+            {
+                blk_id = i;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Access the cache: update the replacement state if hit, otherwise replace a block
+    bool access(UINT64 mem_addr)
+    {
+        UINT32 blk_id;
+        if (lookup(mem_addr, blk_id))
+        {
+            m_repl.touch(0, blk_id);
+            return true;
+        }
+
+        bool evicted;
+        replace(getTag(mem_addr), false, evicted);
+
+        return false;
+    }
+
+    bool probe(UINT64 mem_addr, bool mark_dirty)
+    {
+        UINT32 blk_id;
+        if (!lookup(mem_addr, blk_id)) return false;
+
+        m_repl.touch(0, blk_id);
+        m_dirty[blk_id] |= mark_dirty;
+        return true;
+    }
+
+    bool fill(UINT64 mem_addr, bool dirty, UINT64& victim_addr, bool& victim_dirty)
+    {
+        bool evicted;
+        replace(getTag(mem_addr), dirty, evicted);
+
+        if (evicted)
+        {
+            victim_addr = m_victim_tag << m_blksz_log;
+            victim_dirty = m_victim_dirty;
+        }
+        return evicted;
+    }
+
+    bool invalidate(UINT64 mem_addr, bool& was_dirty)
+    {
+        UINT32 blk_id;
+        if (!lookup(mem_addr, blk_id)) return false;
+
+        was_dirty = m_dirty[blk_id];
+        m_valids[blk_id] = false;
+        return true;
+    }
+
+    // Put tag into an invalid block if there is one, otherwise into the victim chosen by the
+    // replacement policy, whose tag and dirty bit are kept for fill(). Return the block id
+    UINT32 replace(UINT64 tag, bool dirty, bool& evicted)
+    {
+        UINT32 bid_2be_replaced = findInvalid(0, m_block_num);
+        evicted = (bid_2be_replaced == m_block_num);
+        if (evicted)
+        {
+            bid_2be_replaced = m_repl.victim(0);
+            m_victim_tag = m_tags[bid_2be_replaced];
+            m_victim_dirty = m_dirty[bid_2be_replaced];
+        }
+
+        // Replace the cache block
+        m_tags[bid_2be_replaced] = tag;
+        m_valids[bid_2be_replaced] = true;
+        m_dirty[bid_2be_replaced] = dirty;
+        m_repl.insert(0, bid_2be_replaced);
+
+        return bid_2be_replaced;
+    }
+
+    UINT64 m_victim_tag;    // 最近一次被替换出的块
+    bool m_victim_dirty;
+};
+
+/**************************************
+ * Set-Associative Cache Class
+**************************************/
+template<class ReplPolicy>
+class SetAssoCache : public CacheModel
+{
+public:
+    // Constructor
+    SetAssoCache(/* TODO */ UINT32 log_sets, UINT32 log_block_size, UINT32 asso)
+        : CacheModel((asso * (1 << log_sets)), log_block_size),
+          m_repl(1 << log_sets, asso), m_victim_tag(0), m_victim_dirty(false)
+    {
+        m_sets_log = log_sets;
+        m_asso = asso;
+    }
+
+    // Destructor
+    ~SetAssoCache() {}
+
+    bool enableMissClassification()
+    {
+        if (m_3c == NULL) m_3c = new MissClassifier(m_block_num);
+        return true;
+    }
+
+protected:
+
+    // the log of the number of rows & the m_asso
+    UINT32 m_sets_log;
+    UINT32 m_asso;
+
+    ReplPolicy m_repl;
+
+    // 获得当前主存地址的区内块号
+    virtual UINT32 getIndex(UINT64 addr) {
+        return (addr >> m_blksz_log) & ((1 << m_sets_log) - 1);
+    }
+
+    // 获得当前主存地址的区号
+    virtual UINT64 getTag(UINT64 addr) {
+        return (addr >> (m_blksz_log + m_sets_log));
+    }
+
+    // The line number of the block with this index and tag
+    virtual UINT64 lineOf(UINT32 index, UINT64 tag) {
+        return (tag << m_sets_log) | index;
+    }
+
+    // Look up the cache to decide whether the access is hit or missed
+    bool lookup(UINT64 mem_addr, UINT32& blk_id)
+    {
+        // TODO
+        UINT32 index = getIndex(mem_addr);
+        UINT64 tag = getTag(mem_addr);
+
+        for (UINT32 i = (index * m_asso); i < (index * m_asso + m_asso); i++)
+        {
+            if ((m_tags[i] == tag) && (m_valids[i] == true))
+            {
+                blk_id = i;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Access the cache: update the replacement state if hit, otherwise replace a block
+    bool access(UINT64 mem_addr)
+    {
+        // TODO
+        UINT32 blk_id;
+        UINT32 index = getIndex(mem_addr);
+        bool hit = lookup(mem_addr, blk_id);
+
+        // 以本 Cache 所见的行号作为影子的键, 物理索引的变体因此按物理行分类
+        classify(lineOf(index, getTag(mem_addr)), hit);
+
+        if (hit)
+        {
+            m_repl.touch(index, blk_id - index * m_asso);
+            return true;
+        }
+
+        bool evicted;
+        replace(index, getTag(mem_addr), false, evicted);
+
+        return false;
+    }
+
+    // Victim addresses are rebuilt from the index and the tag by lineOf, so the hierarchy
+    // interface is only meaningful when the index and the tag come from the same address
+    bool probe(UINT64 mem_addr, bool mark_dirty)
+    {
+        UINT32 blk_id;
+        if (!lookup(mem_addr, blk_id)) return false;
+
+        m_repl.touch(blk_id / m_asso, blk_id % m_asso);
+        m_dirty[blk_id] |= mark_dirty;
+        return true;
+    }
+
+    bool fill(UINT64 mem_addr, bool dirty, UINT64& victim_addr, bool& victim_dirty)
+    {
+        bool evicted;
+        UINT32 index = getIndex(mem_addr);
+        replace(index, getTag(mem_addr), dirty, evicted);
+
+        if (evicted)
+        {
+            victim_addr = lineOf(index, m_victim_tag) << m_blksz_log;
+            victim_dirty = m_victim_dirty;
+        }
+        return evicted;
+    }
+
+    bool invalidate(UINT64 mem_addr, bool& was_dirty)
+    {
+        UINT32 blk_id;
+        if (!lookup(mem_addr, blk_id)) return false;
+
+        was_dirty = m_dirty[blk_id];
+        m_valids[blk_id] = false;
+        return true;
+    }
+
+    // Put tag into an invalid way of the set if there is one, otherwise into the victim chosen by
+    // the replacement policy, whose tag and dirty bit are kept for fill(). Return the block id
+    UINT32 replace(UINT32 index, UINT64 tag, bool dirty, bool& evicted)
+    {
+        UINT32 way = findInvalid(index * m_asso, m_asso);
+        evicted = (way == m_asso);
+        if (evicted)
+            way = m_repl.victim(index);
+
+        // Replace the cache block
+        UINT32 bid_2be_replaced = index * m_asso + way;
+        if (evicted)
+        {
+            m_victim_tag = m_tags[bid_2be_replaced];
+            m_victim_dirty = m_dirty[bid_2be_replaced];
+        }
+        m_tags[bid_2be_replaced] = tag;
+        m_valids[bid_2be_replaced] = true;
+        m_dirty[bid_2be_replaced] = dirty;
+        m_repl.insert(index, way);
+
+        return bid_2be_replaced;
+    }
+
+    UINT64 m_victim_tag;    // 最近一次被替换出的块
+    bool m_victim_dirty;
+};
+
+/**************************************
+ * Virtually Indexed Caches
+ *
+ * A line indexed by its virtual address has two problems a physically
+ * addressed one has not:
+ *   homonyms  the same virtual address of two address spaces names two
+ *             lines. Virtual tags must either be flushed on every context
+ *             switch (flush) or extended with the ASID (asid)
+ *   synonyms  two virtual addresses of the same physical line, as after a
+ *             fork or a shared mapping, may sit in two places at once: in
+ *             any set of a VIVT cache, and with VIPT in the sets that differ
+ *             only in the index bits above the page offset (alias sets)
+ * On a miss whose physical line is already resident elsewhere, the
+ * synonym policy decides what happens, at the cost it counts:
+ *   none        a second copy is filled, and a write to either goes stale
+ *   invalidate  the other copies are invalidated before the fill
+ *   rmap        a reverse map from physical lines finds the copy, which is
+ *               moved to the new place without a fetch from the next level
+ *   ptag        every miss probes the alias sets by physical tag, and a
+ *               copy found there serves the access
+ * The reverse map of resident physical lines is kept for all policies, so
+ * that the synonyms are counted even when nothing is done about them.
+**************************************/
+enum ContextMode { CTX_FLUSH, CTX_ASID };
+enum SynonymPolicy { SYN_NONE, SYN_INVALIDATE, SYN_RMAP, SYN_PTAG };
+
+// Parse the context switch mode flush or asid. Return false if it is unknown
+inline bool parseContextMode(const string& name, ContextMode& mode)
+{
+    if (name == "flush") mode = CTX_FLUSH;
+    else if (name == "asid") mode = CTX_ASID;
+    else return false;
+    return true;
+}
+
+// Parse the synonym policy none, invalidate, rmap or ptag. Return false if it is unknown
+inline bool parseSynonymPolicy(const string& name, SynonymPolicy& policy)
+{
+    if (name == "none") policy = SYN_NONE;
+    else if (name == "invalidate") policy = SYN_INVALIDATE;
+    else if (name == "rmap") policy = SYN_RMAP;
+    else if (name == "ptag") policy = SYN_PTAG;
+    else return false;
+    return true;
+}
+
+template<class ReplPolicy>
+class VirtIndexedCache : public SetAssoCache<ReplPolicy>
+{
+public:
+    VirtIndexedCache(UINT32 log_sets, UINT32 log_block_size, UINT32 asso, bool virtual_tags,
+                     ContextMode ctx, SynonymPolicy syn)
+        : SetAssoCache<ReplPolicy>(log_sets, log_block_size, asso),
+          m_virtual_tags(virtual_tags), m_ctx(ctx), m_syn(syn),
+          m_alias_sets(virtual_tags ? 1u << log_sets : 1u << get_color_bits(log_sets, log_block_size)),
+          m_switches(0), m_flushed(0), m_synonyms(0), m_alias_invals(0), m_alias_moves(0),
+          m_rmap_lookups(0), m_alias_hits(0), m_extra_probes(0)
+    {
+        m_asids = new UINT32[this->m_block_num]();
+        m_plines = new UINT64[this->m_block_num]();
+    }
+
+    ~VirtIndexedCache()
+    {
+        delete[] m_asids;
+        delete[] m_plines;
+    }
+
+    void switchContext()
+    {
+        m_switches++;
+
+        // 物理标签不受地址空间切换影响, 带 ASID 的虚拟标签也不会混淆
+        if (!m_virtual_tags || m_ctx == CTX_ASID) return;
+
+        for (UINT32 i = 0; i < this->m_block_num; i++)
+        {
+            if (!this->m_valids[i]) continue;
+            this->m_valids[i] = false;
+            m_flushed++;
+        }
+        m_rmap.clear();
+    }
+
+    void dumpResults()
+    {
+        static const char* ctx_names[] = { "flush", "asid" };
+        static const char* syn_names[] = { "none", "invalidate", "rmap", "ptag" };
+
+        SetAssoCache<ReplPolicy>::dumpResults();
+        if (m_virtual_tags)
+            printf("\tcontext switches: %lu (%s),\tlines flushed: %lu\n", m_switches, ctx_names[m_ctx], m_flushed);
+        printf("\tsynonym misses: %lu (%s, %u alias sets)", m_synonyms, syn_names[m_syn], m_alias_sets);
+        if (m_syn == SYN_INVALIDATE) printf(",\taliases invalidated: %lu", m_alias_invals);
+        if (m_syn == SYN_RMAP) printf(",\taliases moved instead of fetched: %lu,\treverse map lookups: %lu", m_alias_moves, m_rmap_lookups);
+        if (m_syn == SYN_PTAG) printf(",\thits in an alias set: %lu,\textra tag probes: %lu", m_alias_hits, m_extra_probes);
+        printf("\n");
+    }
+
+protected:
+    bool m_virtual_tags;    // VIVT, 否则标签来自物理地址 (VIPT)
+    ContextMode m_ctx;
+    SynonymPolicy m_syn;
+    UINT32 m_alias_sets;    // 同一物理行可能落入的组数, VIVT 为全部组
+
+    UINT32* m_asids;        // 每块所属的地址空间
+    UINT64* m_plines;       // 每块的物理行号
+    std::unordered_multimap<UINT64, UINT32> m_rmap;     // 物理行 -> 驻留的块
+
+    UINT64 m_switches;
+    UINT64 m_flushed;       // Lines invalidated by context switches
+    UINT64 m_synonyms;      // Misses on a line resident under another virtual address
+    UINT64 m_alias_invals;
+    UINT64 m_alias_moves;
+    UINT64 m_rmap_lookups;  // Misses that consulted the reverse map
+    UINT64 m_alias_hits;
+    UINT64 m_extra_probes;  // Tag probes of the other alias sets
+
+    // Look up the cache; virtual tags of another address space do not match in asid mode
+    bool lookup(UINT64 mem_addr, UINT32& blk_id)
+    {
+        UINT32 index = this->getIndex(mem_addr);
+        UINT64 tag = this->getTag(mem_addr);
+        bool check_asid = m_virtual_tags && m_ctx == CTX_ASID;
+
+        for (UINT32 i = index * this->m_asso; i < (index + 1) * this->m_asso; i++)
+        {
+            if (this->m_valids[i] && this->m_tags[i] == tag && (!check_asid || m_asids[i] == current_asid))
+            {
+                blk_id = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool access(UINT64 mem_addr)
+    {
+        UINT32 blk_id;
+        UINT32 index = this->getIndex(mem_addr);
+        UINT64 tag = this->getTag(mem_addr);
+        UINT64 pline = get_phy_addr(mem_addr) >> this->m_blksz_log;
+
+        bool hit = lookup(mem_addr, blk_id);
+        bool moved = false, moved_dirty = false;
+        if (!hit)
+        {
+            if (m_syn == SYN_PTAG && !this->m_warming) m_extra_probes += m_alias_sets - 1;
+            if (m_syn == SYN_RMAP && !this->m_warming) m_rmap_lookups++;
+            if (m_rmap.count(pline)) hit = resolveSynonym(pline, blk_id, moved, moved_dirty);
+        }
+
+        // 被搬移的行不需要从下一级取回, 与命中同样计入
+        this->classify(this->lineOf(index, tag), hit || moved);
+
+        if (hit)
+        {
+            this->m_repl.touch(blk_id / this->m_asso, blk_id % this->m_asso);
+            return true;
+        }
+
+        bool evicted;
+        blk_id = this->replace(index, tag, moved_dirty, evicted);
+        if (evicted) unmap(m_plines[blk_id], blk_id);
+        m_plines[blk_id] = pline;
+        m_asids[blk_id] = current_asid;
+        m_rmap.insert(std::make_pair(pline, blk_id));
+
+        return moved;
+    }
+
+    // A miss on pline, which is resident in other blocks. Return true if the policy serves the
+    // access from one of them in place, setting blk_id. Set moved if the copy is taken out to be
+    // refilled at the new place, together with its dirty bit. Nothing is counted while warming
+    bool resolveSynonym(UINT64 pline, UINT32& blk_id, bool& moved, bool& moved_dirty)
+    {
+        UINT64 count = this->m_warming ? 0 : 1;
+        m_synonyms += count;
+        if (m_syn == SYN_NONE) return false;
+
+        // 其余策略保证同一物理行至多驻留一份
+        std::unordered_multimap<UINT64, UINT32>::iterator it = m_rmap.find(pline);
+        if (m_syn == SYN_PTAG)
+        {
+            blk_id = it->second;
+            m_alias_hits += count;
+            return true;
+        }
+
+        this->m_valids[it->second] = false;
+        if (m_syn == SYN_INVALIDATE)
+        {
+            m_alias_invals += count;
+        }
+        else
+        {
+            moved = true;
+            moved_dirty = this->m_dirty[it->second];
+            m_alias_moves += count;
+        }
+        m_rmap.erase(it);
+        return false;
+    }
+
+    void unmap(UINT64 pline, UINT32 blk_id)
+    {
+        std::pair<std::unordered_multimap<UINT64, UINT32>::iterator,
+                  std::unordered_multimap<UINT64, UINT32>::iterator> range = m_rmap.equal_range(pline);
+        for (std::unordered_multimap<UINT64, UINT32>::iterator it = range.first; it != range.second; ++it)
+        {
+            if (it->second != blk_id) continue;
+            m_rmap.erase(it);
+            return;
+        }
+    }
+};
+
+/**************************************
+ * Set-Associative Cache Class (VIVT)
+**************************************/
+template<class ReplPolicy>
+class SetAssoCache_VIVT : public VirtIndexedCache<ReplPolicy>
+{
+public:
+    // Constructor
+    SetAssoCache_VIVT(/* TODO */ UINT32 log_sets, UINT32 log_block_size, UINT32 asso,
+                      ContextMode ctx = CTX_FLUSH, SynonymPolicy syn = SYN_NONE)
+        : VirtIndexedCache<ReplPolicy>(log_sets, log_block_size, asso, true, ctx, syn) {}
+
+    // Destructor
+    ~SetAssoCache_VIVT() {}
+
+private:
+
+    /* 直接继承 VirtIndexedCache 类的成员变量及方法, 无需重复实现 */
+};
+
+/**************************************
+ * Set-Associative Cache Class (PIPT)
+**************************************/
+template<class ReplPolicy>
+class SetAssoCache_PIPT : public SetAssoCache<ReplPolicy>
+{
+public:
+    // Constructor
+    SetAssoCache_PIPT(/* TODO */ UINT32 log_sets, UINT32 log_block_size, UINT32 asso)
+        : SetAssoCache<ReplPolicy>(log_sets, log_block_size, asso) {}
+
+    // Destructor
+    ~SetAssoCache_PIPT() {}
+
+private:
+
+    /* 除了 getIndex 和 getTag 方法需要修改为根据物理地址来获取 index 和 tag, 其它成员变量和方法则是直接继承自 SetAssoCache 类, 无需重复实现 */
+
+    // 获得当前主存地址的区内块号
+    UINT32 getIndex(UINT64 addr) {
+        UINT64 paddr = get_phy_addr(addr);
+        return (paddr >> this->m_blksz_log) & ((1 << this->m_sets_log) - 1);
+    }
+
+    // 获得当前主存地址的区号
+    UINT64 getTag(UINT64 addr) {
+        UINT64 paddr = get_phy_addr(addr);
+        return (paddr >> (this->m_blksz_log + this->m_sets_log));
+    }
+};
+
+/**************************************
+ * Set-Associative Cache Class (VIPT)
+**************************************/
+template<class ReplPolicy>
+class SetAssoCache_VIPT : public VirtIndexedCache<ReplPolicy>
+{
+public:
+    // Constructor
+    SetAssoCache_VIPT(/* TODO */ UINT32 log_sets, UINT32 log_block_size, UINT32 asso,
+                      ContextMode ctx = CTX_FLUSH, SynonymPolicy syn = SYN_NONE)
+        : VirtIndexedCache<ReplPolicy>(log_sets, log_block_size, asso, false, ctx, syn) {}
+
+    // Destructor
+    ~SetAssoCache_VIPT() {}
+
+private:
+
+    /* 除了 getTag 方法需要修改为根据物理地址来获取 tag, 其它成员变量和方法则是直接继承自 VirtIndexedCache 类, 无需重复实现 */
+
+    // 获得当前主存地址的区号
+    // The index bits above the page offset are virtual, so the tag then starts at the physical page number
+    UINT64 getTag(UINT64 addr) {
+        UINT64 paddr = get_phy_addr(addr);
+        return (paddr >> std::min(this->m_blksz_log + this->m_sets_log, (UINT32)PAGE_SIZE_LOG));
+    }
+};
+
+// Instantiate CacheT with the replacement policy selected by name, NULL if there is no such policy
+template<template<class> class CacheT, typename... Args>
+CacheModel* newCacheModel(const string& policy, Args... args)
+{
+    if (policy == "lru")    return new CacheT<LRUPolicy>(args...);
+    if (policy == "plru")   return new CacheT<TreePLRUPolicy>(args...);
+    if (policy == "nru")    return new CacheT<NRUPolicy>(args...);
+    if (policy == "srrip")  return new CacheT<SRRIPPolicy>(args...);
+    if (policy == "brrip")  return new CacheT<BRRIPPolicy>(args...);
+    if (policy == "drrip")  return new CacheT<DRRIPPolicy>(args...);
+    if (policy == "random") return new CacheT<RandomPolicy>(args...);
+    if (policy == "fifo")   return new CacheT<FIFOPolicy>(args...);
+    return NULL;
+}
+
+/**************************************
+ * Alternative Set Organizations
+ *
+ * Bit-sliced indexing maps power-of-two strides onto a few sets. These
+ * variants of SetAssoCache spread them out: a hashed set index, a
+ * skewed-associative cache with one hash per way, and a small fully
+ * associative victim cache behind any cache. The hashed organizations
+ * keep the whole line number as the tag.
+**************************************/
+enum IndexHash
+{
+    INDEX_XOR,              // XOR of every sets_log-bit slice of the line number
+    INDEX_PRIME             // Line number modulo the largest prime not above the set count
+};
+
+template<class ReplPolicy>
+class SetAssoCache_Hashed : public SetAssoCache<ReplPolicy>
+{
+public:
+    SetAssoCache_Hashed(UINT32 log_sets, UINT32 log_block_size, UINT32 asso, IndexHash hash)
+        : SetAssoCache<ReplPolicy>(log_sets, log_block_size, asso), m_hash(hash), m_prime(1)
+    {
+        // 素数取模会空出编号不小于 m_prime 的组
+        for (UINT32 n = 2; n <= (1u << log_sets); n++)
+        {
+            bool prime = true;
+            for (UINT32 d = 2; d * d <= n && prime; d++) prime = (n % d != 0);
+            if (prime) m_prime = n;
+        }
+    }
+
+    ~SetAssoCache_Hashed() {}
+
+private:
+    IndexHash m_hash;
+    UINT32 m_prime;
+
+    UINT32 getIndex(UINT64 addr) {
+        UINT64 line = addr >> this->m_blksz_log;
+        if (m_hash == INDEX_PRIME) return line % m_prime;
+
+        UINT32 index = 0;
+        if (this->m_sets_log == 0) return 0;
+        for (; line; line >>= this->m_sets_log)
+            index ^= line & ((1u << this->m_sets_log) - 1);
+        return index;
+    }
+
+    UINT64 getTag(UINT64 addr) {
+        return addr >> this->m_blksz_log;
+    }
+
+    UINT64 lineOf(UINT32 index, UINT64 tag) {
+        return tag;
+    }
+};
+
+// Skewed-associative cache (Seznec): way w of a line lives in set f_w(line), so lines
+// that conflict in one way are unlikely to conflict in the others. The candidates of a
+// line lie in different sets, where only LRU stamps can be compared, so the cache is
+// built with the LRU policy only
+class SkewedAssoCache : public SetAssoCache<LRUPolicy>
+{
+public:
+    SkewedAssoCache(UINT32 log_sets, UINT32 log_block_size, UINT32 asso)
+        : SetAssoCache<LRUPolicy>(log_sets, log_block_size, asso) {}
+
+    ~SkewedAssoCache() {}
+
+private:
+    // The set of line in way
+    UINT32 skewIndex(UINT64 line, UINT32 way)
+    {
+        if (m_sets_log == 0) return 0;
+        UINT64 h = (line ^ (line >> 31)) * (0x9e3779b97f4a7c15ul ^ ((UINT64)way << 1));
+        return h >> (64 - m_sets_log);
+    }
+
+    UINT32 getIndex(UINT64 addr) { return skewIndex(addr >> m_blksz_log, 0); }
+    UINT64 getTag(UINT64 addr) { return addr >> m_blksz_log; }
+    UINT64 lineOf(UINT32 index, UINT64 tag) { return tag; }
+
+    bool lookup(UINT64 mem_addr, UINT32& blk_id)
+    {
+        UINT64 line = mem_addr >> m_blksz_log;
+        for (UINT32 w = 0; w < m_asso; w++)
+        {
+            UINT32 id = skewIndex(line, w) * m_asso + w;
+            if (m_valids[id] && m_tags[id] == line)
+            {
+                blk_id = id;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool access(UINT64 mem_addr)
+    {
+        UINT32 blk_id;
+        bool hit = lookup(mem_addr, blk_id);
+        classify(mem_addr >> m_blksz_log, hit);
+
+        if (hit)
+        {
+            m_repl.touch(blk_id / m_asso, blk_id % m_asso);
+            return true;
+        }
+
+        bool evicted;
+        place(mem_addr >> m_blksz_log, false, evicted);
+        return false;
+    }
+
+    bool fill(UINT64 mem_addr, bool dirty, UINT64& victim_addr, bool& victim_dirty)
+    {
+        bool evicted;
+        place(mem_addr >> m_blksz_log, dirty, evicted);
+
+        if (evicted)
+        {
+            victim_addr = m_victim_tag << m_blksz_log;
+            victim_dirty = m_victim_dirty;
+        }
+        return evicted;
+    }
+
+    // Put line into an invalid candidate if there is one, otherwise into the least recently used one
+    void place(UINT64 line, bool dirty, bool& evicted)
+    {
+        UINT32 best = ~0u;
+        for (UINT32 w = 0; w < m_asso; w++)
+        {
+            UINT32 id = skewIndex(line, w) * m_asso + w;
+            if (!m_valids[id])
+            {
+                best = id;
+                break;
+            }
+            if (best == ~0u || m_repl.getStamp(id / m_asso, w) < m_repl.getStamp(best / m_asso, best % m_asso))
+                best = id;
+        }
+
+        evicted = m_valids[best];
+        if (evicted)
+        {
+            m_victim_tag = m_tags[best];
+            m_victim_dirty = m_dirty[best];
+        }
+        m_tags[best] = line;
+        m_valids[best] = true;
+        m_dirty[best] = dirty;
+        m_repl.insert(best / m_asso, best % m_asso);
+    }
+};
+
+// A fully associative LRU victim cache behind main: it holds the lines main evicts, and
+// a line found there swaps places with the line main evicts to take it back. The two
+// never hold the same line, and the pair looks like one cache from outside
+class VictimCache : public CacheModel
+{
+public:
+    VictimCache(CacheModel* main, UINT32 entries)
+        : CacheModel(main->getBlockNum() + entries, main->getBlockSizeLog()), m_main(main),
+          m_vc(new FullAssoCache<LRUPolicy>(entries, main->getBlockSizeLog())), m_entries(entries), m_vc_hits(0) {}
+
+    ~VictimCache()
+    {
+        delete m_main;
+        delete m_vc;
+    }
+
+    bool enableMissClassification()
+    {
+        if (m_3c == NULL) m_3c = new MissClassifier(m_block_num);
+        return true;
+    }
+
+    bool probe(UINT64 mem_addr, bool mark_dirty)
+    {
+        if (m_main->probe(mem_addr, mark_dirty)) return true;
+
+        bool dirty;
+        if (!m_vc->invalidate(mem_addr, dirty)) return false;
+        m_vc_hits++;
+
+        // 主 Cache 替换出的块放入受害者 Cache 刚空出的位置
+        UINT64 main_victim, vc_victim;
+        bool main_dirty, vc_dirty;
+        if (m_main->fill(mem_addr, dirty || mark_dirty, main_victim, main_dirty))
+            m_vc->fill(main_victim, main_dirty, vc_victim, vc_dirty);
+        return true;
+    }
+
+    bool fill(UINT64 mem_addr, bool dirty, UINT64& victim_addr, bool& victim_dirty)
+    {
+        UINT64 main_victim;
+        bool main_dirty;
+        if (!m_main->fill(mem_addr, dirty, main_victim, main_dirty)) return false;
+        return m_vc->fill(main_victim, main_dirty, victim_addr, victim_dirty);
+    }
+
+    bool invalidate(UINT64 mem_addr, bool& was_dirty)
+    {
+        return m_main->invalidate(mem_addr, was_dirty) || m_vc->invalidate(mem_addr, was_dirty);
+    }
+
+    void dumpResults()
+    {
+        CacheModel::dumpResults();
+        printf("\tvictim cache: %u lines,\thits: %lu\n", m_entries, m_vc_hits);
+    }
+
+protected:
+    CacheModel* m_main;
+    CacheModel* m_vc;
+    UINT32 m_entries;
+    UINT64 m_vc_hits;       // Misses of the main cache served by the victim cache
+
+    bool lookup(UINT64 mem_addr, UINT32& blk_id)
+    {
+        blk_id = 0;
+        return m_main->contains(mem_addr) || m_vc->contains(mem_addr);
+    }
+
+    bool access(UINT64 mem_addr)
+    {
+        bool hit = probe(mem_addr, false);
+        classify(mem_addr >> m_blksz_log, hit);
+
+        if (!hit)
+        {
+            UINT64 victim_addr;
+            bool victim_dirty;
+            fill(mem_addr, false, victim_addr, victim_dirty);
+        }
+        return hit;
+    }
+};
+
+// Build a set-associative cache organized as "mod" (bit slicing), "xor", "prime" or "skew",
+// NULL if the organization or the policy is unknown, or for "skew" with any policy but LRU
+inline CacheModel* newSetOrganization(const string& policy, const string& org, UINT32 log_sets,
+                                      UINT32 log_block_size, UINT32 asso)
+{
+    if (org == "mod")   return newCacheModel<SetAssoCache>(policy, log_sets, log_block_size, asso);
+    if (org == "xor")   return newCacheModel<SetAssoCache_Hashed>(policy, log_sets, log_block_size, asso, INDEX_XOR);
+    if (org == "prime") return newCacheModel<SetAssoCache_Hashed>(policy, log_sets, log_block_size, asso, INDEX_PRIME);
+    if (org == "skew")  return (policy == "lru") ? new SkewedAssoCache(log_sets, log_block_size, asso) : NULL;
+    return NULL;
+}
+
+// Split a comma separated list
+inline vector<string> splitList(const string& list)
+{
+    vector<string> items;
+    for (size_t pos = 0; pos <= list.size() && !list.empty(); )
+    {
+        size_t end = list.find(',', pos);
+        if (end == string::npos) end = list.size();
+        items.push_back(list.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return items;
+}
+
+// Compare the conflict misses of model with those of the bit-sliced baseline of the
+// same geometry; both must classify their misses
+inline void dumpConflictReduction(CacheModel* model, CacheModel* baseline)
+{
+    UINT64 conflict = model->getMissClassifier()->getConflictMisses();
+    UINT64 base = baseline->getMissClassifier()->getConflictMisses();
+    printf("\tconflict misses: %lu,\tbaseline: %lu,\treduction: %.2f%%\n", conflict, base,
+           base ? 100 * ((double)base - conflict) / base : 0);
+}
+
+// Build one organization of -org: "xor", "prime", "skew", or "v<N>" for the bit-sliced
+// cache with an N-line victim cache. NULL if it is malformed
+inline CacheModel* newCacheOrganization(const string& policy, const string& org, UINT32 log_sets,
+                                        UINT32 log_block_size, UINT32 asso)
+{
+    UINT32 entries;
+    char rest;
+    if (sscanf(org.c_str(), "v%u%c", &entries, &rest) == 1 && entries > 0)
+    {
+        CacheModel* main = newCacheModel<SetAssoCache>(policy, log_sets, log_block_size, asso);
+        return main ? new VictimCache(main, entries) : NULL;
+    }
+    return (org == "mod") ? NULL : newSetOrganization(policy, org, log_sets, log_block_size, asso);
+}
+
+/**************************************
+ * Prefetchers
+ *
+ * A prefetcher observes the demand accesses of one cache level, in
+ * lines, and proposes lines to prefetch into it. trigger is set on a
+ * miss or on the first hit to a prefetched line, the events most
+ * prefetchers train on.
+**************************************/
+class Prefetcher
+{
+public:
+    virtual ~Prefetcher() {}
+    virtual const char* name() = 0;
+
+    // Observe a demand access and append the lines to prefetch to out
+    virtual void train(UINT64 pc, UINT64 line, bool trigger, vector<UINT64>& out) = 0;
+};
+
+// Fetch the next lines after every trigger
+class NextLinePrefetcher : public Prefetcher
+{
+public:
+    NextLinePrefetcher(UINT32 degree) : m_degree(degree) {}
+    const char* name() { return "next-line"; }
+
+    void train(UINT64 pc, UINT64 line, bool trigger, vector<UINT64>& out)
+    {
+        if (!trigger) return;
+        for (UINT32 k = 1; k <= m_degree; k++) out.push_back(line + k);
+    }
+
+private:
+    UINT32 m_degree;
+};
+
+// Reference prediction table (Chen & Baer): a PC-indexed table that prefetches
+// along the stride of a load once the same stride has been seen twice in a row
+class StridePrefetcher : public Prefetcher
+{
+public:
+    StridePrefetcher(UINT32 entries, UINT32 degree) : m_entries(entries), m_degree(degree)
+    {
+        m_table = new Entry[entries]();
+    }
+
+    ~StridePrefetcher() { delete[] m_table; }
+
+    const char* name() { return "stride"; }
+
+    void train(UINT64 pc, UINT64 line, bool trigger, vector<UINT64>& out)
+    {
+        Entry& e = m_table[pc % m_entries];
+        if (e.pc != pc || e.state == RPT_EMPTY)
+        {
+            e.pc = pc;
+            e.last = line;
+            e.stride = 0;
+            e.state = RPT_INIT;
+            return;
+        }
+
+        // 同一行内的连续访问不构成步长
+        if (line == e.last) return;
+
+        INT64 stride = (INT64)(line - e.last);
+        bool correct = (stride == e.stride);
+        switch (e.state)
+        {
+            case RPT_INIT:      e.state = correct ? RPT_STEADY : RPT_TRANSIENT; break;
+            case RPT_TRANSIENT: e.state = correct ? RPT_STEADY : RPT_NO_PRED; break;
+            case RPT_STEADY:    e.state = correct ? RPT_STEADY : RPT_INIT; break;
+            default:            e.state = correct ? RPT_TRANSIENT : RPT_NO_PRED; break;
+        }
+        // 稳定状态下一次预测失败不改变步长
+        if (!correct && e.state != RPT_INIT) e.stride = stride;
+        e.last = line;
+
+        if (e.state == RPT_STEADY && e.stride != 0)
+        {
+            for (UINT32 k = 1; k <= m_degree; k++) out.push_back(line + e.stride * k);
+        }
+    }
+
+private:
+    enum { RPT_EMPTY, RPT_INIT, RPT_TRANSIENT, RPT_STEADY, RPT_NO_PRED };
+
+    struct Entry
+    {
+        UINT64 pc;
+        UINT64 last;
+        INT64 stride;
+        UINT32 state;
+    };
+
+    UINT32 m_entries;
+    UINT32 m_degree;
+    Entry* m_table;
+};
+
+// Stream prefetcher: follows up to STREAMS ascending or descending miss streams and,
+// once a stream has moved twice in the same direction, runs degree lines ahead of it
+class StreamPrefetcher : public Prefetcher
+{
+public:
+    StreamPrefetcher(UINT32 degree) : m_degree(degree), m_clock(0)
+    {
+        memset(m_streams, 0, sizeof(m_streams));
+    }
+
+    const char* name() { return "stream"; }
+
+    void train(UINT64 pc, UINT64 line, bool trigger, vector<UINT64>& out)
+    {
+        if (!trigger) return;
+        m_clock++;
+
+        Stream* s = NULL;
+        for (UINT32 i = 0; i < STREAMS; i++)
+        {
+            Stream& t = m_streams[i];
+            if (t.valid && line != t.last && line + WINDOW > t.last && line < t.last + WINDOW)
+            {
+                s = &t;
+                break;
+            }
+        }
+
+        if (s == NULL)
+        {
+            // 替换最久未推进的流
+            s = &m_streams[0];
+            for (UINT32 i = 1; i < STREAMS; i++)
+                if (!m_streams[i].valid || m_streams[i].used < s->used) s = &m_streams[i];
+            s->valid = true;
+            s->last = line;
+            s->dir = 0;
+            s->confidence = 0;
+            s->used = m_clock;
+            return;
+        }
+
+        int dir = (line > s->last) ? 1 : -1;
+        s->confidence = (dir == s->dir) ? s->confidence + 1 : 1;
+        s->dir = dir;
+        s->last = line;
+        s->used = m_clock;
+
+        if (s->confidence >= 2)
+        {
+            for (UINT32 k = 1; k <= m_degree; k++) out.push_back(line + dir * (long)k);
+        }
+    }
+
+private:
+    static const UINT32 STREAMS = 16;
+    static const UINT64 WINDOW = 16;        // 距流当前位置这么多行以内的缺失属于该流
+
+    struct Stream
+    {
+        bool valid;
+        UINT64 last;
+        int dir;
+        UINT32 confidence;
+        UINT64 used;
+    };
+
+    UINT32 m_degree;
+    UINT64 m_clock;
+    Stream m_streams[STREAMS];
+};
+
+// Best-Offset (Michaud): learns the single line offset D that would have covered the
+// most recent triggers, by checking for each candidate offset d whether X - d was a
+// recent trigger, and prefetches X + D. Scores are kept over learning rounds.
+class BestOffsetPrefetcher : public Prefetcher
+{
+public:
+    BestOffsetPrefetcher() : m_best(1), m_enabled(true), m_test(0), m_round(0)
+    {
+        // 质因子只含 2, 3, 5 的偏移量
+        for (UINT32 d = 1; d <= 64; d++)
+        {
+            UINT32 n = d;
+            while (n % 2 == 0) n /= 2;
+            while (n % 3 == 0) n /= 3;
+            while (n % 5 == 0) n /= 5;
+            if (n == 1) m_offsets.push_back(d);
+        }
+        m_scores.assign(m_offsets.size(), 0);
+        memset(m_recent, 0, sizeof(m_recent));
+    }
+
+    const char* name() { return "best-offset"; }
+
+    void train(UINT64 pc, UINT64 line, bool trigger, vector<UINT64>& out)
+    {
+        if (!trigger) return;
+
+        UINT64 base = line - m_offsets[m_test];
+        if (m_recent[base % RR_SIZE] == base + 1) m_scores[m_test]++;
+
+        if (m_scores[m_test] >= SCORE_MAX || (++m_test == m_offsets.size() && ++m_round >= ROUND_MAX))
+            endRound();
+        if (m_test == m_offsets.size()) m_test = 0;
+
+        m_recent[line % RR_SIZE] = line + 1;
+        if (m_enabled) out.push_back(line + m_best);
+    }
+
+private:
+    static const UINT32 RR_SIZE = 256;
+    static const UINT32 SCORE_MAX = 31;
+    static const UINT32 ROUND_MAX = 100;
+    static const UINT32 BAD_SCORE = 1;
+
+    vector<UINT32> m_offsets;
+    vector<UINT32> m_scores;
+    UINT64 m_recent[RR_SIZE];   // 最近触发的行 (加 1, 0 表示空)
+    UINT32 m_best;
+    bool m_enabled;
+    UINT32 m_test;              // 本次检验的偏移量下标
+    UINT32 m_round;
+
+    void endRound()
+    {
+        UINT32 best = 0;
+        for (UINT32 i = 1; i < m_scores.size(); i++)
+            if (m_scores[i] > m_scores[best]) best = i;
+
+        m_best = m_offsets[best];
+        m_enabled = m_scores[best] > BAD_SCORE;
+        m_scores.assign(m_offsets.size(), 0);
+        m_test = 0;
+        m_round = 0;
+    }
+};
+
+// Build a prefetcher by name, NULL if there is no such prefetcher
+inline Prefetcher* newPrefetcher(const string& name)
+{
+    if (name == "nextline") return new NextLinePrefetcher(1);
+    if (name == "stride")   return new StridePrefetcher(256, 2);
+    if (name == "stream")   return new StreamPrefetcher(4);
+    if (name == "bo")       return new BestOffsetPrefetcher();
+    return NULL;
+}
+
+/**************************************
+ * Multi-Level Cache Hierarchy
+**************************************/
+enum InclusionPolicy
+{
+    INCL_NINE,              // Non-inclusive non-exclusive
+    INCL_INCLUSIVE,         // Evictions back-invalidate the upper levels
+    INCL_EXCLUSIVE          // A line lives either here or in an upper level
+};
+
+// Traffic that reaches main memory, and the timing of the memory channel
+struct MemoryTraffic
+{
+    UINT64 reads;           // Line fills
+    UINT64 writebacks;      // Dirty lines written back
+    UINT64 writes;          // Writes through or not allocated in the last level
+    UINT64 write_bytes;
+
+    UINT64 now;             // The core cycle, for transfers nobody waits for
+    UINT32 latency;         // Cycles of access latency on top of the transfer time
+    double bytes_per_cycle; // 0 for unlimited bandwidth
+    double free_at;         // 通道空闲的时刻
+    UINT64 queue_cycles;    // Cycles requests waited for the channel
+
+    MemoryTraffic() : reads(0), writebacks(0), writes(0), write_bytes(0),
+                      now(0), latency(0), bytes_per_cycle(0), free_at(0), queue_cycles(0) {}
+
+    // Move bytes over the channel for a request arriving at cycle t. Return the cycle all of the
+    // data has arrived: the request waits for the channel, occupies it for bytes / bytes_per_cycle
+    // and then pays the latency
+    UINT64 transfer(UINT64 t, UINT32 bytes)
+    {
+        if (bytes_per_cycle == 0) return t + latency;
+
+        double start = (free_at > t) ? free_at : t;
+        queue_cycles += (UINT64)(start - t);
+        free_at = start + bytes / bytes_per_cycle;
+        return (UINT64)ceil(free_at) + latency;
+    }
+};
+
+// One level of the hierarchy: a CacheModel plus its write and inclusion policies,
+// and optionally a prefetcher. The inclusion policy describes this level with
+// respect to the levels above it.
+//
+// Prefetched lines are tagged until their first demand access. A prefetch is late if
+// that access arrives while the fill is still in flight, so that it merges into the
+// prefetch's MSHR, useful if the fill has already arrived, and useless if the line is
+// evicted first. With setTiming the fill's ready cycle decides; without it a fill is
+// taken to arrive PREFETCH_LATENCY core references after the prefetch was issued. A
+// demand miss on a line that a prefetch fill evicted is counted as pollution.
+//
+// Requests carry the cycle they arrive at, and leave with the cycle their data is
+// ready. A level takes its hit latency to look up a line; each miss and prefetch holds
+// an MSHR until its fill arrives, a request to a line still in flight merges into its
+// MSHR, and a miss with every MSHR busy waits for the first to free up. Without
+// setTiming every latency is 0 and MSHRs are unlimited.
+class CacheLevel
+{
+public:
+    CacheLevel(const string& name, CacheModel* cache, bool write_back, bool write_alloc,
+               InclusionPolicy incl, MemoryTraffic* mem, Prefetcher* pf)
+        : m_name(name), m_cache(cache), m_write_back(write_back), m_write_alloc(write_alloc),
+          m_incl(incl), m_next(NULL), m_mem(mem),
+          m_rd_reqs(0), m_rd_hits(0), m_wr_reqs(0), m_wr_hits(0), m_rd_bytes(0), m_wr_bytes(0),
+          m_fetches(0), m_wb_in(0), m_wb_out(0), m_wt_out(0), m_wt_bytes(0), m_back_invals(0),
+          m_pf(pf), m_polluters(NULL), m_now(NULL),
+          m_pf_issued(0), m_pf_useful(0), m_pf_late(0), m_pf_useless(0), m_pf_polluting(0),
+          m_hit_lat(0), m_mshr_num(0), m_timed_misses(0), m_miss_cycles(0),
+          m_mshr_merges(0), m_mshr_full(0), m_mshr_wait_cycles(0), m_pf_dropped(0)
+    {
+        if (m_pf) m_polluters = new UINT64[m_cache->getBlockNum()]();
+    }
+
+    ~CacheLevel()
+    {
+        delete m_cache;
+        delete m_pf;
+        delete[] m_polluters;
+    }
+
+    // Share the count of core references, the clock of prefetch timeliness
+    void setClock(const UINT64* now) { m_now = now; }
+
+    // Model the hit latency in cycles and mshr_num outstanding misses
+    void setTiming(UINT32 hit_lat, UINT32 mshr_num)
+    {
+        m_hit_lat = hit_lat;
+        m_mshr_num = mshr_num;
+        m_mshrs.assign(mshr_num, Mshr());
+    }
+
+    UINT32 getHitLatency() { return m_hit_lat; }
+
+    // Connect this level to the next one towards memory
+    void setNext(CacheLevel* next)
+    {
+        m_next = next;
+        next->m_uppers.push_back(this);
+    }
+
+    // Serve a read from the core, or a line fill for an upper level.
+    // Return true if the line handed up is dirty, which only happens when it leaves an exclusive level
+    // pc is the instruction behind the request, used only to train the prefetchers.
+    // time is the arrival cycle on entry and the cycle the data is ready on return
+    bool read(UINT64 addr, UINT32 size, bool from_upper, UINT64 pc, UINT64& time)
+    {
+        m_rd_reqs++;
+        m_rd_bytes += size;
+        bool move_up = from_upper && m_incl == INCL_EXCLUSIVE;
+        bool dirty = false;
+        UINT64 arrive = time;
+
+        if (m_cache->probe(addr, false))
+        {
+            m_rd_hits++;
+            bool trigger = demandHit(addr, arrive);
+            if (move_up) m_cache->invalidate(addr, dirty);
+            time = hitReady(addr, arrive);
+            prefetch(pc, addr, trigger, arrive);
+            return dirty;
+        }
+
+        demandMiss(addr);
+        dirty = miss(addr, pc, time);
+        if (!move_up) allocate(addr, dirty);
+        prefetch(pc, addr, true, arrive);
+
+        return move_up && dirty;
+    }
+
+    // Serve a store from the core, or a write-through from an upper level.
+    // time is the arrival cycle on entry and the cycle the store completes here on return
+    void write(UINT64 addr, UINT32 size, bool from_upper, UINT64 pc, UINT64& time)
+    {
+        m_wr_reqs++;
+        m_wr_bytes += size;
+        UINT64 arrive = time;
+
+        if (m_cache->probe(addr, m_write_back))
+        {
+            m_wr_hits++;
+            bool trigger = demandHit(addr, arrive);
+            time = hitReady(addr, arrive);
+            if (!m_write_back) writeThrough(addr, size, pc, arrive + m_hit_lat);
+            prefetch(pc, addr, trigger, arrive);
+            return;
+        }
+
+        demandMiss(addr);
+        time = arrive + m_hit_lat;
+
+        // An exclusive level never allocates on behalf of the levels above it
+        bool allocated = m_write_alloc && !(from_upper && m_incl == INCL_EXCLUSIVE);
+        if (allocated)
+        {
+            time = arrive;
+            bool dirty = miss(addr, pc, time);
+            allocate(addr, dirty || m_write_back);
+        }
+
+        if (!m_write_back || !allocated) writeThrough(addr, size, pc, arrive + m_hit_lat);
+        prefetch(pc, addr, true, arrive);
+    }
+
+    // Accept a line evicted from an upper level
+    void evictFromUpper(UINT64 addr, bool dirty)
+    {
+        if (dirty) m_wb_in++;
+
+        // An exclusive level is the victim cache of the levels above it
+        if (m_incl == INCL_EXCLUSIVE)
+        {
+            if (!m_cache->probe(addr, dirty)) allocate(addr, dirty);
+            return;
+        }
+
+        if (!dirty) return;
+
+        if (m_write_back)
+        {
+            if (m_cache->probe(addr, true)) return;
+            if (m_write_alloc)
+            {
+                allocate(addr, true);
+                return;
+            }
+        }
+        else
+        {
+            m_cache->probe(addr, false);
+        }
+
+        evict(addr, true);
+    }
+
+    // Drop addr from this level and every level above it. Return true if any copy was dirty
+    bool backInvalidate(UINT64 addr)
+    {
+        bool dirty = false;
+        if (m_cache->invalidate(addr, dirty))
+        {
+            m_back_invals++;
+            m_pf_lines.erase(addr >> m_cache->getBlockSizeLog());
+        }
+
+        for (size_t i = 0; i < m_uppers.size(); i++)
+            dirty |= m_uppers[i]->backInvalidate(addr);
+
+        return dirty;
+    }
+
+    void dumpResults()
+    {
+        const char* incl_name[] = { "NINE", "inclusive", "exclusive" };
+        UINT32 blk_size = 1 << m_cache->getBlockSizeLog();
+
+        printf("\n%s (%u KB, %s, %s, %s):\n", m_name.c_str(), (m_cache->getBlockNum() * blk_size) >> 10,
+               m_write_back ? "write-back" : "write-through",
+               m_write_alloc ? "write-allocate" : "no-write-allocate", incl_name[m_incl]);
+        printf("\tread req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_rd_reqs, m_rd_hits,
+               m_rd_reqs ? 100 * (float)m_rd_hits / m_rd_reqs : 0);
+        printf("\twrite req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_wr_reqs, m_wr_hits,
+               m_wr_reqs ? 100 * (float)m_wr_hits / m_wr_reqs : 0);
+        printf("\tbytes read: %lu,\tbytes written: %lu\n", m_rd_bytes, m_wr_bytes);
+        printf("\twritebacks in: %lu,\twritebacks out: %lu,\twrite-throughs out: %lu,\tback-invalidated: %lu\n",
+               m_wb_in, m_wb_out, m_wt_out, m_back_invals);
+        printf("\ttraffic to next level: read %lu bytes,\twritten %lu bytes\n",
+               m_fetches * blk_size, m_wb_out * blk_size + m_wt_bytes);
+
+        if (m_pf == NULL) return;
+
+        UINT64 used = m_pf_useful + m_pf_late;
+        UINT64 misses = (m_rd_reqs - m_rd_hits) + (m_wr_reqs - m_wr_hits);
+        printf("\tprefetcher: %s,\tissued: %lu,\tuseful: %lu,\tlate: %lu,\tuseless: %lu,\tpolluting: %lu\n",
+               m_pf->name(), m_pf_issued, m_pf_useful, m_pf_late, m_pf_useless, m_pf_polluting);
+        printf("\taccuracy: %.2f%%,\tcoverage: %.2f%%,\ttimeliness: %.2f%%\n",
+               m_pf_issued ? 100 * (float)used / m_pf_issued : 0,
+               used + misses ? 100 * (float)used / (used + misses) : 0,
+               used ? 100 * (float)m_pf_useful / used : 0);
+        if (m_mshr_num) printf("\tprefetches dropped for lack of an MSHR: %lu\n", m_pf_dropped);
+    }
+
+    void registerStats(StatsRegistry& stats, const string& prefix)
+    {
+        string p = prefix + "." + m_name;
+        stats.watch(p + ".read_reqs", &m_rd_reqs);
+        stats.watch(p + ".read_hits", &m_rd_hits);
+        stats.watch(p + ".write_reqs", &m_wr_reqs);
+        stats.watch(p + ".write_hits", &m_wr_hits);
+        stats.watch(p + ".fetches", &m_fetches);
+        stats.watch(p + ".writebacks", &m_wb_out);
+        stats.watch(p + ".back_invalidations", &m_back_invals);
+        if (m_pf)
+        {
+            stats.watch(p + ".prefetch_issued", &m_pf_issued);
+            stats.watch(p + ".prefetch_useful", &m_pf_useful);
+            stats.watch(p + ".prefetch_late", &m_pf_late);
+        }
+        if (m_mshr_num) stats.watch(p + ".miss_cycles", &m_miss_cycles);
+    }
+
+    // Print the latency statistics, once setTiming has been called
+    void dumpTiming()
+    {
+        if (m_mshr_num == 0) return;
+
+        printf("\t%s:\thit latency: %u,\tMSHRs: %u,\tavg miss latency: %.1f cycles,\tMSHR merges: %lu,"
+               "\tMSHR full: %lu (%lu cycles)\n", m_name.c_str(), m_hit_lat, m_mshr_num,
+               m_timed_misses ? (double)m_miss_cycles / m_timed_misses : 0,
+               m_mshr_merges, m_mshr_full, m_mshr_wait_cycles);
+    }
+
+private:
+    string m_name;
+    CacheModel* m_cache;
+    bool m_write_back;
+    bool m_write_alloc;
+    InclusionPolicy m_incl;
+
+    CacheLevel* m_next;                 // NULL 表示下一级为主存
+    vector<CacheLevel*> m_uppers;       // 以本级为下一级的各个 Cache
+    MemoryTraffic* m_mem;
+
+    UINT64 m_rd_reqs;       // Reads from the core or line fills for upper levels
+    UINT64 m_rd_hits;
+    UINT64 m_wr_reqs;       // Stores from the core or write-throughs from upper levels
+    UINT64 m_wr_hits;
+    UINT64 m_rd_bytes;      // Bytes requested by reads, a whole line for fills
+    UINT64 m_wr_bytes;
+    UINT64 m_fetches;       // Lines fetched from the next level
+    UINT64 m_wb_in;         // Dirty lines received from upper levels
+    UINT64 m_wb_out;        // Dirty lines sent to the next level
+    UINT64 m_wt_out;        // Writes passed through to the next level
+    UINT64 m_wt_bytes;
+    UINT64 m_back_invals;   // Lines dropped because a lower inclusive level evicted them
+
+    // Core references a prefetch fill is taken to need when the level is not timed
+    static const UINT64 PREFETCH_LATENCY = 32;
+
+    Prefetcher* m_pf;                       // NULL 表示不预取
+    unordered_map<UINT64, UINT64> m_pf_lines;   // 尚未被访问的预取行 -> 填充到达的周期, 未计时则为发出预取时的 *m_now
+    UINT64* m_polluters;    // 被预取挤出的行号加 1, 按行号直接映射, 用于识别污染
+    vector<UINT64> m_pf_candidates;
+    const UINT64* m_now;    // Core references so far, owned by the hierarchy
+
+    UINT64 m_pf_issued;
+    UINT64 m_pf_useful;
+    UINT64 m_pf_late;
+    UINT64 m_pf_useless;
+    UINT64 m_pf_polluting;
+
+    // 未命中状态保持寄存器: 在途的行及其数据到达的时刻
+    struct Mshr
+    {
+        UINT64 line;
+        UINT64 ready;
+
+        Mshr() : line(0), ready(0) {}
+    };
+
+    UINT32 m_hit_lat;
+    UINT32 m_mshr_num;      // 0 when the level is not timed
+    vector<Mshr> m_mshrs;
+
+    UINT64 m_timed_misses;
+    UINT64 m_miss_cycles;   // From arrival to data ready, summed over misses
+    UINT64 m_mshr_merges;   // Requests to a line already in flight
+    UINT64 m_mshr_full;     // Misses that waited for an MSHR
+    UINT64 m_mshr_wait_cycles;
+    UINT64 m_pf_dropped;
+
+    // Fetch a line from the next level. Return true if it arrives dirty
+    // time is the cycle the request leaves for the next level on entry, and the cycle the line arrives on return
+    bool fetch(UINT64 addr, UINT64 pc, UINT64& time)
+    {
+        m_fetches++;
+        UINT32 blk_size = 1 << m_cache->getBlockSizeLog();
+        if (m_next) return m_next->read(addr, blk_size, true, pc, time);
+
+        m_mem->reads++;
+        time = m_mem->transfer(time, blk_size);
+        return false;
+    }
+
+    // Fetch a missing line through an MSHR; time as in read()
+    bool miss(UINT64 addr, UINT64 pc, UINT64& time)
+    {
+        UINT64 arrive = time;
+        time += m_hit_lat;
+        if (m_mshr_num == 0) return fetch(addr, pc, time);
+
+        Mshr* mshr = freeMshr(time);
+        if (mshr->ready > time)
+        {
+            m_mshr_full++;
+            m_mshr_wait_cycles += mshr->ready - time;
+            time = mshr->ready;
+        }
+
+        bool dirty = fetch(addr, pc, time);
+        mshr->line = addr >> m_cache->getBlockSizeLog();
+        mshr->ready = time;
+
+        m_timed_misses++;
+        m_miss_cycles += time - arrive;
+        return dirty;
+    }
+
+    // A hit is ready after the hit latency, or when the fill it merges into arrives
+    UINT64 hitReady(UINT64 addr, UINT64 arrive)
+    {
+        UINT64 time = arrive + m_hit_lat;
+        UINT64 line = addr >> m_cache->getBlockSizeLog();
+        for (UINT32 i = 0; i < m_mshr_num; i++)
+        {
+            if (m_mshrs[i].line == line && m_mshrs[i].ready > time)
+            {
+                m_mshr_merges++;
+                return m_mshrs[i].ready;
+            }
+        }
+        return time;
+    }
+
+    // The MSHR that frees up first, which is free at time if its ready cycle has passed
+    Mshr* freeMshr(UINT64 time)
+    {
+        Mshr* first = &m_mshrs[0];
+        for (UINT32 i = 1; i < m_mshr_num && first->ready > time; i++)
+            if (m_mshrs[i].ready < first->ready) first = &m_mshrs[i];
+        return first;
+    }
+
+    // Stores are posted, so nobody waits for the time they take below this level
+    void writeThrough(UINT64 addr, UINT32 size, UINT64 pc, UINT64 time)
+    {
+        m_wt_out++;
+        m_wt_bytes += size;
+        if (m_next) m_next->write(addr, size, true, pc, time);
+        else
+        {
+            m_mem->writes++;
+            m_mem->write_bytes += size;
+            m_mem->transfer(time, size);
+        }
+    }
+
+    // Hand a line leaving this level to the next one
+    void evict(UINT64 addr, bool dirty)
+    {
+        if (dirty) m_wb_out++;
+
+        if (m_next) m_next->evictFromUpper(addr, dirty);
+        else if (dirty)
+        {
+            m_mem->writebacks++;
+            m_mem->transfer(m_mem->now, 1 << m_cache->getBlockSizeLog());
+        }
+    }
+
+    // Allocate a line, and return the line it evicted, if any, in victim
+    bool allocate(UINT64 addr, bool dirty, UINT64* victim = NULL)
+    {
+        UINT64 victim_addr;
+        bool victim_dirty;
+        if (!m_cache->fill(addr, dirty, victim_addr, victim_dirty)) return false;
+
+        UINT64 victim_line = victim_addr >> m_cache->getBlockSizeLog();
+        if (!m_pf_lines.empty() && m_pf_lines.erase(victim_line)) m_pf_useless++;
+        if (victim) *victim = victim_line;
+
+        if (m_incl == INCL_INCLUSIVE)
+        {
+            for (size_t i = 0; i < m_uppers.size(); i++)
+                victim_dirty |= m_uppers[i]->backInvalidate(victim_addr);
+        }
+
+        evict(victim_addr, victim_dirty);
+        return true;
+    }
+
+    // First demand access to a prefetched line, arriving at cycle arrive. Return true if it was one,
+    // which trains the prefetcher
+    bool demandHit(UINT64 addr, UINT64 arrive)
+    {
+        if (m_pf_lines.empty()) return false;
+
+        unordered_map<UINT64, UINT64>::iterator it = m_pf_lines.find(addr >> m_cache->getBlockSizeLog());
+        if (it == m_pf_lines.end()) return false;
+
+        // 计时时与 hitReady 一致: 合并进预取的 MSHR 即为迟到
+        bool late = m_mshr_num ? it->second > arrive + m_hit_lat : *m_now - it->second < PREFETCH_LATENCY;
+        if (late) m_pf_late++;
+        else m_pf_useful++;
+        m_pf_lines.erase(it);
+        return true;
+    }
+
+    void demandMiss(UINT64 addr)
+    {
+        if (m_polluters == NULL) return;
+
+        UINT64 line = addr >> m_cache->getBlockSizeLog();
+        UINT64& slot = m_polluters[line % m_cache->getBlockNum()];
+        if (slot == line + 1)
+        {
+            m_pf_polluting++;
+            slot = 0;
+        }
+    }
+
+    // Train the prefetcher and fill the lines it asks for, within the page of addr.
+    // Prefetches leave after the lookup of the trigger that arrived at cycle arrive
+    void prefetch(UINT64 pc, UINT64 addr, bool trigger, UINT64 arrive)
+    {
+        if (m_pf == NULL) return;
+
+        UINT32 blksz_log = m_cache->getBlockSizeLog();
+        UINT64 line = addr >> blksz_log;
+        m_pf_candidates.clear();
+        m_pf->train(pc, line, trigger, m_pf_candidates);
+
+        for (size_t i = 0; i < m_pf_candidates.size(); i++)
+        {
+            UINT64 pf_line = m_pf_candidates[i];
+            UINT64 pf_addr = pf_line << blksz_log;
+            if ((pf_line ^ line) >> (PAGE_SIZE_LOG - blksz_log) || m_cache->contains(pf_addr)) continue;
+
+            UINT64 time = arrive + m_hit_lat;
+            Mshr* mshr = NULL;
+            if (m_mshr_num)
+            {
+                // 预取不等待 MSHR
+                mshr = freeMshr(time);
+                if (mshr->ready > time)
+                {
+                    m_pf_dropped++;
+                    continue;
+                }
+            }
+
+            m_pf_issued++;
+            UINT64 victim;
+            if (allocate(pf_addr, fetch(pf_addr, pc, time), &victim))
+                m_polluters[victim % m_cache->getBlockNum()] = victim + 1;
+            m_pf_lines[pf_line] = m_mshr_num ? time : *m_now;
+
+            if (mshr)
+            {
+                mshr->line = pf_line;
+                mshr->ready = time;
+            }
+        }
+    }
+};
+
+// Build a level from "log_sets,asso,wb|wt,wa|nwa,nine|incl|excl" followed by any of
+// ",nextline|stride|stream|bo" (a prefetcher), ",xor|prime|skew" (the set organization)
+// and ",v<N>" (an N-line victim cache). NULL if the spec is malformed
+inline CacheLevel* newCacheLevel(const string& name, const string& spec, const string& policy,
+                                 UINT32 log_block_size, MemoryTraffic* mem)
+{
+    UINT32 log_sets, asso;
+    char write[4], alloc[4], incl[5];
+    int len = 0;
+    if (sscanf(spec.c_str(), "%u,%u,%3[a-z],%3[a-z],%4[a-z]%n", &log_sets, &asso, write, alloc, incl, &len) != 5 || len == 0)
+        return NULL;
+
+    string w(write), a(alloc), i(incl);
+    if ((w != "wb" && w != "wt") || (a != "wa" && a != "nwa") || (i != "nine" && i != "incl" && i != "excl"))
+        return NULL;
+
+    // 其余字段均以逗号开头
+    string extra = spec.substr(len);
+    if (!extra.empty() && extra[0] != ',')
+        return NULL;
+
+    string org = "mod";
+    UINT32 victims = 0;
+    Prefetcher* pf = NULL;
+    bool ok = true;
+    vector<string> fields = splitList(extra.empty() ? extra : extra.substr(1));
+    for (size_t k = 0; ok && k < fields.size(); k++)
+    {
+        char c;
+        Prefetcher* p = NULL;
+        if (fields[k] == "xor" || fields[k] == "prime" || fields[k] == "skew") org = fields[k];
+        else if (sscanf(fields[k].c_str(), "v%u%c", &victims, &c) == 1 && victims > 0) continue;
+        else if (pf == NULL && (p = newPrefetcher(fields[k])) != NULL) pf = p;
+        else ok = false;
+    }
+
+    CacheModel* cache = ok ? newSetOrganization(policy, org, log_sets, log_block_size, asso) : NULL;
+    if (cache == NULL)
+    {
+        delete pf;
+        return NULL;
+    }
+    if (victims) cache = new VictimCache(cache, victims);
+
+    InclusionPolicy ip = (i == "incl") ? INCL_INCLUSIVE : (i == "excl") ? INCL_EXCLUSIVE : INCL_NINE;
+    return new CacheLevel(name, cache, w == "wb", a == "wa", ip, mem, pf);
+}
+
+// L1I and L1D share an L2, which is backed by the LLC.
+//
+// With setTiming the hierarchy also keeps a core clock: the core issues one reference
+// per cycle, and stalls on fetches and loads until their data is ready, beyond the
+// L1 hit latency that the pipeline hides. Stores retire into a store buffer and never
+// stall, though their misses still hold MSHRs and memory bandwidth.
+class CacheHierarchy
+{
+public:
+    CacheHierarchy(CacheLevel* l1i, CacheLevel* l1d, CacheLevel* l2, CacheLevel* llc, MemoryTraffic* mem)
+        : m_l1i(l1i), m_l1d(l1d), m_l2(l2), m_llc(llc), m_mem(mem), m_refs(0), m_timed(false), m_stall_cycles(0)
+    {
+        memset(m_ref_num, 0, sizeof(m_ref_num));
+        memset(m_ref_cycles, 0, sizeof(m_ref_cycles));
+
+        m_l1i->setClock(&m_refs);
+        m_l1d->setClock(&m_refs);
+        m_l2->setClock(&m_refs);
+        m_llc->setClock(&m_refs);
+
+        m_l1i->setNext(m_l2);
+        m_l1d->setNext(m_l2);
+        m_l2->setNext(m_llc);
+    }
+
+    ~CacheHierarchy()
+    {
+        delete m_l1i;
+        delete m_l1d;
+        delete m_l2;
+        delete m_llc;
+        delete m_mem;
+    }
+
+    // Model latencies from "l1i,l1d,l2,llc" hit cycles, "l1i,l1d,l2,llc" MSHRs and
+    // "latency,bytes_per_cycle" of memory. Return false if a spec is malformed
+    bool setTiming(const string& lat_spec, const string& mshr_spec, const string& mem_spec)
+    {
+        UINT32 lat[4], mshrs[4], mem_lat;
+        double bw;
+        if (sscanf(lat_spec.c_str(), "%u,%u,%u,%u", &lat[0], &lat[1], &lat[2], &lat[3]) != 4 ||
+            sscanf(mshr_spec.c_str(), "%u,%u,%u,%u", &mshrs[0], &mshrs[1], &mshrs[2], &mshrs[3]) != 4 ||
+            sscanf(mem_spec.c_str(), "%u,%lf", &mem_lat, &bw) != 2 || bw < 0)
+            return false;
+
+        CacheLevel* levels[4] = { m_l1i, m_l1d, m_l2, m_llc };
+        for (int i = 0; i < 4; i++)
+        {
+            if (mshrs[i] == 0) return false;
+            levels[i]->setTiming(lat[i], mshrs[i]);
+        }
+
+        m_mem->latency = mem_lat;
+        m_mem->bytes_per_cycle = bw;
+        m_timed = true;
+        return true;
+    }
+
+    // Each access must stay within one line. pc trains the prefetchers, 0 if unknown
+    void fetchInst(UINT64 addr, UINT32 size)
+    {
+        UINT64 time = issue();
+        m_l1i->read(addr, size, false, addr, time);
+        retire(REF_KIND_FETCH, time, m_l1i->getHitLatency());
+    }
+
+    void read(UINT64 addr, UINT32 size, UINT64 pc = 0)
+    {
+        UINT64 time = issue();
+        m_l1d->read(addr, size, false, pc, time);
+        retire(REF_KIND_READ, time, m_l1d->getHitLatency());
+    }
+
+    void write(UINT64 addr, UINT32 size, UINT64 pc = 0)
+    {
+        UINT64 time = issue();
+        m_l1d->write(addr, size, false, pc, time);
+        retire(REF_KIND_WRITE, time, m_l1d->getHitLatency());
+    }
+
+    // Call after setTiming, so the timing counters are exported too
+    void registerStats(StatsRegistry& stats, const string& prefix)
+    {
+        m_l1i->registerStats(stats, prefix);
+        m_l1d->registerStats(stats, prefix);
+        m_l2->registerStats(stats, prefix);
+        m_llc->registerStats(stats, prefix);
+        stats.watch(prefix + ".mem.reads", &m_mem->reads);
+        stats.watch(prefix + ".mem.writebacks", &m_mem->writebacks);
+        stats.watch(prefix + ".mem.writes", &m_mem->writes);
+        if (m_timed) stats.watch(prefix + ".stall_cycles", &m_stall_cycles);
+    }
+
+    void dumpResults(UINT32 log_block_size, UINT64 inst_count)
+    {
+        m_l1i->dumpResults();
+        m_l1d->dumpResults();
+        m_l2->dumpResults();
+        m_llc->dumpResults();
+
+        printf("\nMemory:\n");
+        printf("\tline reads: %lu,\twritebacks: %lu,\tpartial writes: %lu\n",
+               m_mem->reads, m_mem->writebacks, m_mem->writes);
+        printf("\ttraffic: read %lu bytes,\twritten %lu bytes\n", m_mem->reads << log_block_size,
+               (m_mem->writebacks << log_block_size) + m_mem->write_bytes);
+
+        if (!m_timed) return;
+
+        UINT64 cycles = m_mem->now;
+        UINT64 refs = m_ref_num[0] + m_ref_num[1] + m_ref_num[2];
+        UINT64 transfers = m_mem->reads + m_mem->writebacks + m_mem->writes;
+        UINT64 bytes = ((m_mem->reads + m_mem->writebacks) << log_block_size) + m_mem->write_bytes;
+        double bw_used = cycles ? (double)bytes / cycles : 0;
+
+        printf("\nTiming:\n");
+        printf("\tAMAT: %.2f cycles,\tfetch: %.2f,\tread: %.2f,\twrite: %.2f\n",
+               refs ? (double)(m_ref_cycles[0] + m_ref_cycles[1] + m_ref_cycles[2]) / refs : 0,
+               avgLatency(REF_KIND_FETCH), avgLatency(REF_KIND_READ), avgLatency(REF_KIND_WRITE));
+        m_l1i->dumpTiming();
+        m_l1d->dumpTiming();
+        m_l2->dumpTiming();
+        m_llc->dumpTiming();
+        printf("\tmemory:\tlatency: %u,\tbandwidth used: %.2f bytes/cycle", m_mem->latency, bw_used);
+        if (m_mem->bytes_per_cycle > 0)
+            printf(" (%.2f%%)", 100 * bw_used / m_mem->bytes_per_cycle);
+        printf(",\tavg queueing: %.1f cycles\n", transfers ? (double)m_mem->queue_cycles / transfers : 0);
+        printf("\testimated cycles: %lu,\tmemory-stall cycles: %lu (%.2f%%),\tstall cycles per kilo-instruction: %.2f\n",
+               cycles, m_stall_cycles, cycles ? 100 * (double)m_stall_cycles / cycles : 0,
+               inst_count ? 1000 * (double)m_stall_cycles / inst_count : 0);
+    }
+
+private:
+    enum { REF_KIND_FETCH, REF_KIND_READ, REF_KIND_WRITE, REF_KINDS };
+
+    CacheLevel* m_l1i;
+    CacheLevel* m_l1d;
+    CacheLevel* m_l2;
+    CacheLevel* m_llc;
+    MemoryTraffic* m_mem;   // Its now is the core clock
+    UINT64 m_refs;          // Fetches, reads and writes from the core
+
+    bool m_timed;
+    UINT64 m_ref_num[REF_KINDS];
+    UINT64 m_ref_cycles[REF_KINDS];     // 从发出到数据就绪的周期数之和
+    UINT64 m_stall_cycles;
+
+    // Issue a reference from the core, returning its cycle
+    UINT64 issue()
+    {
+        m_refs++;
+        return m_mem->now;
+    }
+
+    // Account for a reference that issued at the core clock and was ready at cycle ready
+    void retire(UINT32 kind, UINT64 ready, UINT32 hidden)
+    {
+        if (!m_timed) return;
+
+        UINT64 latency = ready - m_mem->now;
+        m_ref_num[kind]++;
+        m_ref_cycles[kind] += latency;
+
+        UINT64 stall = (kind != REF_KIND_WRITE && latency > hidden) ? latency - hidden : 0;
+        m_stall_cycles += stall;
+        m_mem->now += 1 + stall;
+    }
+
+    double avgLatency(UINT32 kind) { return m_ref_num[kind] ? (double)m_ref_cycles[kind] / m_ref_num[kind] : 0; }
+};
+
+/**************************************
+ * TLB Hierarchy and Page Walker
+**************************************/
+
+// A TLB made of one or more set-associative arrays, each caching the translations
+// of some page sizes. Translations are kept in SetAssoCache models with 1-byte
+// blocks, addressed by a key that combines the virtual page number and the page size
+class TLB
+{
+public:
+    TLB(const string& name) : m_name(name), m_lookups(0), m_misses(0) {}
+
+    ~TLB()
+    {
+        for (size_t i = 0; i < m_arrays.size(); i++) delete m_arrays[i];
+    }
+
+    // Add an array of entries translations organised in asso ways, serving the
+    // page sizes whose logs are set in page_log_mask. Return false on a bad geometry
+    bool addArray(UINT32 entries, UINT32 asso, UINT64 page_log_mask)
+    {
+        if (asso == 0 || entries % asso != 0) return false;
+
+        UINT32 sets = entries / asso, log_sets = 0;
+        while ((1u << log_sets) < sets) log_sets++;
+        if ((1u << log_sets) != sets) return false;
+
+        m_arrays.push_back(new SetAssoCache<LRUPolicy>(log_sets, 0, asso));
+        m_page_logs.push_back(page_log_mask);
+        return true;
+    }
+
+    // Look up the translation of vaddr in the array serving its page size
+    bool lookup(UINT64 vaddr, UINT32 page_log)
+    {
+        m_lookups++;
+        CacheModel* array = getArray(page_log);
+        if (array && array->probe(pageKey(vaddr, page_log), false)) return true;
+
+        m_misses++;
+        return false;
+    }
+
+    void fill(UINT64 vaddr, UINT32 page_log)
+    {
+        CacheModel* array = getArray(page_log);
+        if (array == NULL) return;
+
+        UINT64 victim_key;
+        bool victim_dirty;
+        array->fill(pageKey(vaddr, page_log), false, victim_key, victim_dirty);
+    }
+
+    void dumpResults(UINT64 inst_count)
+    {
+        printf("\t%s:\tlookups: %lu,\tmisses: %lu,\tmiss rate: %.2f%%,\tMPKI: %.3f\n", m_name.c_str(),
+               m_lookups, m_misses, m_lookups ? 100 * (float)m_misses / m_lookups : 0,
+               inst_count ? 1000 * (double)m_misses / inst_count : 0);
+    }
+
+private:
+    string m_name;
+    vector<CacheModel*> m_arrays;
+    vector<UINT64> m_page_logs;     // 各数组所服务的页大小, 第 i 位表示 2^i 字节的页
+
+    UINT64 m_lookups;
+    UINT64 m_misses;
+
+    // Page sizes are kept above the 36-bit VPN, so they never change the set index
+    static UINT64 pageKey(UINT64 vaddr, UINT32 page_log)
+    {
+        return ((vaddr & ((1ul << VIR_ADDR_BITS) - 1)) >> page_log) | ((UINT64)page_log << 56);
+    }
+
+    CacheModel* getArray(UINT32 page_log)
+    {
+        for (size_t i = 0; i < m_arrays.size(); i++)
+            if (m_page_logs[i] & (1ul << page_log)) return m_arrays[i];
+        return NULL;
+    }
+};
+
+// L1 dTLB backed by the STLB, with a 4-level radix page walker whose upper-level
+// entries (PML4E, PDPTE, PDE) are cached in small fully associative page walk caches.
+// A level given 0 entries has no page walk cache. All data is backed by pages of one size,
+// unless a page allocator maps them: each translation then uses the size of its mapping,
+// so the regions promoted to huge pages hit the 2 MB arrays
+class MMU
+{
+public:
+    MMU(TLB* dtlb, TLB* stlb, UINT32 page_log, const UINT32 pwc_entries[3])
+        : m_dtlb(dtlb), m_stlb(stlb), m_page_log(page_log), m_walks(0), m_walk_refs(0), m_other_pages(0)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            m_pwc[i] = pwc_entries[i] ? new FullAssoCache<LRUPolicy>(pwc_entries[i], levelShift(i)) : NULL;
+            m_pwc_hits[i] = 0;
+        }
+    }
+
+    ~MMU()
+    {
+        delete m_dtlb;
+        delete m_stlb;
+        for (int i = 0; i < 3; i++) delete m_pwc[i];
+    }
+
+    // Model the translation of one data access
+    void translate(UINT64 vaddr)
+    {
+        UINT32 page_log = m_page_log;
+        if (page_allocator)
+        {
+            page_log = page_allocator->pageLog(vaddr);
+            if (page_log != m_page_log) m_other_pages++;
+        }
+
+        if (m_dtlb->lookup(vaddr, page_log)) return;
+
+        if (!m_stlb->lookup(vaddr, page_log))
+        {
+            walk(vaddr, page_log);
+            m_stlb->fill(vaddr, page_log);
+        }
+        m_dtlb->fill(vaddr, page_log);
+    }
+
+    void dumpResults(UINT64 inst_count)
+    {
+        printf("\n%lu KB pages, %lu instructions:\n", (1ul << m_page_log) >> 10, inst_count);
+        if (m_other_pages) printf("\ttranslations in huge pages of the allocator: %lu\n", m_other_pages);
+        m_dtlb->dumpResults(inst_count);
+        m_stlb->dumpResults(inst_count);
+        printf("\tpage walks: %lu,\tmemory references: %lu (%.2f per walk)\n",
+               m_walks, m_walk_refs, m_walks ? (float)m_walk_refs / m_walks : 0);
+        printf("\tpage walk cache hits:\tPML4E: %lu,\tPDPTE: %lu,\tPDE: %lu\n",
+               m_pwc_hits[0], m_pwc_hits[1], m_pwc_hits[2]);
+    }
+
+private:
+    // 第 level 级页表项所映射的虚拟地址位: 39, 30, 21, 12
+    static UINT32 levelShift(UINT32 level) { return VIR_ADDR_BITS - 9 * (level + 1); }
+
+    TLB* m_dtlb;
+    TLB* m_stlb;
+    UINT32 m_page_log;
+
+    CacheModel* m_pwc[3];   // NULL 表示该级没有页表遍历缓存
+    UINT64 m_pwc_hits[3];
+    UINT64 m_walks;
+    UINT64 m_walk_refs;     // 页表遍历所读取的页表项个数
+    UINT64 m_other_pages;   // 按页分配器的映射使用了另一种页大小的翻译
+
+    // Walk the page table down to the leaf entry of a page_log sized page,
+    // starting below the deepest level whose entry hits in the page walk caches
+    void walk(UINT64 vaddr, UINT32 page_log)
+    {
+        UINT32 leaf = (page_log >= 30) ? 1 : (page_log >= 21) ? 2 : 3;
+        UINT32 start = 0;
+        for (int i = leaf - 1; i >= 0; i--)
+        {
+            if (m_pwc[i] && m_pwc[i]->probe(vaddr, false))
+            {
+                m_pwc_hits[i]++;
+                start = i + 1;
+                break;
+            }
+        }
+
+        UINT64 victim_addr;
+        bool victim_dirty;
+        for (UINT32 i = start; i < leaf; i++)
+            if (m_pwc[i]) m_pwc[i]->fill(vaddr, false, victim_addr, victim_dirty);
+
+        m_walks++;
+        m_walk_refs += leaf - start + 1;
+    }
+};
+
+// Parse "entries,asso" into an array of tlb serving page_log_mask
+inline bool addTLBArray(TLB* tlb, const string& spec, UINT64 page_log_mask)
+{
+    UINT32 entries, asso;
+    if (sscanf(spec.c_str(), "%u,%u", &entries, &asso) != 2) return false;
+    return tlb->addArray(entries, asso, page_log_mask);
+}
+
+// Build the MMU from the TLB knobs, NULL if any of them is malformed
+inline MMU* newMMU(UINT32 page_log, const string& pwc_spec, const string& dtlb4k, const string& dtlb2m,
+                   const string& dtlb1g, const string& stlb_spec, const string& stlb1g)
+{
+    UINT32 pwc[3];
+    TLB* dtlb = new TLB("L1 dTLB");
+    TLB* stlb = new TLB("STLB");
+    bool ok = (page_log == 12 || page_log == 21 || page_log == 30)
+        && sscanf(pwc_spec.c_str(), "%u,%u,%u", &pwc[0], &pwc[1], &pwc[2]) == 3
+        && addTLBArray(dtlb, dtlb4k, 1ul << 12)
+        && addTLBArray(dtlb, dtlb2m, 1ul << 21)
+        && addTLBArray(dtlb, dtlb1g, 1ul << 30)
+        && addTLBArray(stlb, stlb_spec, (1ul << 12) | (1ul << 21))
+        && addTLBArray(stlb, stlb1g, 1ul << 30);
+    if (!ok)
+    {
+        delete dtlb;
+        delete stlb;
+        return NULL;
+    }
+    return new MMU(dtlb, stlb, page_log, pwc);
+}
+
+// Build the hierarchy from the per-level specs, NULL if any of them is malformed
+inline CacheHierarchy* newCacheHierarchy(const string& policy, UINT32 blksz_log, const string& l1i_spec,
+                                         const string& l1d_spec, const string& l2_spec, const string& llc_spec)
+{
+    MemoryTraffic* mem = new MemoryTraffic();
+    CacheLevel* l1i = newCacheLevel("L1I", l1i_spec, policy, blksz_log, mem);
+    CacheLevel* l1d = newCacheLevel("L1D", l1d_spec, policy, blksz_log, mem);
+    CacheLevel* l2 = newCacheLevel("L2", l2_spec, policy, blksz_log, mem);
+    CacheLevel* llc = newCacheLevel("LLC", llc_spec, policy, blksz_log, mem);
+    if (!l1i || !l1d || !l2 || !llc)
+    {
+        delete l1i;
+        delete l1d;
+        delete l2;
+        delete llc;
+        delete mem;
+        return NULL;
+    }
+    return new CacheHierarchy(l1i, l1d, l2, llc, mem);
+}
+
+// Return where the part of [addr, end) that lies in addr's line stops
+inline UINT64 lineChunkEnd(UINT64 addr, UINT64 end, UINT32 line_log)
+{
+    UINT64 line_end = ((addr >> line_log) + 1) << line_log;
+    return (line_end < end) ? line_end : end;
+}
+
+/**************************************
+ * Miss-Ratio Curves
+ *
+ * Mattson's stack algorithm: an LRU cache of C lines hits exactly the
+ * references whose stack distance (the number of distinct lines touched
+ * since the last reference to the same line) is below C, so one pass
+ * gives the miss ratio of every cache size at once.
+**************************************/
+#define DIST_COLD   (~(UINT64)0)    // The first reference to a line
+
+// Fully associative stack distances in O(log n) per reference. Every line keeps the
+// time of its last reference, and a Fenwick tree marks the times that are still
+// some line's last reference, so the distance is the number of marks after it.
+class ReuseDistance
+{
+public:
+    ReuseDistance() : m_now(0) { m_tree.assign(MIN_CAPACITY + 1, 0); }
+
+    // Return the stack distance of line, or DIST_COLD, and make it the most recent one
+    UINT64 access(UINT64 line)
+    {
+        if (m_now + 1 >= m_tree.size()) compact();
+        UINT64 now = ++m_now;
+        UINT64 dist = DIST_COLD;
+
+        unordered_map<UINT64, UINT64>::iterator it = m_last.find(line);
+        if (it != m_last.end())
+        {
+            dist = prefix(now - 1) - prefix(it->second);
+            update(it->second, -1);
+            it->second = now;
+        }
+        else
+        {
+            m_last[line] = now;
+        }
+
+        update(now, 1);
+        return dist;
+    }
+
+    // Forget line as if it had never been referenced
+    void remove(UINT64 line)
+    {
+        unordered_map<UINT64, UINT64>::iterator it = m_last.find(line);
+        if (it == m_last.end()) return;
+        update(it->second, -1);
+        m_last.erase(it);
+    }
+
+    UINT64 getLineNum() { return m_last.size(); }
+
+    // Approximate heap usage: the hash nodes and buckets plus the tree
+    UINT64 getMemoryUsage()
+    {
+        return m_last.size() * (2 * sizeof(UINT64) + 2 * sizeof(void*))
+             + m_last.bucket_count() * sizeof(void*) + m_tree.size() * sizeof(UINT32);
+    }
+
+private:
+    static const UINT64 MIN_CAPACITY = 1 << 16;
+
+    unordered_map<UINT64, UINT64> m_last;   // line -> 最近一次访问的时间
+    vector<UINT32> m_tree;                  // Fenwick 树, 下标从 1 开始
+    UINT64 m_now;
+
+    void update(UINT64 i, int delta)
+    {
+        for (; i < m_tree.size(); i += i & (~i + 1)) m_tree[i] += delta;
+    }
+
+    UINT64 prefix(UINT64 i)
+    {
+        UINT64 sum = 0;
+        for (; i > 0; i -= i & (~i + 1)) sum += m_tree[i];
+        return sum;
+    }
+
+    // The tree has run out of timestamps: renumber the live ones 1..n in order and
+    // leave as much room again, so compaction is amortized O(log n) per reference
+    void compact()
+    {
+        vector<pair<UINT64, UINT64> > order;
+        order.reserve(m_last.size());
+        for (unordered_map<UINT64, UINT64>::iterator it = m_last.begin(); it != m_last.end(); ++it)
+            order.push_back(std::make_pair(it->second, it->first));
+        std::sort(order.begin(), order.end());
+
+        UINT64 n = order.size();
+        for (UINT64 i = 0; i < n; i++) m_last[order[i].second] = i + 1;
+
+        // Positions 1..n are all marked, so node i covers min(i, n) - min(i - lowbit(i), n) marks
+        m_tree.assign(std::max(2 * n, (UINT64)MIN_CAPACITY) + 1, 0);
+        for (UINT64 i = 1; i < m_tree.size(); i++)
+        {
+            UINT64 low = i - (i & (~i + 1));
+            m_tree[i] = std::min(i, n) - std::min(low, n);
+        }
+        m_now = n;
+    }
+};
+
+// Histogram of stack distances with four buckets per octave. Bucket boundaries are
+// the cache sizes on the curve, so the miss ratio at each of them is exact.
+class StackHistogram
+{
+public:
+    StackHistogram() : m_cold(0), m_total(0) {}
+
+    // weight 不为 1 时用于采样后的缩放
+    void add(UINT64 dist, double weight)
+    {
+        m_total += weight;
+        if (dist == DIST_COLD)
+        {
+            m_cold += weight;
+            return;
+        }
+
+        UINT32 b = bucketOf(dist);
+        if (b >= m_buckets.size()) m_buckets.resize(b + 1, 0);
+        m_buckets[b] += weight;
+    }
+
+    // The smallest distance counted in bucket b, i.e. the cache size in lines it stands for
+    static UINT64 bucketLow(UINT32 b)
+    {
+        if (b < 4) return b;
+        return (UINT64)(4 + (b & 3)) << ((b - 4) / 4);
+    }
+
+    static UINT32 bucketOf(UINT64 dist)
+    {
+        if (dist < 4) return dist;
+        UINT32 k = 63 - __builtin_clzl(dist);
+        return 4 + (k - 2) * 4 + ((dist >> (k - 2)) & 3);
+    }
+
+    UINT32 getBucketNum() { return m_buckets.size(); }
+    double getTotal() { return m_total; }
+    double getCold() { return m_cold; }
+
+    // Miss ratio of a fully associative LRU cache of bucketLow(b) lines
+    double missRatio(UINT32 b)
+    {
+        if (m_total == 0) return 0;
+        double misses = m_cold;
+        for (UINT32 i = b; i < m_buckets.size(); i++) misses += m_buckets[i];
+        return misses / m_total;
+    }
+
+private:
+    vector<double> m_buckets;
+    double m_cold;
+    double m_total;
+};
+
+// Stack distances within the sets of a set-associative LRU cache, up to max_asso.
+// One pass gives the miss ratio of every associativity for this number of sets.
+class SetStackDistance
+{
+public:
+    SetStackDistance(UINT32 log_sets, UINT32 max_asso)
+        : m_sets_log(log_sets), m_max_asso(max_asso), m_total(0)
+    {
+        m_stacks = new UINT64[(1u << log_sets) * max_asso];
+        m_depth = new UINT32[1u << log_sets]();
+        m_hist = new UINT64[max_asso + 1]();
+    }
+
+    ~SetStackDistance()
+    {
+        delete[] m_stacks;
+        delete[] m_depth;
+        delete[] m_hist;
+    }
+
+    void access(UINT64 line)
+    {
+        UINT32 set = line & ((1u << m_sets_log) - 1);
+        UINT64* stack = m_stacks + (UINT64)set * m_max_asso;
+        UINT32& depth = m_depth[set];
+
+        // 栈顶为最近访问的行; 未找到时距离记为 m_max_asso, 即所有相联度下都缺失
+        UINT32 pos = 0;
+        while (pos < depth && stack[pos] != line) pos++;
+        m_hist[pos < depth ? pos : m_max_asso]++;
+        m_total++;
+
+        if (pos == depth)
+        {
+            if (depth < m_max_asso) depth++;
+            pos = depth - 1;
+        }
+        memmove(stack + 1, stack, pos * sizeof(UINT64));
+        stack[0] = line;
+    }
+
+    UINT32 getSetsLog() { return m_sets_log; }
+    UINT32 getMaxAsso() { return m_max_asso; }
+
+    double missRatio(UINT32 asso)
+    {
+        if (m_total == 0) return 0;
+        UINT64 misses = 0;
+        for (UINT32 i = asso; i <= m_max_asso; i++) misses += m_hist[i];
+        return (double)misses / m_total;
+    }
+
+private:
+    UINT32 m_sets_log;
+    UINT32 m_max_asso;
+    UINT64* m_stacks;       // 每组一个按 LRU 顺序排列的行号栈
+    UINT32* m_depth;
+    UINT64* m_hist;         // 组内栈距离的直方图
+    UINT64 m_total;
+};
+
+// Miss-ratio curves of the fully associative cache and of set-associative caches with
+// 2^min_sets_log .. 2^max_sets_log sets, all with LRU and the same block size
+class MissRatioCurve
+{
+public:
+    MissRatioCurve(UINT32 log_block_size, UINT32 min_sets_log, UINT32 max_sets_log, UINT32 max_asso)
+        : m_blksz_log(log_block_size)
+    {
+        for (UINT32 sets_log = min_sets_log; sets_log <= max_sets_log; sets_log++)
+            m_sa.push_back(new SetStackDistance(sets_log, max_asso));
+    }
+
+    ~MissRatioCurve()
+    {
+        for (UINT32 i = 0; i < m_sa.size(); i++) delete m_sa[i];
+    }
+
+    void access(UINT64 mem_addr)
+    {
+        UINT64 line = mem_addr >> m_blksz_log;
+        m_fa_hist.add(m_fa.access(line), 1);
+        for (UINT32 i = 0; i < m_sa.size(); i++) m_sa[i]->access(line);
+    }
+
+    // One row per cache size: model,sets,asso,lines,bytes,miss_ratio
+    void writeCSV(FILE* fp)
+    {
+        fprintf(fp, "model,sets,asso,lines,bytes,miss_ratio\n");
+
+        // 最后一行的容量足以容纳所有行, 只剩冷缺失
+        UINT32 bucket_num = m_fa_hist.getBucketNum();
+        for (UINT32 b = 1; b <= bucket_num; b++)
+        {
+            UINT64 lines = StackHistogram::bucketLow(b);
+            fprintf(fp, "fa,1,%lu,%lu,%lu,%.6f\n", lines, lines, lines << m_blksz_log, m_fa_hist.missRatio(b));
+        }
+
+        for (UINT32 i = 0; i < m_sa.size(); i++)
+        {
+            UINT64 sets = 1ul << m_sa[i]->getSetsLog();
+            for (UINT32 asso = 1; asso <= m_sa[i]->getMaxAsso(); asso++)
+                fprintf(fp, "sa,%lu,%u,%lu,%lu,%.6f\n", sets, asso, sets * asso,
+                        (sets * asso) << m_blksz_log, m_sa[i]->missRatio(asso));
+        }
+    }
+
+    void dumpResults()
+    {
+        printf("\treferences: %.0f,\tdistinct lines: %lu,\tcold miss ratio: %.4f\n",
+               m_fa_hist.getTotal(), m_fa.getLineNum(), m_fa_hist.missRatio(m_fa_hist.getBucketNum()));
+    }
+
+private:
+    UINT32 m_blksz_log;
+    ReuseDistance m_fa;
+    StackHistogram m_fa_hist;
+    vector<SetStackDistance*> m_sa;
+};
+
+// SHARDS: spatially hashed sampling of the fully associative curve for footprints too
+// large to track every line. A line is tracked iff its hash is below the threshold,
+// so a sampled line keeps all of its references and the distances among sampled lines
+// scale by 1/rate. With a line budget, the threshold drops whenever the budget is
+// exceeded, evicting the tracked lines with the largest hashes.
+class SampledReuseDistance
+{
+public:
+    SampledReuseDistance(UINT32 log_block_size, double rate, UINT64 max_lines)
+        : m_blksz_log(log_block_size), m_max_lines(max_lines), m_refs(0), m_sampled(0), m_count_sq(0)
+    {
+        m_threshold = (UINT32)(rate * HASH_MODULUS);
+        if (m_threshold == 0) m_threshold = 1;
+        if (m_threshold > HASH_MODULUS) m_threshold = HASH_MODULUS;
+        m_min_rate = getRate();
+    }
+
+    void access(UINT64 mem_addr)
+    {
+        UINT64 line = mem_addr >> m_blksz_log;
+        m_refs++;
+
+        UINT32 hash = mixHash(line) & (HASH_MODULUS - 1);
+        if (hash >= m_threshold) return;
+
+        double rate = getRate();
+        UINT64 dist = m_rd.access(line);
+        if (dist == DIST_COLD && m_max_lines) m_by_hash.insert(std::make_pair(hash, line));
+        m_hist.add(dist == DIST_COLD ? dist : (UINT64)(dist / rate), 1 / rate);
+        m_sampled += 1 / rate;
+
+        UINT64& count = m_counts[line];
+        m_count_sq += 2 * count + 1;
+        count++;
+
+        while (m_max_lines && m_rd.getLineNum() > m_max_lines) lowerThreshold();
+    }
+
+    // One row per cache size: lines,bytes,miss_ratio
+    void writeCSV(FILE* fp)
+    {
+        StackHistogram hist = adjusted();
+        fprintf(fp, "lines,bytes,miss_ratio\n");
+        for (UINT32 b = 1; b <= hist.getBucketNum(); b++)
+        {
+            UINT64 lines = StackHistogram::bucketLow(b);
+            fprintf(fp, "%lu,%lu,%.6f\n", lines, lines << m_blksz_log, hist.missRatio(b));
+        }
+    }
+
+    void dumpResults()
+    {
+        printf("\treferences: %lu,\tsampled lines: %lu,\tsampling rate: %.6f (lowest %.6f)\n",
+               m_refs, m_rd.getLineNum(), getRate(), m_min_rate);
+        printf("\terror bound: +-%.4f (95%%, any cache size),\tmemory: %.1f KB\n",
+               errorBound(), getMemoryUsage() / 1024.0);
+    }
+
+    double getRate() { return (double)m_threshold / HASH_MODULUS; }
+
+    UINT64 getMemoryUsage()
+    {
+        return m_rd.getMemoryUsage() + m_by_hash.size() * (sizeof(pair<UINT32, UINT64>) + 4 * sizeof(void*))
+             + m_counts.size() * (2 * sizeof(UINT64) + 2 * sizeof(void*)) + m_counts.bucket_count() * sizeof(void*);
+    }
+
+private:
+    static const UINT32 HASH_MODULUS = 1 << 24;
+
+    UINT32 m_blksz_log;
+    UINT32 m_threshold;     // 行号哈希低 24 位小于该值的行被采样
+    UINT64 m_max_lines;     // 0 表示固定采样率
+    double m_min_rate;
+    UINT64 m_refs;
+    double m_sampled;       // 采样引用按 1/rate 放大后的总数
+    UINT64 m_count_sq;      // 各采样行引用次数的平方和
+    unordered_map<UINT64, UINT64> m_counts;
+    ReuseDistance m_rd;
+    StackHistogram m_hist;
+    std::set<pair<UINT32, UINT64> > m_by_hash;
+
+    static UINT64 mixHash(UINT64 x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdul;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ul;
+        x ^= x >> 33;
+        return x;
+    }
+
+    // Drop the threshold to the largest tracked hash and forget the lines at it
+    void lowerThreshold()
+    {
+        m_threshold = m_by_hash.rbegin()->first;
+        while (!m_by_hash.empty() && m_by_hash.rbegin()->first >= m_threshold)
+        {
+            std::set<pair<UINT32, UINT64> >::iterator it = --m_by_hash.end();
+            m_rd.remove(it->second);
+
+            unordered_map<UINT64, UINT64>::iterator count = m_counts.find(it->second);
+            m_count_sq -= count->second * count->second;
+            m_counts.erase(count);
+
+            m_by_hash.erase(it);
+        }
+        if (getRate() < m_min_rate) m_min_rate = getRate();
+    }
+
+    // SHARDS-adj: the scaled sample rarely adds up to the real number of references,
+    // and the difference is credited to the smallest distance
+    StackHistogram adjusted()
+    {
+        StackHistogram hist = m_hist;
+        hist.add(0, m_refs - m_sampled);
+        return hist;
+    }
+
+    // 95% bound of every miss ratio on the curve. Lines are sampled independently
+    // with probability R, so the scaled miss count of a size has the variance
+    // (1 - R) / R^2 * sum(m_i^2) over the sampled lines, where m_i is the misses of
+    // line i at that size and never exceeds its reference count c_i.
+    double errorBound()
+    {
+        if (m_refs == 0) return 1;
+        double rate = getRate();
+        return 1.96 * sqrt((1 - rate) * m_count_sq) / rate / m_refs;
+    }
+};
+
+// Build the curves from "min_sets_log,max_sets_log", NULL if malformed
+inline MissRatioCurve* newMissRatioCurve(UINT32 blksz_log, const string& sets_spec, UINT32 max_asso)
+{
+    UINT32 min_log, max_log;
+    if (sscanf(sets_spec.c_str(), "%u,%u", &min_log, &max_log) != 2) return NULL;
+    if (min_log > max_log || max_log > 24 || max_asso == 0) return NULL;
+    return new MissRatioCurve(blksz_log, min_log, max_log, max_asso);
+}
+
+// Build the sampled curve, NULL if the rate is outside (0, 1]
+inline SampledReuseDistance* newSampledReuseDistance(UINT32 blksz_log, double rate, UINT64 max_lines)
+{
+    if (!(rate > 0 && rate <= 1)) return NULL;
+    return new SampledReuseDistance(blksz_log, rate, max_lines);
+}
+
+/**************************************
+ * Miss Attribution
+ *
+ * Charges every access of one cache model to the PC of the memory
+ * instruction and to the call site of the live heap allocation that
+ * contains the address, then reports the top offenders of both.
+**************************************/
+struct MissCounter
+{
+    UINT64 accesses;
+    UINT64 misses;
+};
+
+class MissAttribution
+{
+public:
+    MissAttribution()
+    {
+        memset(&m_other, 0, sizeof(m_other));
+    }
+
+    void addAllocation(UINT64 start, UINT64 size, UINT64 site)
+    {
+        if (size == 0) return;
+        Allocation& alloc = m_live[start];
+        alloc.end = start + size;
+        alloc.site = site;
+
+        SiteStats& stats = m_by_site[site];
+        stats.allocs++;
+        stats.bytes += size;
+    }
+
+    void removeAllocation(UINT64 start) { m_live.erase(start); }
+
+    void record(UINT64 pc, UINT64 addr, bool hit)
+    {
+        MissCounter& inst = m_by_pc[pc];
+        inst.accesses++;
+        inst.misses += !hit;
+
+        // 找到起始地址不大于 addr 的最后一个分配, 再检查 addr 是否落在其中
+        MissCounter* data = &m_other;
+        std::map<UINT64, Allocation>::iterator it = m_live.upper_bound(addr);
+        if (it != m_live.begin() && addr < (--it)->second.end)
+            data = &m_by_site[it->second.site].counter;
+        data->accesses++;
+        data->misses += !hit;
+    }
+
+    // describe turns a PC or a call site into a readable location, it may be NULL
+    void dumpResults(UINT32 top_n, string (*describe)(UINT64))
+    {
+        UINT64 total = m_other.misses;
+        for (unordered_map<UINT64, SiteStats>::iterator it = m_by_site.begin(); it != m_by_site.end(); ++it)
+            total += it->second.counter.misses;
+
+        vector<pair<UINT64, UINT64> > pcs = topByMisses(m_by_pc, top_n);
+        printf("\ttop %lu of %lu instructions by misses:\n", pcs.size(), m_by_pc.size());
+        for (UINT32 i = 0; i < pcs.size(); i++)
+        {
+            MissCounter& c = m_by_pc[pcs[i].second];
+            printf("\t%#14lx  misses: %lu (%.2f%%),\taccesses: %lu,\tmiss rate: %.2f%%\t%s\n",
+                   pcs[i].second, c.misses, share(c.misses, total), c.accesses, share(c.misses, c.accesses),
+                   describe ? describe(pcs[i].second).c_str() : "");
+        }
+
+        unordered_map<UINT64, MissCounter> sites;
+        for (unordered_map<UINT64, SiteStats>::iterator it = m_by_site.begin(); it != m_by_site.end(); ++it)
+            sites[it->first] = it->second.counter;
+
+        vector<pair<UINT64, UINT64> > top = topByMisses(sites, top_n);
+        printf("\ttop %lu of %lu allocation sites by misses:\n", top.size(), m_by_site.size());
+        for (UINT32 i = 0; i < top.size(); i++)
+        {
+            SiteStats& st = m_by_site[top[i].second];
+            printf("\t%#14lx  misses: %lu (%.2f%%),\taccesses: %lu,\tmiss rate: %.2f%%,\t%lu allocations, %lu bytes\t%s\n",
+                   top[i].second, st.counter.misses, share(st.counter.misses, total), st.counter.accesses,
+                   share(st.counter.misses, st.counter.accesses), st.allocs, st.bytes,
+                   describe ? describe(top[i].second).c_str() : "");
+        }
+
+        printf("\toutside live heap allocations (stack, static data, freed memory):\n");
+        printf("\t%14s  misses: %lu (%.2f%%),\taccesses: %lu,\tmiss rate: %.2f%%\n", "", m_other.misses,
+               share(m_other.misses, total), m_other.accesses, share(m_other.misses, m_other.accesses));
+    }
+
+private:
+    struct Allocation
+    {
+        UINT64 end;
+        UINT64 site;
+    };
+
+    struct SiteStats
+    {
+        MissCounter counter;
+        UINT64 allocs;      // 该调用点分配的次数与总字节数
+        UINT64 bytes;
+    };
+
+    std::map<UINT64, Allocation> m_live;            // 起始地址 -> 存活的分配
+    unordered_map<UINT64, MissCounter> m_by_pc;
+    unordered_map<UINT64, SiteStats> m_by_site;
+    MissCounter m_other;
+
+    static double share(UINT64 part, UINT64 whole) { return whole ? 100.0 * part / whole : 0; }
+
+    // Return (misses, key) of the top_n keys with the most misses, most first
+    static vector<pair<UINT64, UINT64> > topByMisses(unordered_map<UINT64, MissCounter>& counters, UINT32 top_n)
+    {
+        vector<pair<UINT64, UINT64> > order;
+        for (unordered_map<UINT64, MissCounter>::iterator it = counters.begin(); it != counters.end(); ++it)
+            if (it->second.misses) order.push_back(std::make_pair(it->second.misses, it->first));
+
+        UINT32 n = order.size() < top_n ? order.size() : top_n;
+        std::partial_sort(order.begin(), order.begin() + n, order.end(), std::greater<pair<UINT64, UINT64> >());
+        order.resize(n);
+        return order;
+    }
+};
+
+/**************************************
+ * Multi-Core Coherence
+ *
+ * One private set-associative L1 per core behind a full-map directory
+ * running MESI or MOESI. A coherence miss is a miss on a line whose copy
+ * this core lost to another core's write. When the write that caused it
+ * touched no byte the missing access touches, the miss is false sharing
+ * and is recorded per line with both PCs.
+**************************************/
+enum CoherenceProtocol { COH_MESI, COH_MOESI };
+
+struct CoreStats
+{
+    UINT64 reads;
+    UINT64 writes;
+    UINT64 misses;
+    UINT64 coherence_misses;    // 副本曾被其它核的写作废
+    UINT64 upgrades;            // 写 S/O 状态的行, 需作废其它副本
+    UINT64 invalidations;       // 被其它核作废的副本数
+    UINT64 downgrades;          // M/E 被其它核的读降级
+    UINT64 writebacks;
+};
+
+class CoherentCaches
+{
+public:
+    static const UINT32 MAX_CORES = 64;
+
+    CoherentCaches(UINT32 cores, const string& policy, UINT32 log_sets, UINT32 log_block_size,
+                   UINT32 asso, CoherenceProtocol protocol)
+        : m_cores(cores), m_blksz_log(log_block_size), m_protocol(protocol), m_transfers(0)
+    {
+        for (UINT32 i = 0; i < cores; i++)
+            m_l1.push_back(newCacheModel<SetAssoCache>(policy, log_sets, log_block_size, asso));
+        m_stats = new CoreStats[cores]();
+
+        // 每个掩码位代表的字节数, 使 64 位掩码覆盖一整行
+        m_grain_log = log_block_size > 6 ? log_block_size - 6 : 0;
+    }
+
+    ~CoherentCaches()
+    {
+        for (UINT32 i = 0; i < m_cores; i++) delete m_l1[i];
+        delete[] m_stats;
+    }
+
+    // An access of core to [addr, addr + size), all within one line
+    void access(UINT32 core, UINT64 pc, UINT64 addr, UINT32 size, bool is_write)
+    {
+        UINT64 line = addr >> m_blksz_log;
+        UINT64 bit = 1ul << core;
+        UINT64 mask = byteMask(addr, size);
+        DirEntry& e = entry(line);
+        CoreStats& st = m_stats[core];
+
+        bool present = m_l1[core]->probe(addr, false);
+        if (!present) recordMiss(core, line, e, pc, mask);
+
+        if (!is_write)
+        {
+            st.reads++;
+            if (present) return;
+
+            if (e.owner >= 0)
+            {
+                // 由持有者提供数据; MESI 下脏行同时写回内存, MOESI 下持有者转为 O 继续持有脏数据
+                m_transfers++;
+                m_stats[e.owner].downgrades++;
+                if (e.dirty && m_protocol == COH_MESI)
+                {
+                    m_stats[e.owner].writebacks++;
+                    e.dirty = false;
+                }
+                if (!e.dirty) e.owner = -1;
+            }
+
+            e.sharers |= bit;
+            if (e.sharers == bit) e.owner = core;      // E
+            fillLine(core, addr);
+            return;
+        }
+
+        st.writes++;
+        if (present && e.sharers == bit)
+        {
+            // E -> M 或已是 M, 无需总线事务
+            e.owner = core;
+            e.dirty = true;
+        }
+        else
+        {
+            if (present) st.upgrades++;
+            else if (e.owner >= 0 && e.owner != (INT32)core) m_transfers++;
+
+            invalidateOthers(core, addr, e);
+            if (!present) fillLine(core, addr);
+            e.sharers = bit;
+            e.owner = core;
+            e.dirty = true;
+        }
+
+        if (e.last_writer != (INT32)core)
+        {
+            e.last_writer = core;
+            e.written = 0;
+        }
+        e.written |= mask;
+        e.writer_pc = pc;
+    }
+
+    void dumpResults(UINT32 top_n, string (*describe)(UINT64))
+    {
+        CoreStats total;
+        memset(&total, 0, sizeof(total));
+
+        printf("\t%s, %u cores, %u KB private L1 each\n", m_protocol == COH_MESI ? "MESI" : "MOESI",
+               m_cores, (m_l1[0]->getBlockNum() << m_blksz_log) >> 10);
+        for (UINT32 i = 0; i < m_cores; i++)
+        {
+            CoreStats& c = m_stats[i];
+            if (c.reads + c.writes == 0) continue;
+            printf("\tcore %u:\t", i);
+            dumpCore(c);
+
+            total.reads += c.reads;
+            total.writes += c.writes;
+            total.misses += c.misses;
+            total.coherence_misses += c.coherence_misses;
+            total.upgrades += c.upgrades;
+            total.invalidations += c.invalidations;
+            total.downgrades += c.downgrades;
+            total.writebacks += c.writebacks;
+        }
+        printf("\ttotal:\t");
+        dumpCore(total);
+        printf("\tcache-to-cache transfers: %lu\n", m_transfers);
+
+        // 按伪共享缺失次数排序
+        vector<pair<UINT64, UINT64> > order;
+        for (unordered_map<UINT64, SharingStats>::iterator it = m_sharing.begin(); it != m_sharing.end(); ++it)
+            if (it->second.false_misses) order.push_back(std::make_pair(it->second.false_misses, it->first));
+        UINT32 n = order.size() < top_n ? order.size() : top_n;
+        std::partial_sort(order.begin(), order.begin() + n, order.end(), std::greater<pair<UINT64, UINT64> >());
+
+        printf("\tfalse sharing: %lu lines, top %u:\n", (UINT64)order.size(), n);
+        for (UINT32 i = 0; i < n; i++)
+        {
+            SharingStats& fs = m_sharing[order[i].second];
+            printf("\tline %#lx:\tfalse sharing misses: %lu,\ttrue sharing misses: %lu\n",
+                   order[i].second << m_blksz_log, fs.false_misses, fs.true_misses);
+
+            // 每行列出最多 3 对 (缺失的访问, 造成作废的写)
+            vector<pair<UINT64, pair<UINT64, UINT64> > > pcs;
+            for (std::map<pair<UINT64, UINT64>, UINT64>::iterator it = fs.pcs.begin(); it != fs.pcs.end(); ++it)
+                pcs.push_back(std::make_pair(it->second, it->first));
+            UINT32 m = pcs.size() < 3 ? pcs.size() : 3;
+            std::partial_sort(pcs.begin(), pcs.begin() + m, pcs.end(),
+                              std::greater<pair<UINT64, pair<UINT64, UINT64> > >());
+            for (UINT32 j = 0; j < m; j++)
+            {
+                UINT64 pc = pcs[j].second.first, writer = pcs[j].second.second;
+                printf("\t\t%lu x  %#lx %s  after write by  %#lx %s\n", pcs[j].first,
+                       pc, describe ? describe(pc).c_str() : "", writer, describe ? describe(writer).c_str() : "");
+            }
+        }
+    }
+
+private:
+    struct DirEntry
+    {
+        UINT64 sharers;     // 持有副本的核
+        UINT64 lost;        // 副本被其它核的写作废且尚未重新取回的核
+        INT32 owner;        // M/E/O 状态的核, -1 表示没有
+        bool dirty;         // owner 的副本比内存新 (M 或 O)
+        INT32 last_writer;  // 最近写该行的核, 及其自取得该行以来写过的字节
+        UINT64 written;
+        UINT64 writer_pc;
+    };
+
+    struct SharingStats
+    {
+        UINT64 false_misses;
+        UINT64 true_misses;
+        std::map<pair<UINT64, UINT64>, UINT64> pcs;    // (缺失的 PC, 写者的 PC) -> 次数
+    };
+
+    UINT32 m_cores;
+    UINT32 m_blksz_log;
+    UINT32 m_grain_log;
+    CoherenceProtocol m_protocol;
+    vector<CacheModel*> m_l1;
+    CoreStats* m_stats;
+    UINT64 m_transfers;
+    unordered_map<UINT64, DirEntry> m_dir;
+    unordered_map<UINT64, SharingStats> m_sharing;
+
+    DirEntry& entry(UINT64 line)
+    {
+        unordered_map<UINT64, DirEntry>::iterator it = m_dir.find(line);
+        if (it != m_dir.end()) return it->second;
+
+        DirEntry& e = m_dir[line];
+        memset(&e, 0, sizeof(e));
+        e.owner = -1;
+        e.last_writer = -1;
+        return e;
+    }
+
+    UINT64 byteMask(UINT64 addr, UINT32 size)
+    {
+        UINT32 offset = addr & ((1u << m_blksz_log) - 1);
+        UINT32 first = offset >> m_grain_log, last = (offset + size - 1) >> m_grain_log;
+        UINT64 upto = (last == 63) ? ~0ul : (1ul << (last + 1)) - 1;
+        return upto & ~((1ul << first) - 1);
+    }
+
+    void recordMiss(UINT32 core, UINT64 line, DirEntry& e, UINT64 pc, UINT64 mask)
+    {
+        UINT64 bit = 1ul << core;
+        m_stats[core].misses++;
+        if (!(e.lost & bit)) return;
+
+        e.lost &= ~bit;
+        m_stats[core].coherence_misses++;
+        if (e.last_writer < 0 || e.last_writer == (INT32)core) return;
+
+        SharingStats& fs = m_sharing[line];
+        if (mask & e.written)
+        {
+            fs.true_misses++;
+            return;
+        }
+        fs.false_misses++;
+        fs.pcs[std::make_pair(pc, e.writer_pc)]++;
+    }
+
+    void invalidateOthers(UINT32 core, UINT64 addr, DirEntry& e)
+    {
+        UINT64 others = e.sharers & ~(1ul << core);
+        for (UINT32 i = 0; others; i++, others >>= 1)
+        {
+            if (!(others & 1)) continue;
+
+            bool was_dirty;
+            m_l1[i]->invalidate(addr, was_dirty);
+            m_stats[i].invalidations++;
+            e.lost |= 1ul << i;
+        }
+    }
+
+    // Fill addr into core's L1 and drop the evicted line from the directory
+    void fillLine(UINT32 core, UINT64 addr)
+    {
+        UINT64 victim_addr;
+        bool victim_dirty;
+        if (!m_l1[core]->fill(addr, false, victim_addr, victim_dirty)) return;
+
+        DirEntry& v = entry(victim_addr >> m_blksz_log);
+        v.sharers &= ~(1ul << core);
+        if (v.owner == (INT32)core)
+        {
+            if (v.dirty) m_stats[core].writebacks++;
+            v.owner = -1;
+            v.dirty = false;
+        }
+    }
+
+    static void dumpCore(CoreStats& c)
+    {
+        UINT64 accesses = c.reads + c.writes;
+        printf("reads: %lu,\twrites: %lu,\tmisses: %lu (%.2f%%),\tcoherence misses: %lu,\t"
+               "upgrades: %lu,\tinvalidated: %lu,\tdowngraded: %lu,\twritebacks: %lu\n",
+               c.reads, c.writes, c.misses, accesses ? 100.0 * c.misses / accesses : 0, c.coherence_misses,
+               c.upgrades, c.invalidations, c.downgrades, c.writebacks);
+    }
+};
+
+/**************************************
+ * Sampled Estimates
+ *
+ * With SMARTS-style sampling only short windows of the run are measured.
+ * Each window gives one sample of a ratio such as the hit rate, and the
+ * spread of the samples bounds the error of their mean: by the central
+ * limit theorem the true value lies within mean +- 1.96 * s / sqrt(n)
+ * with 95% confidence.
+**************************************/
+class SampledRatio
+{
+public:
+    SampledRatio() : m_n(0), m_sum(0), m_sumsq(0), m_hits(0), m_reqs(0) {}
+
+    // Add the window that saw hits out of reqs
+    void add(UINT64 hits, UINT64 reqs)
+    {
+        if (reqs == 0) return;
+
+        double r = (double)hits / reqs;
+        m_n++;
+        m_sum += r;
+        m_sumsq += r * r;
+        m_hits += hits;
+        m_reqs += reqs;
+    }
+
+    UINT64 getSamples() { return m_n; }
+    double mean() { return m_n ? m_sum / m_n : 0; }
+
+    double stddev()
+    {
+        if (m_n < 2) return 0;
+        double var = (m_sumsq - m_sum * m_sum / m_n) / (m_n - 1);
+        return var > 0 ? sqrt(var) : 0;
+    }
+
+    // Half width of the 95% confidence interval of mean()
+    double ci95() { return m_n ? 1.96 * stddev() / sqrt((double)m_n) : 0; }
+
+    // Samples needed for a 95% confidence interval of +-error
+    UINT64 samplesFor(double error)
+    {
+        double n = 1.96 * stddev() / error;
+        return (UINT64)ceil(n * n);
+    }
+
+    void dumpResults(const char* name)
+    {
+        printf("\t%s:\thit rate: %.2f%% +- %.2f%% (95%% confidence),\tsamples: %lu,\t"
+               "stddev: %.2f%%,\tsamples for +-1%%: %lu,\tmeasured: %lu hits of %lu\n",
+               name, 100 * mean(), 100 * ci95(), m_n, 100 * stddev(), samplesFor(0.01), m_hits, m_reqs);
+    }
+
+private:
+    UINT64 m_n;
+    double m_sum;
+    double m_sumsq;
+    UINT64 m_hits;
+    UINT64 m_reqs;
+};
+
+#endif // CACHE_MODEL_H
@@ -0,0 +1,408 @@
+/*
+ * Standalone cache simulator replaying a trace recorded by cacheModel -trace_out,
+ * with the same models, options and report as the Pin tool.
+ *
+ * Build: g++ -O2 -std=c++11 -o cacheReplay cacheReplay.cpp
+ * Usage: cacheReplay [-n 512] [-b 6] [-r 7] [-a 4] [-p lru] [-hier 1] [-tlb 1] ... <trace file>
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cacheModel.h"
+#include "memTrace.h"
+
+// Tell the kernel to read this far ahead of the decoder
+#define PREFETCH_WINDOW     (64ul << 20)
+#define PREFETCH_STEP       (16ul << 20)
+
+struct Option
+{
+    const char* name;
+    string value;
+    const char* desc;
+};
+
+// 与 cacheModel 的 knob 同名同默认值
+Option options[] = {
+    { "n",      "512",              "the number of blocks of the fully associative cache" },
+    { "b",      "6",                "the log of the block size in bytes" },
+    { "r",      "7",                "the log of the number of rows" },
+    { "a",      "4",                "the associativity" },
+    { "p",      "lru",              "the replacement policy: lru, plru, nru, srrip, brrip, drrip, random or fifo" },
+    { "3c",     "0",                "classify the misses of the set-associative caches as compulsory, capacity or conflict" },
+    { "synonym", "none",            "on a miss to a line resident under another virtual address: none, invalidate, rmap or ptag" },
+    { "org",    "",                 "also simulate these set organizations: xor, prime, skew (LRU only) or v<N>, comma separated" },
+    { "hier",   "0",                "also simulate the L1I/L1D/L2/LLC hierarchy" },
+    { "l1i",    "6,8,wb,wa,nine",   "L1I as log_sets,asso,wb|wt,wa|nwa,nine|incl|excl[,prefetcher][,organization]" },
+    { "l1d",    "6,8,wb,wa,nine",   "L1D as log_sets,asso,wb|wt,wa|nwa,nine|incl|excl[,prefetcher][,organization]" },
+    { "l2",     "10,8,wb,wa,nine",  "L2 as log_sets,asso,wb|wt,wa|nwa,nine|incl|excl[,prefetcher][,organization]" },
+    { "llc",    "13,16,wb,wa,incl", "the LLC as log_sets,asso,wb|wt,wa|nwa,nine|incl|excl[,prefetcher][,organization]" },
+    { "timing", "0",                "estimate AMAT and memory-stall cycles of the hierarchy (with -hier)" },
+    { "lat",    "4,4,10,26",        "the lookup latencies of L1I,L1D,L2,LLC" },
+    { "mshrs",  "8,16,32,64",       "the MSHRs of L1I,L1D,L2,LLC" },
+    { "mem",    "160,16",           "the memory latency and bandwidth in bytes per cycle" },
+    { "palloc", "",                 "map pages on first touch with this allocator: buddy, random or color; the hierarchy is then physically addressed" },
+    { "color_bits", "0",            "the log of the number of page colors, 0 to derive it from the LLC (with -hier) or -r and -b" },
+    { "thp",    "0",                "promote a 2 MB region to a huge page once this many of its 4 KB pages are touched, 0 to disable" },
+    { "tlb",    "0",                "also simulate the dTLB/STLB and the page walker" },
+    { "page",   "12",               "the log of the page size backing all data without -palloc: 12, 21 or 30" },
+    { "dtlb4k", "64,4",             "the L1 dTLB array for 4 KB pages" },
+    { "dtlb2m", "32,4",             "the L1 dTLB array for 2 MB pages" },
+    { "dtlb1g", "4,4",              "the L1 dTLB array for 1 GB pages" },
+    { "stlb",   "1024,8",           "the STLB array shared by 4 KB and 2 MB pages" },
+    { "stlb1g", "16,4",             "the STLB array for 1 GB pages" },
+    { "pwc",    "2,4,32",           "the page walk cache entries for PML4E,PDPTE,PDE, 0 for none" },
+    { "mrc",    "",                 "write the LRU miss-ratio curves of every cache size to this CSV file" },
+    { "mrc_sets", "4,13",           "the range of log_sets of the set-associative curves" },
+    { "mrc_asso", "16",             "the largest associativity of the set-associative curves" },
+    { "shards", "",                 "write the sampled fully associative LRU miss-ratio curve to this CSV file" },
+    { "shards_rate", "0.01",        "the initial fraction of lines sampled" },
+    { "shards_lines", "65536",      "lower the rate to track at most this many lines, 0 for a fixed rate" },
+};
+
+const UINT32 OPTION_NUM = sizeof(options) / sizeof(options[0]);
+
+Option* findOption(const char* name)
+{
+    for (UINT32 i = 0; i < OPTION_NUM; i++)
+        if (strcmp(options[i].name, name) == 0) return &options[i];
+    return NULL;
+}
+
+const string& optStr(const char* name) { return findOption(name)->value; }
+UINT32 optInt(const char* name) { return strtoul(optStr(name).c_str(), NULL, 0); }
+
+void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [options] <trace file>\n", prog);
+    for (UINT32 i = 0; i < OPTION_NUM; i++)
+        fprintf(stderr, "  -%-8s %-18s %s\n", options[i].name, options[i].value.c_str(), options[i].desc);
+}
+
+const char* model_names[] = {
+    "Fully Associative Cache",
+    "Set-Associative Cache",
+    "Set-Associative Cache (VIVT)",
+    "Set-Associative Cache (PIPT)",
+    "Set-Associative Cache (VIPT)",
+};
+
+const UINT32 MODEL_NUM = sizeof(model_names) / sizeof(model_names[0]);
+
+CacheModel* models[MODEL_NUM];
+vector<CacheModel*> org_models;
+vector<string> org_names;
+CacheHierarchy* hierarchy;
+MMU* mmu;
+MissRatioCurve* mrc;
+SampledReuseDistance* shards;
+UINT32 line_size_log;
+
+// Split a reference into lines and feed every model, as cacheModel does online
+inline void replayRef(const TraceRecord& rec)
+{
+    UINT64 end = rec.addr + rec.size;
+    for (UINT64 addr = rec.addr, next; addr < end; addr = next)
+    {
+        next = lineChunkEnd(addr, end, line_size_log);
+        UINT32 size = next - addr;
+
+        if (rec.type == REF_FETCH)
+        {
+            if (hierarchy) hierarchy->fetchInst(get_hier_addr(addr), size);
+            continue;
+        }
+
+        if (mmu) mmu->translate(addr);
+        if (mrc) mrc->access(addr);
+        if (shards) shards->access(addr);
+
+        bool is_write = (rec.type == REF_WRITE);
+        for (UINT32 i = 0; i < MODEL_NUM; i++)
+        {
+            if (is_write) models[i]->writeReq(addr, size);
+            else models[i]->readReq(addr, size);
+        }
+        for (size_t i = 0; i < org_models.size(); i++)
+        {
+            if (is_write) org_models[i]->writeReq(addr, size);
+            else org_models[i]->readReq(addr, size);
+        }
+
+        if (hierarchy)
+        {
+            if (is_write) hierarchy->write(get_hier_addr(addr), size, rec.pc);
+            else hierarchy->read(get_hier_addr(addr), size, rec.pc);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            path = argv[i];
+            continue;
+        }
+
+        Option* opt = findOption(argv[i] + 1);
+        if (opt == NULL || i + 1 >= argc)
+        {
+            usage(argv[0]);
+            return -1;
+        }
+        opt->value = argv[++i];
+    }
+
+    if (path == NULL)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    string policy = optStr("p");
+    line_size_log = optInt("b");
+
+    // 踪迹中没有 fork, 地址空间始终只有一个, 无需 -ctx
+    SynonymPolicy syn_policy;
+    if (!parseSynonymPolicy(optStr("synonym"), syn_policy))
+    {
+        fprintf(stderr, "Malformed synonym policy, expected none, invalidate, rmap or ptag\n");
+        return -1;
+    }
+
+    models[0] = newCacheModel<FullAssoCache>(policy, optInt("n"), line_size_log);
+    models[1] = newCacheModel<SetAssoCache>(policy, optInt("r"), line_size_log, optInt("a"));
+    models[2] = newCacheModel<SetAssoCache_VIVT>(policy, optInt("r"), line_size_log, optInt("a"), CTX_FLUSH, syn_policy);
+    models[3] = newCacheModel<SetAssoCache_PIPT>(policy, optInt("r"), line_size_log, optInt("a"));
+    models[4] = newCacheModel<SetAssoCache_VIPT>(policy, optInt("r"), line_size_log, optInt("a"), CTX_FLUSH, syn_policy);
+
+    if (models[0] == NULL)
+    {
+        fprintf(stderr, "Unknown replacement policy: %s\n", policy.c_str());
+        return -1;
+    }
+
+    if (optInt("3c"))
+    {
+        for (UINT32 i = 0; i < MODEL_NUM; i++) models[i]->enableMissClassification();
+    }
+
+    org_names = splitList(optStr("org"));
+    for (size_t i = 0; i < org_names.size(); i++)
+    {
+        CacheModel* cache = newCacheOrganization(policy, org_names[i], optInt("r"), line_size_log, optInt("a"));
+        if (cache == NULL)
+        {
+            fprintf(stderr, "Malformed organization %s, expected xor, prime, skew (with -p lru only) or v<N>\n", org_names[i].c_str());
+            return -1;
+        }
+
+        cache->enableMissClassification();
+        models[1]->enableMissClassification();
+        org_models.push_back(cache);
+    }
+
+    if (optInt("hier"))
+    {
+        hierarchy = newCacheHierarchy(policy, line_size_log, optStr("l1i"), optStr("l1d"), optStr("l2"), optStr("llc"));
+        if (hierarchy == NULL)
+        {
+            fprintf(stderr, "Malformed cache level, expected log_sets,asso,wb|wt,wa|nwa,nine|incl|excl"
+                            "[,nextline|stride|stream|bo][,xor|prime|skew][,v<N>], skew with -p lru only\n");
+            return -1;
+        }
+
+        if (optInt("timing") && !hierarchy->setTiming(optStr("lat"), optStr("mshrs"), optStr("mem")))
+        {
+            fprintf(stderr, "Malformed timing, expected l1i,l1d,l2,llc latencies and MSHRs, and latency,bytes_per_cycle of memory\n");
+            return -1;
+        }
+    }
+
+    if (!optStr("palloc").empty())
+    {
+        UINT32 color_bits = optInt("color_bits"), llc_log_sets;
+        if (color_bits == 0 && optInt("hier") && sscanf(optStr("llc").c_str(), "%u", &llc_log_sets) == 1)
+            color_bits = get_color_bits(llc_log_sets, line_size_log);
+        else if (color_bits == 0)
+            color_bits = get_color_bits(optInt("r"), line_size_log);
+
+        page_allocator = newPageAllocator(optStr("palloc"), color_bits, optInt("thp"));
+        if (page_allocator == NULL)
+        {
+            fprintf(stderr, "Malformed page allocation, expected -palloc buddy|random|color and -thp 0..512\n");
+            return -1;
+        }
+    }
+
+    if (optInt("tlb"))
+    {
+        mmu = newMMU(optInt("page"), optStr("pwc"), optStr("dtlb4k"), optStr("dtlb2m"),
+                     optStr("dtlb1g"), optStr("stlb"), optStr("stlb1g"));
+        if (mmu == NULL)
+        {
+            fprintf(stderr, "Malformed TLB configuration, expected power-of-two entries,asso arrays\n");
+            return -1;
+        }
+    }
+
+    if (!optStr("mrc").empty())
+    {
+        mrc = newMissRatioCurve(line_size_log, optStr("mrc_sets"), optInt("mrc_asso"));
+        if (mrc == NULL)
+        {
+            fprintf(stderr, "Malformed miss-ratio curve configuration, expected min_log_sets,max_log_sets\n");
+            return -1;
+        }
+    }
+
+    if (!optStr("shards").empty())
+    {
+        shards = newSampledReuseDistance(line_size_log, atof(optStr("shards_rate").c_str()),
+                                         strtoull(optStr("shards_lines").c_str(), NULL, 0));
+        if (shards == NULL)
+        {
+            fprintf(stderr, "The sampling rate must be in (0, 1]\n");
+            return -1;
+        }
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "Cannot open the trace file %s\n", path);
+        return -1;
+    }
+
+    size_t len = st.st_size;
+    void* data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map the trace file %s\n", path);
+        return -1;
+    }
+
+    TraceReader reader((const UINT8*)data, len);
+    if (!reader.isValid())
+    {
+        fprintf(stderr, "%s is not a trace written by cacheModel -trace_out\n", path);
+        return -1;
+    }
+
+    // 顺序读取: 让内核加大预读, 并在解码位置之前滚动地提示下一段
+    madvise(data, len, MADV_SEQUENTIAL);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t hinted = 0;
+
+    TraceRecord rec;
+    UINT64 replayed = 0;
+    while (reader.next(rec))
+    {
+        replayRef(rec);
+        replayed++;
+
+        if ((replayed & 0xffff) == 0 && hinted < len && reader.getOffset() + PREFETCH_WINDOW - PREFETCH_STEP >= hinted)
+        {
+            size_t upto = (reader.getOffset() + PREFETCH_WINDOW) & ~(size_t)(page_size - 1);
+            if (upto > len) upto = len;
+            madvise((char*)data + hinted, upto - hinted, MADV_WILLNEED);
+            hinted = upto;
+        }
+    }
+
+    const TraceHeader& header = reader.getHeader();
+    if (replayed != header.ref_count)
+        fprintf(stderr, "Warning: replayed %lu of the %lu references in the trace\n", replayed, header.ref_count);
+
+    printf("\nTrace: %s, %lu references, %lu instructions\n", path, replayed, header.inst_count);
+    printf("\nReplacement policy: %s\n", policy.c_str());
+
+    for (UINT32 i = 0; i < MODEL_NUM; i++)
+    {
+        printf("\n%s:\n", model_names[i]);
+        models[i]->dumpResults();
+    }
+
+    for (size_t i = 0; i < org_models.size(); i++)
+    {
+        printf("\nSet-Associative Cache (%s):\n", org_names[i].c_str());
+        org_models[i]->dumpResults();
+        dumpConflictReduction(org_models[i], models[1]);
+        delete org_models[i];
+    }
+
+    for (UINT32 i = 0; i < MODEL_NUM; i++) delete models[i];
+
+    if (page_allocator)
+    {
+        printf("\nPage Allocation:\n");
+        page_allocator->dumpResults();
+        delete page_allocator;
+        page_allocator = NULL;
+    }
+
+    if (mmu)
+    {
+        printf("\nTLB:");
+        mmu->dumpResults(header.inst_count);
+        delete mmu;
+    }
+
+    if (hierarchy)
+    {
+        printf("\nCache Hierarchy:\n");
+        hierarchy->dumpResults(line_size_log, header.inst_count);
+        delete hierarchy;
+    }
+
+    if (mrc)
+    {
+        printf("\nMiss-Ratio Curves:\n");
+        mrc->dumpResults();
+
+        FILE* fp = fopen(optStr("mrc").c_str(), "w");
+        if (fp)
+        {
+            mrc->writeCSV(fp);
+            fclose(fp);
+            printf("\tcurves written to %s\n", optStr("mrc").c_str());
+        }
+        else
+        {
+            fprintf(stderr, "Cannot create %s\n", optStr("mrc").c_str());
+        }
+        delete mrc;
+    }
+
+    if (shards)
+    {
+        printf("\nSampled Miss-Ratio Curve:\n");
+        shards->dumpResults();
+
+        FILE* fp = fopen(optStr("shards").c_str(), "w");
+        if (fp)
+        {
+            shards->writeCSV(fp);
+            fclose(fp);
+            printf("\tcurve written to %s\n", optStr("shards").c_str());
+        }
+        else
+        {
+            fprintf(stderr, "Cannot create %s\n", optStr("shards").c_str());
+        }
+        delete shards;
+    }
+
+    munmap(data, len);
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Compact binary memory-reference trace, written by cacheModel -trace_out and
+ * replayed by cacheReplay.
+ *
+ * The file starts with a TraceHeader, followed by one record per reference:
+ *   UINT8   head:   bits 0-1 the RefType, bits 2-4 the log of the size (7 means an
+ *                   explicit size follows), bit 5 set if a PC follows
+ *   varint  zigzag delta of the address from the previous reference of the same
+ *           stream (data, or instruction fetch)
+ *   varint  the size, only when it is not a power of two up to 64 bytes
+ *   varint  zigzag delta of the PC from the previous PC, only if bit 5 is set
+ */
+#ifndef MEM_TRACE_H
+#define MEM_TRACE_H
+
+#include "cacheModel.h"
+
+enum RefType { REF_READ, REF_WRITE, REF_FETCH };
+
+#define TRACE_MAGIC         0x4352544d      // "MTRC"
+#define TRACE_VERSION       1
+#define TRACE_HAS_PC        0x1
+
+#define TRACE_SIZE_EXPLICIT 7
+#define TRACE_PC_BIT        0x20
+
+struct TraceHeader
+{
+    UINT32 magic;
+    UINT32 version;
+    UINT32 flags;
+    UINT32 reserved;
+    UINT64 inst_count;      // Instructions executed while the trace was recorded
+    UINT64 ref_count;       // The number of records
+};
+
+// One decoded reference
+struct TraceRecord
+{
+    UINT64 addr;
+    UINT64 pc;              // 0 if the trace has no PCs
+    UINT32 size;
+    UINT32 type;
+};
+
+inline UINT64 zigzagEncode(UINT64 delta) { return (delta << 1) ^ (0 - (delta >> 63)); }
+inline UINT64 zigzagDecode(UINT64 val) { return (val >> 1) ^ (~(val & 1) + 1); }
+
+class TraceWriter
+{
+public:
+    TraceWriter() : m_file(NULL), m_len(0), m_pc_prev(0)
+    {
+        memset(&m_header, 0, sizeof(m_header));
+        m_addr_prev[0] = m_addr_prev[1] = 0;
+    }
+
+    ~TraceWriter() { close(0); }
+
+    bool open(const char* path, bool with_pc)
+    {
+        m_file = fopen(path, "wb");
+        if (m_file == NULL) return false;
+
+        m_header.magic = TRACE_MAGIC;
+        m_header.version = TRACE_VERSION;
+        m_header.flags = with_pc ? TRACE_HAS_PC : 0;
+        return fwrite(&m_header, sizeof(m_header), 1, m_file) == 1;
+    }
+
+    void write(UINT32 type, UINT64 addr, UINT32 size, UINT64 pc)
+    {
+        if (m_len + MAX_RECORD_LEN > BUF_LEN) flush();
+
+        UINT32 size_log = TRACE_SIZE_EXPLICIT;
+        if (size && size <= 64 && (size & (size - 1)) == 0)
+            size_log = __builtin_ctz(size);
+
+        bool with_pc = m_header.flags & TRACE_HAS_PC;
+        m_buf[m_len++] = type | (size_log << 2) | (with_pc ? TRACE_PC_BIT : 0);
+
+        UINT64& prev = m_addr_prev[type == REF_FETCH];
+        putVarint(zigzagEncode(addr - prev));
+        prev = addr;
+
+        if (size_log == TRACE_SIZE_EXPLICIT) putVarint(size);
+
+        if (with_pc)
+        {
+            putVarint(zigzagEncode(pc - m_pc_prev));
+            m_pc_prev = pc;
+        }
+
+        m_header.ref_count++;
+    }
+
+    // Flush the records and rewrite the header with the final counts
+    void close(UINT64 inst_count)
+    {
+        if (m_file == NULL) return;
+
+        flush();
+        m_header.inst_count = inst_count;
+        fseek(m_file, 0, SEEK_SET);
+        fwrite(&m_header, sizeof(m_header), 1, m_file);
+        fclose(m_file);
+        m_file = NULL;
+    }
+
+    UINT64 getRefCount() { return m_header.ref_count; }
+
+private:
+    static const size_t BUF_LEN = 1 << 20;
+    static const size_t MAX_RECORD_LEN = 1 + 10 * 3;
+
+    FILE* m_file;
+    TraceHeader m_header;
+    UINT8 m_buf[BUF_LEN];
+    size_t m_len;
+    UINT64 m_addr_prev[2];  // 数据访问和取指各自的上一个地址
+    UINT64 m_pc_prev;
+
+    void putVarint(UINT64 val)
+    {
+        while (val >= 0x80)
+        {
+            m_buf[m_len++] = (UINT8)(val | 0x80);
+            val >>= 7;
+        }
+        m_buf[m_len++] = (UINT8)val;
+    }
+
+    void flush()
+    {
+        if (m_len) fwrite(m_buf, 1, m_len, m_file);
+        m_len = 0;
+    }
+};
+
+// Decode records from a trace held in memory, e.g. an mmap()ed file
+class TraceReader
+{
+public:
+    TraceReader(const UINT8* data, size_t len)
+        : m_data(data), m_pos(data), m_end(data + len), m_pc_prev(0)
+    {
+        m_addr_prev[0] = m_addr_prev[1] = 0;
+        m_valid = len >= sizeof(TraceHeader);
+        if (m_valid)
+        {
+            memcpy(&m_header, data, sizeof(TraceHeader));
+            m_valid = (m_header.magic == TRACE_MAGIC) && (m_header.version == TRACE_VERSION);
+            m_pos += sizeof(TraceHeader);
+        }
+    }
+
+    bool isValid() { return m_valid; }
+    const TraceHeader& getHeader() { return m_header; }
+
+    // Bytes decoded so far, for prefetch hints
+    size_t getOffset() { return m_pos - m_data; }
+
+    // Decode the next record. Return false at the end of the trace or on a truncated record
+    bool next(TraceRecord& rec)
+    {
+        if (m_pos >= m_end) return false;
+
+        UINT8 head = *m_pos++;
+        rec.type = head & 0x3;
+        UINT32 size_log = (head >> 2) & 0x7;
+
+        UINT64 val;
+        if (!getVarint(val)) return false;
+        UINT64& prev = m_addr_prev[rec.type == REF_FETCH];
+        prev += zigzagDecode(val);
+        rec.addr = prev;
+
+        if (size_log == TRACE_SIZE_EXPLICIT)
+        {
+            if (!getVarint(val)) return false;
+            rec.size = (UINT32)val;
+        }
+        else
+        {
+            rec.size = 1u << size_log;
+        }
+
+        if (head & TRACE_PC_BIT)
+        {
+            if (!getVarint(val)) return false;
+            m_pc_prev += zigzagDecode(val);
+        }
+        rec.pc = m_pc_prev;
+
+        return true;
+    }
+
+private:
+    const UINT8* m_data;
+    const UINT8* m_pos;
+    const UINT8* m_end;
+    TraceHeader m_header;
+    bool m_valid;
+    UINT64 m_addr_prev[2];
+    UINT64 m_pc_prev;
+
+    bool getVarint(UINT64& val)
+    {
+        val = 0;
+        for (UINT32 shift = 0; m_pos < m_end && shift < 64; shift += 7)
+        {
+            UINT8 byte = *m_pos++;
+            val |= (UINT64)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+};
+
+#endif // MEM_TRACE_H
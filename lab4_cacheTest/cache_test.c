@@ -1,17 +1,49 @@
+// build: gcc -O2 -pthread -o cache_test cache_test.c
+#define _GNU_SOURCE												// pthread_setaffinity_np, CPU_SET
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/sysinfo.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
 
 #define ARRAY_SIZE (1 << 30)                                    // test array size is 2^28
 #define TEST_TIMES_0 30000
 #define TEST_TIMES_1 60000
 #define TEST_TIMES_2 80000
+#define CHASE_STRIDE 64											// one node per cache line
+#define CHASE_LOADS (1 << 22)									// timed loads per working-set size
+#define CHASE_TRIALS 3											// the fastest trial is reported
+#define CHASE_STEPS_PER_OCTAVE 4								// working-set sizes grow by 2^(1/4)
+#define BW_MIN_SIZE_LOG2 14										// per-thread working set: 16KB ..
+#define BW_MAX_SIZE_LOG2 26										// .. 64MB, growing by 4x
+#define BW_BYTES_PER_THREAD (1L << 27)							// traffic per thread per trial
+#define BW_TRIALS 3												// the fastest trial is reported
+#define MAX_CACHE_LEVELS 8
+#define INFER_LOADS (1 << 19)									// timed loads per trial
+#define INFER_TRIALS 5											// the median trial is used
+#define INFER_RISE_STEP 1.1										// a point 10% above the previous one is still rising
+#define INFER_RISE_TOTAL 1.3									// a rise of 30% marks a new level
+#define INFER_MAX_WAYS 32
+#define INFER_MAX_POINTS 128
+#define INFER_PAIR_BLOCK 512									// block stride of the line size probe
+#define HUGE_TLB_MAX_PAGES 16384								// largest page count probed per page size
+#define HUGE_TLB_MAX_BYTES (1L << 32)							// and at most this much memory (or half the free RAM)
+#define HUGE_TLB_MIN_PAGES 8									// fewer pages can't show a TLB level past 4 entries
+#define THP_PAGE_SIZE (1L << 21)
 
 typedef unsigned char BYTE;										// define BYTE as one-byte type
 
-BYTE array[ARRAY_SIZE];											// test array
+BYTE array[ARRAY_SIZE] __attribute__((aligned(1 << 21)));		// test array, aligned to a huge page
 const int L1_cache_size = 1 << 18;
 const int L2_cache_size = 1 << 22;
 
@@ -20,6 +52,21 @@ double get_usec(const struct timeval tp0, const struct timeval tp1)
     return 1000000 * (tp1.tv_sec - tp0.tv_sec) + tp1.tv_usec - tp0.tv_usec;
 }
 
+double get_nsec(const struct timespec tp0, const struct timespec tp1)
+{
+	return 1e9 * (tp1.tv_sec - tp0.tv_sec) + (tp1.tv_nsec - tp0.tv_nsec);
+}
+
+// xorshift64, rand() is too narrow to shuffle millions of lines
+unsigned long long Rand64()
+{
+	static unsigned long long x = 88172645463325252ULL;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
+
 // have an access to arrays with L2 Data Cache'size to clear the L1 cache
 void Clear_L1_Cache()
 {
@@ -191,8 +238,1033 @@ void Test_TLB_Size()
 	}
 }
 
-int main()
+void Shuffle(size_t *order, size_t count)
+{
+	for (size_t i = count - 1; i > 0 && count > 0; i--)
+	{
+		size_t j = Rand64() % (i + 1);
+		size_t tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+}
+
+// store at base + offsets[i] a pointer to base + offsets[i + 1], closing the cycle
+void **Link_Chase(BYTE *base, const size_t *offsets, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		*(void **)(base + offsets[i]) = base + offsets[(i + 1) % count];
+	return (void **)(base + offsets[0]);
+}
+
+// link the first `lines` cache lines of array into one cycle visited in shuffled order,
+// so every load depends on the previous one and the prefetchers cannot guess the next line
+void **Build_Chase(size_t lines)
+{
+	size_t *order = malloc(lines * sizeof(size_t));
+	for (size_t i = 0; i < lines; i++)
+		order[i] = i;
+	Shuffle(order, lines);
+	for (size_t i = 0; i < lines; i++)
+		order[i] *= CHASE_STRIDE;
+
+	void **head = Link_Chase(array, order, lines);
+	free(order);
+	return head;
+}
+
+// follow the chain for `loads` loads (rounded up to a multiple of 8)
+void **Chase(void **p, long loads)
+{
+	for (long i = 0; i < loads; i += 8)
+	{
+		p = (void **)*p; p = (void **)*p; p = (void **)*p; p = (void **)*p;
+		p = (void **)*p; p = (void **)*p; p = (void **)*p; p = (void **)*p;
+	}
+	return p;
+}
+
+void * volatile chase_sink;										// keeps the chase from being optimized away
+
+// point `step` of a grid with CHASE_STEPS_PER_OCTAVE points per octave, i.e. 2^(step/4)
+size_t Grid_Point(int step)
+{
+	const double octave_step[CHASE_STEPS_PER_OCTAVE] = {1.0, 1.189207, 1.414214, 1.681793};	// 2^(k/4), k = 0..3
+	return (size_t)((1UL << (step / CHASE_STEPS_PER_OCTAVE)) * octave_step[step % CHASE_STEPS_PER_OCTAVE]);
+}
+
+void Test_Load_Latency()
+{
+	printf("**************************************************************\n");
+	printf("Load Latency Test (pointer chase)\n");
+
+	for (int step = 12 * CHASE_STEPS_PER_OCTAVE; step <= 28 * CHASE_STEPS_PER_OCTAVE; step++) // 4KB .. 256MB
+	{
+		size_t test_size = Grid_Point(step);
+		size_t lines = test_size / CHASE_STRIDE;
+		test_size = lines * CHASE_STRIDE;
+
+		void **p = Build_Chase(lines);
+		p = Chase(p, lines < CHASE_LOADS ? lines : CHASE_LOADS);		// warm up caches and TLB
+
+		double best = 0;
+		for (int trial = 0; trial < CHASE_TRIALS; trial++)
+		{
+			struct timespec tp[2];
+			clock_gettime(CLOCK_MONOTONIC, &tp[0]);
+			p = Chase(p, CHASE_LOADS);
+			clock_gettime(CLOCK_MONOTONIC, &tp[1]);
+			double time_used = get_nsec(tp[0], tp[1]);
+			if (trial == 0 || time_used < best)
+				best = time_used;
+		}
+		chase_sink = p;
+		printf("[Test_Array_Size = %9.1fKB]\t\tAverage load latency: %.2fns\n", test_size / 1024.0, best / CHASE_LOADS);
+	}
+}
+
+/*
+ * Bandwidth test: STREAM-style kernels over double arrays, each in several code variants.
+ * Only the bytes the kernel reads and writes are counted, not the write-allocate traffic.
+ */
+
+// keep gcc from vectorizing the scalar kernels or turning them into memset/memcpy
+#define BW_SCALAR_CODE __attribute__((optimize("no-tree-vectorize", "no-tree-loop-distribute-patterns")))
+#define BW_TRIAD_SCALE 3.0
+
+typedef double (*BW_Kernel_Func)(double *a, double *b, double *c, size_t n);	// n is a multiple of 16
+
+BW_SCALAR_CODE double Read_Scalar(double *a, double *b, double *c, size_t n)
+{
+	double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	for (size_t i = 0; i < n; i += 4)
+	{
+		s0 += a[i];
+		s1 += a[i + 1];
+		s2 += a[i + 2];
+		s3 += a[i + 3];
+	}
+	return s0 + s1 + s2 + s3;
+}
+
+BW_SCALAR_CODE double Write_Scalar(double *a, double *b, double *c, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		a[i] = BW_TRIAD_SCALE;
+	return 0;
+}
+
+BW_SCALAR_CODE double Copy_Scalar(double *a, double *b, double *c, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		a[i] = b[i];
+	return 0;
+}
+
+BW_SCALAR_CODE double Triad_Scalar(double *a, double *b, double *c, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		a[i] = b[i] + BW_TRIAD_SCALE * c[i];
+	return 0;
+}
+
+#ifdef HAVE_X86_SIMD
+double Read_SSE(double *a, double *b, double *c, size_t n)
+{
+	__m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd(), s2 = _mm_setzero_pd(), s3 = _mm_setzero_pd();
+	for (size_t i = 0; i < n; i += 8)
+	{
+		s0 = _mm_add_pd(s0, _mm_load_pd(a + i));
+		s1 = _mm_add_pd(s1, _mm_load_pd(a + i + 2));
+		s2 = _mm_add_pd(s2, _mm_load_pd(a + i + 4));
+		s3 = _mm_add_pd(s3, _mm_load_pd(a + i + 6));
+	}
+	double r[2];
+	_mm_storeu_pd(r, _mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3)));
+	return r[0] + r[1];
+}
+
+double Write_SSE(double *a, double *b, double *c, size_t n)
+{
+	__m128d v = _mm_set1_pd(BW_TRIAD_SCALE);
+	for (size_t i = 0; i < n; i += 2)
+		_mm_store_pd(a + i, v);
+	return 0;
+}
+
+double Copy_SSE(double *a, double *b, double *c, size_t n)
+{
+	for (size_t i = 0; i < n; i += 2)
+		_mm_store_pd(a + i, _mm_load_pd(b + i));
+	return 0;
+}
+
+double Triad_SSE(double *a, double *b, double *c, size_t n)
+{
+	__m128d s = _mm_set1_pd(BW_TRIAD_SCALE);
+	for (size_t i = 0; i < n; i += 2)
+		_mm_store_pd(a + i, _mm_add_pd(_mm_load_pd(b + i), _mm_mul_pd(s, _mm_load_pd(c + i))));
+	return 0;
+}
+
+__attribute__((target("avx2"))) double Read_AVX2(double *a, double *b, double *c, size_t n)
+{
+	__m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd(), s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+	for (size_t i = 0; i < n; i += 16)
+	{
+		s0 = _mm256_add_pd(s0, _mm256_load_pd(a + i));
+		s1 = _mm256_add_pd(s1, _mm256_load_pd(a + i + 4));
+		s2 = _mm256_add_pd(s2, _mm256_load_pd(a + i + 8));
+		s3 = _mm256_add_pd(s3, _mm256_load_pd(a + i + 12));
+	}
+	double r[4];
+	_mm256_storeu_pd(r, _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+	return r[0] + r[1] + r[2] + r[3];
+}
+
+__attribute__((target("avx2"))) double Write_AVX2(double *a, double *b, double *c, size_t n)
+{
+	__m256d v = _mm256_set1_pd(BW_TRIAD_SCALE);
+	for (size_t i = 0; i < n; i += 4)
+		_mm256_store_pd(a + i, v);
+	return 0;
+}
+
+__attribute__((target("avx2"))) double Copy_AVX2(double *a, double *b, double *c, size_t n)
+{
+	for (size_t i = 0; i < n; i += 4)
+		_mm256_store_pd(a + i, _mm256_load_pd(b + i));
+	return 0;
+}
+
+__attribute__((target("avx2"))) double Triad_AVX2(double *a, double *b, double *c, size_t n)
+{
+	__m256d s = _mm256_set1_pd(BW_TRIAD_SCALE);
+	for (size_t i = 0; i < n; i += 4)
+		_mm256_store_pd(a + i, _mm256_add_pd(_mm256_load_pd(b + i), _mm256_mul_pd(s, _mm256_load_pd(c + i))));
+	return 0;
+}
+
+// non-temporal stores bypass the caches and skip the read-for-ownership,
+// SSE2 width is enough since they only matter once the arrays spill to memory
+double Write_NT(double *a, double *b, double *c, size_t n)
+{
+	__m128d v = _mm_set1_pd(BW_TRIAD_SCALE);
+	for (size_t i = 0; i < n; i += 2)
+		_mm_stream_pd(a + i, v);
+	_mm_sfence();
+	return 0;
+}
+
+double Copy_NT(double *a, double *b, double *c, size_t n)
+{
+	for (size_t i = 0; i < n; i += 2)
+		_mm_stream_pd(a + i, _mm_load_pd(b + i));
+	_mm_sfence();
+	return 0;
+}
+
+double Triad_NT(double *a, double *b, double *c, size_t n)
+{
+	__m128d s = _mm_set1_pd(BW_TRIAD_SCALE);
+	for (size_t i = 0; i < n; i += 2)
+		_mm_stream_pd(a + i, _mm_add_pd(_mm_load_pd(b + i), _mm_mul_pd(s, _mm_load_pd(c + i))));
+	_mm_sfence();
+	return 0;
+}
+#else
+#define Read_SSE NULL
+#define Write_SSE NULL
+#define Copy_SSE NULL
+#define Triad_SSE NULL
+#define Read_AVX2 NULL
+#define Write_AVX2 NULL
+#define Copy_AVX2 NULL
+#define Triad_AVX2 NULL
+#define Write_NT NULL
+#define Copy_NT NULL
+#define Triad_NT NULL
+#endif
+
+enum BW_Variant {BW_SCALAR, BW_SSE, BW_AVX2, BW_NT, BW_VARIANTS};
+const char *bw_variant_names[BW_VARIANTS] = {"scalar", "sse", "avx2", "nt"};
+
+struct BW_Kernel
+{
+	const char *name;
+	int arrays;													// arrays the working set is split into
+	int bytes;													// bytes moved per element
+	BW_Kernel_Func func[BW_VARIANTS];							// NULL if the variant doesn't exist
+} bw_kernels[] = {
+	{"read",  1,  8, {Read_Scalar,  Read_SSE,  Read_AVX2,  NULL}},
+	{"write", 1,  8, {Write_Scalar, Write_SSE, Write_AVX2, Write_NT}},
+	{"copy",  2, 16, {Copy_Scalar,  Copy_SSE,  Copy_AVX2,  Copy_NT}},
+	{"triad", 3, 24, {Triad_Scalar, Triad_SSE, Triad_AVX2, Triad_NT}},
+};
+
+// pick the variants this CPU can run
+int BW_Variant_Supported(int variant)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	switch (variant)
+	{
+		case BW_SSE:
+		case BW_NT:
+			return __builtin_cpu_supports("sse2");
+		case BW_AVX2:
+			return __builtin_cpu_supports("avx2");
+	}
+#endif
+	return variant == BW_SCALAR;
+}
+
+struct Cache_Level
+{
+	int level;
+	long size;
+	int line_size;
+	int ways;
+	int sharers;												// logical CPUs sharing this cache
+};
+
+// "0-3,8-11" -> 8
+int Count_CPU_List(const char *list)
+{
+	int count = 0;
+	while (*list >= '0' && *list <= '9')
+	{
+		char *end;
+		long lo = strtol(list, &end, 10), hi = lo;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		count += hi - lo + 1;
+		list = (*end == ',') ? end + 1 : end;
+	}
+	return count;
+}
+
+int Read_Sysfs_Line(const char *dir, const char *file, char *buf, int len)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+		return 0;
+	int ok = fgets(buf, len, fp) != NULL;
+	fclose(fp);
+	return ok;
+}
+
+// data and unified caches of cpu0 as reported by the kernel, returns how many were found
+int Read_Cache_Levels(struct Cache_Level *levels, int max_levels)
+{
+	int count = 0;
+	for (int index = 0; count < max_levels; index++)
+	{
+		char dir[128], buf[256];
+		snprintf(dir, sizeof(dir), "/sys/devices/system/cpu/cpu0/cache/index%d", index);
+		if (!Read_Sysfs_Line(dir, "type", buf, sizeof(buf)))
+			break;
+		if (strncmp(buf, "Instruction", 11) == 0)
+			continue;
+
+		struct Cache_Level *lv = &levels[count];
+		lv->level = Read_Sysfs_Line(dir, "level", buf, sizeof(buf)) ? atoi(buf) : 0;
+		lv->size = 0;
+		if (Read_Sysfs_Line(dir, "size", buf, sizeof(buf)))
+		{
+			char *unit;
+			lv->size = strtol(buf, &unit, 10);
+			if (*unit == 'K')
+				lv->size <<= 10;
+			else if (*unit == 'M')
+				lv->size <<= 20;
+			else if (*unit == 'G')
+				lv->size <<= 30;
+		}
+		lv->line_size = Read_Sysfs_Line(dir, "coherency_line_size", buf, sizeof(buf)) ? atoi(buf) : 0;
+		lv->ways = Read_Sysfs_Line(dir, "ways_of_associativity", buf, sizeof(buf)) ? atoi(buf) : 0;
+		lv->sharers = Read_Sysfs_Line(dir, "shared_cpu_list", buf, sizeof(buf)) ? Count_CPU_List(buf) : 1;
+		if (lv->sharers < 1)
+			lv->sharers = 1;
+		if (lv->size > 0)
+			count++;
+	}
+	return count;
+}
+
+// the innermost level that holds a per-thread working set of `size`, when `threads` threads share it
+const char *Level_Name(const struct Cache_Level *levels, int count, long size, int threads)
+{
+	static char name[8];
+	for (int i = 0; i < count; i++)
+	{
+		int sharing = threads < levels[i].sharers ? threads : levels[i].sharers;
+		if (size * sharing <= levels[i].size)
+		{
+			snprintf(name, sizeof(name), "L%d", levels[i].level);
+			return name;
+		}
+	}
+	return "Mem";
+}
+
+struct BW_Thread
+{
+	pthread_t thread;
+	int index;
+	int cpu;
+	BW_Kernel_Func func;
+	double *a, *b, *c;
+	size_t n;
+	size_t size;												// bytes of array owned by this thread
+	long reps;
+	double sum;
+};
+
+pthread_barrier_t bw_barrier;
+double bw_best_nsec;											// written by thread 0 only
+volatile double bw_sink;
+
+void *BW_Worker(void *arg)
+{
+	struct BW_Thread *t = arg;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	// first touch from the pinned thread, then one untimed pass to warm caches and TLB
+	memset(t->a, 0, t->size);
+	t->sum = t->func(t->a, t->b, t->c, t->n);
+
+	for (int trial = 0; trial < BW_TRIALS; trial++)
+	{
+		struct timespec tp[2];
+		pthread_barrier_wait(&bw_barrier);
+		clock_gettime(CLOCK_MONOTONIC, &tp[0]);
+		for (long r = 0; r < t->reps; r++)
+			t->sum += t->func(t->a, t->b, t->c, t->n);
+		pthread_barrier_wait(&bw_barrier);
+		clock_gettime(CLOCK_MONOTONIC, &tp[1]);
+		double time_used = get_nsec(tp[0], tp[1]);
+		if (t->index == 0 && (trial == 0 || time_used < bw_best_nsec))
+			bw_best_nsec = time_used;
+	}
+	return NULL;
+}
+
+// run `func` on `threads` pinned threads, each over its own `size` bytes of array; returns GB/s
+double BW_Measure(const struct BW_Kernel *k, BW_Kernel_Func func, const int *cpus, int threads, size_t size)
+{
+	size_t n = (size / (k->arrays * sizeof(double))) & ~(size_t)15;
+	long reps = BW_BYTES_PER_THREAD / (long)(n * k->bytes);
+	if (reps < 1)
+		reps = 1;
+
+	struct BW_Thread *t = malloc(threads * sizeof(struct BW_Thread));
+	pthread_barrier_init(&bw_barrier, NULL, threads);
+	for (int i = 0; i < threads; i++)
+	{
+		t[i].index = i;
+		t[i].cpu = cpus[i];
+		t[i].func = func;
+		t[i].a = (double *)(array + i * size);
+		t[i].b = t[i].a + n;
+		t[i].c = t[i].b + n;
+		t[i].n = n;
+		t[i].size = size;
+		t[i].reps = reps;
+		pthread_create(&t[i].thread, NULL, BW_Worker, &t[i]);
+	}
+	for (int i = 0; i < threads; i++)
+	{
+		pthread_join(t[i].thread, NULL);
+		bw_sink += t[i].sum;
+	}
+	pthread_barrier_destroy(&bw_barrier);
+	free(t);
+
+	return (double)threads * reps * n * k->bytes / bw_best_nsec;	// bytes per ns == GB/s
+}
+
+void Test_Bandwidth()
+{
+	printf("**************************************************************\n");
+	printf("Memory Bandwidth Test\n");
+
+	cpu_set_t set;
+	int cpus[CPU_SETSIZE], cpu_count = 0;
+	sched_getaffinity(0, sizeof(set), &set);
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &set))
+			cpus[cpu_count++] = cpu;
+
+	struct Cache_Level levels[MAX_CACHE_LEVELS];
+	int level_count = Read_Cache_Levels(levels, MAX_CACHE_LEVELS);
+
+	for (int variant = 0; variant < BW_VARIANTS; variant++)
+		if (!BW_Variant_Supported(variant))
+			printf("Variant %s is not supported by this CPU, skipped\n", bw_variant_names[variant]);
+
+	for (int kernel = 0; kernel < (int)(sizeof(bw_kernels) / sizeof(bw_kernels[0])); kernel++)
+	{
+		const struct BW_Kernel *k = &bw_kernels[kernel];
+		for (int variant = 0; variant < BW_VARIANTS; variant++)
+		{
+			if (k->func[variant] == NULL || !BW_Variant_Supported(variant))
+				continue;
+			// 1, 2, 4, .. threads, and all of them
+			for (int threads = 1; threads <= cpu_count; threads = (threads < cpu_count && threads * 2 > cpu_count) ? cpu_count : threads * 2)
+			{
+				for (int size_log2 = BW_MIN_SIZE_LOG2; size_log2 <= BW_MAX_SIZE_LOG2; size_log2 += 2)
+				{
+					size_t size = 1UL << size_log2;
+					if (size * threads > ARRAY_SIZE)
+						break;
+					double bandwidth = BW_Measure(k, k->func[variant], cpus, threads, size);
+					printf("[Kernel = %-5s Variant = %-6s Threads = %3d Array_Size = %6luKB (%-3s)]\t\tBandwidth: %.1fGB/s\n",
+						k->name, bw_variant_names[variant], threads, (unsigned long)(size >> 10),
+						Level_Name(levels, level_count, size, threads), bandwidth);
+				}
+				if (threads == cpu_count)
+					break;
+			}
+		}
+	}
+}
+
+/*
+ * Parameter inference: every probe is a pointer chase whose latency curve is split into
+ * plateaus, each rise between two plateaus marks where one level of the hierarchy runs out.
+ */
+
+int Compare_Double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+double Median(double *values, int count)
+{
+	qsort(values, count, sizeof(double), Compare_Double);
+	return (count & 1) ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// median ns per load over INFER_TRIALS runs, after `warm` untimed loads
+double Time_Chase(void **p, long warm)
+{
+	double trials[INFER_TRIALS];
+	p = Chase(p, warm);
+	for (int trial = 0; trial < INFER_TRIALS; trial++)
+	{
+		struct timespec tp[2];
+		clock_gettime(CLOCK_MONOTONIC, &tp[0]);
+		p = Chase(p, INFER_LOADS);
+		clock_gettime(CLOCK_MONOTONIC, &tp[1]);
+		trials[trial] = get_nsec(tp[0], tp[1]) / INFER_LOADS;
+	}
+	chase_sink = p;
+	return Median(trials, INFER_TRIALS);
+}
+
+// like Build_Chase, but the lines of one page are visited together (pages and the lines within
+// them both in shuffled order), so TLB misses stay rare and the curve only shows the caches
+void **Build_Page_Chase(size_t lines, size_t page_size)
+{
+	size_t page_lines = page_size / CHASE_STRIDE;
+	size_t pages = (lines + page_lines - 1) / page_lines;
+	size_t *page_order = malloc(pages * sizeof(size_t));
+	size_t *offsets = malloc(lines * sizeof(size_t));
+	for (size_t i = 0; i < pages; i++)
+		page_order[i] = i;
+	Shuffle(page_order, pages);
+
+	size_t count = 0;
+	for (size_t i = 0; i < pages; i++)
+	{
+		size_t first = page_order[i] * page_lines;
+		size_t n = (first + page_lines <= lines) ? page_lines : lines - first;
+		for (size_t j = 0; j < n; j++)
+			offsets[count + j] = (first + j) * CHASE_STRIDE;
+		Shuffle(offsets + count, n);
+		count += n;
+	}
+
+	void **head = Link_Chase(array, offsets, lines);
+	free(page_order);
+	free(offsets);
+	return head;
+}
+
+// one line in each of `pages` pages from base, staggered so they spread over the cache sets
+void **Build_TLB_Chase(BYTE *base, size_t pages, size_t page_size)
+{
+	size_t *offsets = malloc(pages * sizeof(size_t));
+	for (size_t i = 0; i < pages; i++)
+		offsets[i] = i * page_size + (i % (page_size / CHASE_STRIDE)) * CHASE_STRIDE;
+	Shuffle(offsets, pages);
+
+	void **head = Link_Chase(base, offsets, pages);
+	free(offsets);
+	return head;
+}
+
+// loads at offset 0 and block/2 of INFER_PAIR_BLOCK-spaced blocks: both loads share a line
+// (one miss per pair) until block/2 reaches the line size (two misses per pair)
+void **Build_Pair_Chase(size_t blocks, size_t block)
+{
+	size_t *order = malloc(blocks * sizeof(size_t));
+	size_t *offsets = malloc(2 * blocks * sizeof(size_t));
+	for (size_t i = 0; i < blocks; i++)
+		order[i] = i;
+	Shuffle(order, blocks);
+	for (size_t i = 0; i < blocks; i++)
+	{
+		offsets[2 * i] = order[i] * INFER_PAIR_BLOCK;
+		offsets[2 * i + 1] = order[i] * INFER_PAIR_BLOCK + block / 2;
+	}
+
+	void **head = Link_Chase(array, offsets, 2 * blocks);
+	free(order);
+	free(offsets);
+	return head;
+}
+
+// `count` nodes `stride` bytes apart, all of which fall into the same cache set once the stride
+// is a multiple of the level's set span
+void **Build_Set_Chase(size_t count, size_t stride)
+{
+	size_t *offsets = malloc(count * sizeof(size_t));
+	for (size_t i = 0; i < count; i++)
+		offsets[i] = i * stride;
+
+	void **head = Link_Chase(array, offsets, count);
+	free(offsets);
+	return head;
+}
+
+// find the rises of a curve: a rise is a run of points each more than INFER_RISE_STEP above the
+// one before (it may pause for a single point), and it counts if it climbs INFER_RISE_TOTAL in
+// all; starts[] gets the last point before the rise passes its geometric midpoint, ends[] its top
+int Find_Rises(const double *curve, int count, int *starts, int *ends, int max_rises)
+{
+	int found = 0;
+	int i = 1;
+	while (i < count && found < max_rises)
+	{
+		if (curve[i] <= curve[i - 1] * INFER_RISE_STEP)
+		{
+			i++;
+			continue;
+		}
+		int start = i - 1, top = i;
+		while (i < count)
+		{
+			if (curve[i] > curve[i - 1] * INFER_RISE_STEP)
+				top = i;
+			else if (i + 1 >= count || curve[i + 1] <= curve[i] * INFER_RISE_STEP)
+				break;
+			i++;
+		}
+		if (curve[top] >= curve[start] * INFER_RISE_TOTAL)
+		{
+			// noise can start a rise a point or two early, the midpoint can't move much
+			double mid_square = curve[start] * curve[top];
+			while (start + 1 < top && curve[start + 1] * curve[start + 1] <= mid_square)
+				start++;
+			starts[found] = start;
+			ends[found] = top;
+			found++;
+		}
+	}
+	return found;
+}
+
+// median of curve[from .. to], both inclusive
+double Plateau(const double *curve, int from, int to)
+{
+	double values[INFER_MAX_POINTS];
+	int count = 0;
+	for (int i = from; i <= to && count < INFER_MAX_POINTS; i++)
+		values[count++] = curve[i];
+	return count ? Median(values, count) : 0;
+}
+
+long Next_Pow2(long x)
+{
+	long p = 1;
+	while (p < x)
+		p <<= 1;
+	return p;
+}
+
+// Only the JSON goes to stdout, so `cache_test infer | jq .` works
+void Test_Infer()
+{
+	fprintf(stderr, "**************************************************************\n");
+	fprintf(stderr, "Cache and TLB Parameter Inference (JSON)\n");
+
+	const long page_size = sysconf(_SC_PAGESIZE);
+	struct Cache_Level sysfs[MAX_CACHE_LEVELS];
+	int sysfs_count = Read_Cache_Levels(sysfs, MAX_CACHE_LEVELS);
+
+	// cache sizes: latency of a page-grouped chase over 4KB .. 256MB
+	size_t sizes[INFER_MAX_POINTS];
+	double latency[INFER_MAX_POINTS];
+	int points = 0;
+	for (int step = 12 * CHASE_STEPS_PER_OCTAVE; step <= 28 * CHASE_STEPS_PER_OCTAVE; step++)
+	{
+		size_t lines = Grid_Point(step) / CHASE_STRIDE;
+		sizes[points] = lines * CHASE_STRIDE;
+		latency[points] = Time_Chase(Build_Page_Chase(lines, page_size), lines);
+		points++;
+	}
+	int starts[MAX_CACHE_LEVELS], ends[MAX_CACHE_LEVELS];
+	int levels = Find_Rises(latency, points, starts, ends, MAX_CACHE_LEVELS);
+	long level_size[MAX_CACHE_LEVELS];
+	double level_latency[MAX_CACHE_LEVELS + 1];					// the last one is memory
+	for (int k = 0; k <= levels; k++)
+	{
+		int from = k ? ends[k - 1] : 0;
+		int to = k < levels ? starts[k] : points - 1;
+		level_latency[k] = Plateau(latency, from, to);
+		if (k < levels)
+			level_size[k] = sizes[starts[k]];
+	}
+
+	// line size: pairs of loads in blocks that miss L1 but stay in L2
+	int line_size = 0;
+	if (levels >= 1)
+	{
+		size_t blocks = 2 * level_size[0] / CHASE_STRIDE;
+		double pair[INFER_MAX_POINTS];
+		int block_log2[INFER_MAX_POINTS], count = 0;
+		for (int b = 4; (1 << b) <= INFER_PAIR_BLOCK; b++)			// 16B .. 512B
+		{
+			block_log2[count] = b;
+			pair[count++] = Time_Chase(Build_Pair_Chase(blocks, 1 << b), 2 * blocks);
+		}
+		int rise_start, rise_end;
+		if (Find_Rises(pair, count, &rise_start, &rise_end, 1))
+			line_size = 1 << block_log2[rise_start];
+	}
+
+	// associativity: `n` nodes that map to one set, the level holds them until n exceeds its ways;
+	// lower levels overflow first, so level k uses the first rise after level k-1's ways.
+	// Physically indexed levels only see one set when the stride stays inside a page, so the
+	// array is backed by transparent huge pages for this probe where the kernel allows it
+	int level_ways[MAX_CACHE_LEVELS];
+	madvise(array, ARRAY_SIZE, MADV_HUGEPAGE);
+	madvise(array, ARRAY_SIZE, MADV_DONTNEED);					// refault as huge pages
+	for (int k = 0; k < levels; k++)
+	{
+		level_ways[k] = 0;
+		long stride = Next_Pow2(level_size[k]);
+		double set[INFER_MAX_WAYS];
+		int count = 0;
+		for (int n = 1; n <= INFER_MAX_WAYS && n * stride <= ARRAY_SIZE; n++)
+			set[count++] = Time_Chase(Build_Set_Chase(n, stride), n);
+		int rise_starts[INFER_MAX_WAYS], rise_ends[INFER_MAX_WAYS];
+		int rises = Find_Rises(set, count, rise_starts, rise_ends, INFER_MAX_WAYS);
+		for (int r = 0; r < rises; r++)
+			if (rise_starts[r] + 1 > (k ? level_ways[k - 1] : 0))
+			{
+				level_ways[k] = rise_starts[r] + 1;
+				break;
+			}
+	}
+	madvise(array, ARRAY_SIZE, MADV_NOHUGEPAGE);
+	madvise(array, ARRAY_SIZE, MADV_DONTNEED);					// back to base pages for the TLB probe
+
+	// TLB: one line per page against a control chase over as many lines packed densely,
+	// so the ratio only moves when the pages stop fitting in a TLB level
+	size_t pages[INFER_MAX_POINTS];
+	double ratio[INFER_MAX_POINTS] = {0}, extra[INFER_MAX_POINTS] = {0};
+	int tlb_points = 0;
+	for (int step = 2 * CHASE_STEPS_PER_OCTAVE; step <= 14 * CHASE_STEPS_PER_OCTAVE; step++)	// 4 .. 16384 pages
+	{
+		size_t n = Grid_Point(step);
+		if (n * page_size > ARRAY_SIZE)
+			break;
+		double spread = Time_Chase(Build_TLB_Chase(array, n, page_size), n);
+		double dense = Time_Chase(Build_Chase(n), n);
+		pages[tlb_points] = n;
+		ratio[tlb_points] = spread / dense;
+		extra[tlb_points] = spread - dense;
+		tlb_points++;
+	}
+	int tlb_starts[MAX_CACHE_LEVELS], tlb_ends[MAX_CACHE_LEVELS];
+	int tlb_levels = Find_Rises(ratio, tlb_points, tlb_starts, tlb_ends, MAX_CACHE_LEVELS);
+
+	printf("{\n");
+	printf("  \"page_size\": %ld,\n", page_size);
+	printf("  \"line_size\": %d,\n", line_size);
+	printf("  \"caches\": [");
+	for (int k = 0; k < levels; k++)
+	{
+		const struct Cache_Level *sys = NULL;
+		for (int i = 0; i < sysfs_count; i++)
+			if (sysfs[i].level == k + 1)
+				sys = &sysfs[i];
+		printf("%s\n    {\"level\": %d, \"size\": %ld, \"latency_ns\": %.2f, \"ways\": ", k ? "," : "", k + 1, level_size[k], level_latency[k]);
+		if (level_ways[k])
+			printf("%d", level_ways[k]);
+		else
+			printf("null");
+		if (sys)
+		{
+			// the chase loses some capacity to conflicts, so a size half an octave short still matches
+			double size_ratio = (double)level_size[k] / sys->size;
+			printf(", \"sysfs\": {\"size\": %ld, \"line_size\": %d, \"ways\": %d}", sys->size, sys->line_size, sys->ways);
+			printf(", \"size_matches\": %s", (size_ratio >= 0.5 && size_ratio <= 1.25) ? "true" : "false");
+			printf(", \"ways_match\": %s", level_ways[k] == sys->ways ? "true" : "false");
+			if (k == 0)
+				printf(", \"line_size_matches\": %s", line_size == sys->line_size ? "true" : "false");
+		}
+		else
+			printf(", \"sysfs\": null");
+		printf("}");
+	}
+	printf("%s],\n", levels ? "\n  " : "");
+	printf("  \"sysfs_levels\": %d,\n", sysfs_count);
+	printf("  \"memory_latency_ns\": %.2f,\n", level_latency[levels]);
+	printf("  \"tlb\": [");
+	for (int k = 0; k < tlb_levels; k++)
+	{
+		int from = k ? tlb_ends[k - 1] : 0;
+		int next = k + 1 < tlb_levels ? tlb_starts[k + 1] : tlb_points - 1;
+		double penalty = Plateau(extra, tlb_ends[k], next) - Plateau(extra, from, tlb_starts[k]);
+		printf("%s\n    {\"level\": %d, \"entries\": %lu, \"miss_penalty_ns\": %.2f}", k ? "," : "", k + 1,
+			(unsigned long)pages[tlb_starts[k]], penalty);
+	}
+	printf("%s]\n", tlb_levels ? "\n  " : "");
+	printf("}\n");
+}
+
+/*
+ * TLB test per page size: the same spread-vs-dense chase as Test_Infer, on mmap regions backed
+ * by base pages, 2MB pages (hugetlbfs, else THP) and 1GB pages (hugetlbfs only).
+ */
+
+// bytes of the mapping at addr backed by transparent huge pages, from /proc/self/smaps
+size_t THP_Backed_Bytes(void *addr)
 {
+	FILE *fp = fopen("/proc/self/smaps", "r");
+	if (fp == NULL)
+		return 0;
+	char line[256];
+	size_t bytes = 0;
+	int in_mapping = 0;
+	while (fgets(line, sizeof(line), fp))
+	{
+		unsigned long start, end;
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2 && strchr(line, ' ') == line + strcspn(line, " "))
+			in_mapping = (start <= (unsigned long)addr && (unsigned long)addr < end);
+		else if (in_mapping && strncmp(line, "AnonHugePages:", 14) == 0)
+		{
+			bytes = strtoul(line + 14, NULL, 10) << 10;
+			break;
+		}
+	}
+	fclose(fp);
+	return bytes;
+}
+
+// free pages in the hugetlbfs pool of `page_size` pages, 0 if there is no such pool; the pool is
+// sized by nr_hugepages in the same directory
+size_t Hugetlb_Free_Pages(size_t page_size)
+{
+	char path[128];
+	snprintf(path, sizeof(path), "/sys/kernel/mm/hugepages/hugepages-%lukB/free_hugepages", (unsigned long)(page_size >> 10));
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+		return 0;
+	unsigned long pages = 0;
+	if (fscanf(fp, "%lu", &pages) != 1)
+		pages = 0;
+	fclose(fp);
+	return pages;
+}
+
+// map `bytes` of memory backed by `page_size` pages, touching every page; returns NULL if the
+// kernel can't provide them, otherwise *backing says where they came from
+BYTE *Map_Pages(size_t bytes, size_t page_size, const char **backing)
+{
+	BYTE *p;
+	if (page_size == (size_t)sysconf(_SC_PAGESIZE))
+	{
+		p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+		madvise(p, bytes, MADV_NOHUGEPAGE);
+		*backing = "base";
+	}
+	else
+	{
+		p = MAP_FAILED;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+		p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (__builtin_ctzl(page_size) << MAP_HUGE_SHIFT), -1, 0);
+		*backing = "hugetlbfs";
+#endif
+		if (p == MAP_FAILED && page_size == THP_PAGE_SIZE)
+		{
+			// over-map so the region can start on a huge page boundary
+			BYTE *raw = mmap(NULL, bytes + page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (raw == MAP_FAILED)
+				return NULL;
+			p = (BYTE *)(((unsigned long)raw + page_size - 1) & ~(page_size - 1));
+			if (p > raw)
+				munmap(raw, p - raw);
+			munmap(p + bytes, raw + page_size - p);
+			madvise(p, bytes, MADV_HUGEPAGE);
+			*backing = "THP";
+		}
+		if (p == MAP_FAILED)
+			return NULL;
+	}
+
+	for (size_t offset = 0; offset < bytes; offset += page_size)
+		p[offset] = 1;
+	// THP is best effort, give up if most of the region fell back to base pages
+	if (strcmp(*backing, "THP") == 0 && THP_Backed_Bytes(p) < bytes / 2)
+	{
+		munmap(p, bytes);
+		return NULL;
+	}
+	return p;
+}
+
+void Test_Huge_TLB()
+{
+	printf("**************************************************************\n");
+	printf("TLB Size Test per Page Size\n");
+
+	const size_t page_sizes[] = {sysconf(_SC_PAGESIZE), THP_PAGE_SIZE, 1L << 30};
+	struct sysinfo info;
+	sysinfo(&info);
+	size_t budget = (size_t)info.freeram * info.mem_unit / 2;
+	if (budget > HUGE_TLB_MAX_BYTES)
+		budget = HUGE_TLB_MAX_BYTES;
+
+	for (int ps = 0; ps < (int)(sizeof(page_sizes) / sizeof(page_sizes[0])); ps++)
+	{
+		const size_t page_size = page_sizes[ps];
+		size_t max_pages = budget / page_size;
+		// hugetlbfs pages are reserved apart from the free RAM, so the whole free pool can be probed;
+		// pages larger than THP only come from there
+		size_t pool = ps ? Hugetlb_Free_Pages(page_size) : 0;
+		if (page_size > THP_PAGE_SIZE || pool > max_pages)
+			max_pages = pool;
+		if (max_pages > HUGE_TLB_MAX_PAGES)
+			max_pages = HUGE_TLB_MAX_PAGES;
+		if (max_pages < HUGE_TLB_MIN_PAGES)
+		{
+			printf("[Page_Size = %7luKB]\t\t%lu pages available, too few to measure (at least %d, see nr_hugepages), skipped\n",
+				(unsigned long)(page_size >> 10), (unsigned long)max_pages, HUGE_TLB_MIN_PAGES);
+			continue;
+		}
+
+		// reserved huge pages may be scarce, so shrink the region until the mapping succeeds
+		const char *backing = NULL;
+		BYTE *region = NULL;
+		while (max_pages >= HUGE_TLB_MIN_PAGES && (region = Map_Pages(max_pages * page_size, page_size, &backing)) == NULL)
+			max_pages /= 2;
+		if (region == NULL)
+		{
+			printf("[Page_Size = %7luKB]\t\tnot available, skipped\n", (unsigned long)(page_size >> 10));
+			continue;
+		}
+
+		size_t pages[INFER_MAX_POINTS];
+		double ratio[INFER_MAX_POINTS] = {0}, extra[INFER_MAX_POINTS] = {0};
+		int points = 0;
+		for (int step = 0; points < INFER_MAX_POINTS; step++)		// from 1 page, a 1GB TLB level may hold only 4
+		{
+			size_t n = Grid_Point(step);
+			if (n > max_pages)
+				break;
+			if (points && n == pages[points - 1])
+				continue;
+			double spread = Time_Chase(Build_TLB_Chase(region, n, page_size), n);
+			double dense = Time_Chase(Build_Chase(n), n);
+			pages[points] = n;
+			ratio[points] = spread / dense;
+			extra[points] = spread - dense;
+			printf("[Page_Size = %7luKB (%s) Pages = %6lu]\t\tAverage load latency: %.2fns (dense: %.2fns)\n",
+				(unsigned long)(page_size >> 10), backing, (unsigned long)n, spread, dense);
+			points++;
+		}
+		munmap(region, max_pages * page_size);
+
+		int starts[MAX_CACHE_LEVELS], ends[MAX_CACHE_LEVELS];
+		int levels = Find_Rises(ratio, points, starts, ends, MAX_CACHE_LEVELS);
+		double walk = 0;
+		for (int k = 0; k < levels; k++)
+		{
+			int from = k ? ends[k - 1] : 0;
+			int next = k + 1 < levels ? starts[k + 1] : points - 1;
+			double penalty = Plateau(extra, ends[k], next) - Plateau(extra, from, starts[k]);
+			walk += penalty;
+			printf("=> %luKB pages, TLB level %d: %lu entries, miss costs %.2fns more\n",
+				(unsigned long)(page_size >> 10), k + 1, (unsigned long)pages[starts[k]], penalty);
+		}
+		// past the last level every load walks the page table, so the rises add up to the walk cost;
+		// it is only the full walk if the probe went past every TLB level the CPU has
+		if (levels)
+			printf("=> %luKB pages, page walk penalty past %d level(s) within %lu pages: %.2fns\n",
+				(unsigned long)(page_size >> 10), levels, (unsigned long)max_pages, walk);
+		else
+			printf("=> %luKB pages, no TLB limit within %lu pages\n", (unsigned long)(page_size >> 10), (unsigned long)max_pages);
+	}
+}
+
+struct Test
+{
+	const char *name;
+	void (*run)();
+} tests[] = {
+	{"size", Test_Cache_Size},
+	{"block", Test_L1C_Block_Size},
+	{"way", Test_L1C_Way_Count},
+	{"tlb", Test_TLB_Size},
+	{"latency", Test_Load_Latency},
+	{"bandwidth", Test_Bandwidth},
+	{"infer", Test_Infer},
+	{"tlb-huge", Test_Huge_TLB},
+};
+
+// cache_test [test ...] runs only the named tests, all of them but infer when none is given:
+// infer writes JSON for scripts and is only run by name
+int main(int argc, char *argv[])
+{
+	const int test_count = sizeof(tests) / sizeof(tests[0]);
+	for (int arg = 1; arg < argc; arg++)
+	{
+		int found = 0;
+		for (int i = 0; i < test_count; i++)
+			if (strcmp(argv[arg], tests[i].name) == 0)
+				found = 1;
+		if (!found)
+		{
+			fprintf(stderr, "Unknown test %s, expected one of:", argv[arg]);
+			for (int i = 0; i < test_count; i++)
+				fprintf(stderr, " %s", tests[i].name);
+			fprintf(stderr, "\n");
+			return -1;
+		}
+	}
+	if (argc > 1)
+	{
+		for (int arg = 1; arg < argc; arg++)
+			for (int i = 0; i < test_count; i++)
+				if (strcmp(argv[arg], tests[i].name) == 0)
+					tests[i].run();
+		return 0;
+	}
+
 	Test_Cache_Size();
 	Test_L1C_Block_Size();
 	// Test_L2C_Block_Size();
@@ -201,6 +1273,9 @@ int main()
 	// Test_Cache_Write_Policy();
 	// Test_Cache_Swap_Method();
 	Test_TLB_Size();
+	Test_Load_Latency();
+	Test_Bandwidth();
+	Test_Huge_TLB();
 	
 	return 0;
 }